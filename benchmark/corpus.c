@@ -0,0 +1,120 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "corpus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "helper.h"
+#include "string_set.h"
+
+static char* readFile(const char* path, size_t* size)
+{
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char* buffer = malloc(*size + 1);
+	if (buffer != NULL && fread(buffer, 1, *size, file) != *size) {
+		free(buffer);
+		buffer = NULL;
+	}
+	fclose(file);
+	return buffer;
+}
+
+static int collectIdentifiers(const char* buffer, size_t size,
+                              struct IdentifierCorpus* corpus)
+{
+	size_t i = 0;
+	while (i < size) {
+		if (!isAlphabetic(buffer[i])) {
+			// skip numbers as a whole so their suffixes are not counted
+			while (i < size && isAlphaNumeric(buffer[i])) {
+				i++;
+			}
+			i += i < size;
+			continue;
+		}
+		size_t start = i;
+		while (i < size && isAlphaNumeric(buffer[i])) {
+			i++;
+		}
+		if (corpus->num == corpus->capacity) {
+			int capacity = MAX(corpus->capacity * 2, 1024);
+			struct Identifier* identifiers = realloc(
+			    corpus->identifiers, sizeof(*identifiers) * capacity);
+			if (identifiers == NULL) {
+				return -1;
+			}
+			corpus->identifiers = identifiers;
+			corpus->capacity = capacity;
+		}
+		struct Identifier* identifier = &corpus->identifiers[corpus->num++];
+		identifier->string = buffer + start;
+		identifier->length = i - start;
+		identifier->hash = hashSubstring(identifier->string, i - start);
+	}
+	return 0;
+}
+
+int loadIdentifierCorpus(struct IdentifierCorpus* corpus, int num_files,
+                         const char** files)
+{
+	corpus->identifiers = NULL;
+	corpus->num = 0;
+	corpus->capacity = 0;
+	corpus->num_buffers = 0;
+	corpus->buffers = calloc(num_files, sizeof(*corpus->buffers));
+	if (corpus->buffers == NULL) {
+		return -1;
+	}
+	for (int i = 0; i < num_files; i++) {
+		size_t size;
+		char* buffer = readFile(files[i], &size);
+		if (buffer == NULL) {
+			fprintf(stderr, "Could not read %s\n", files[i]);
+			return -1;
+		}
+		corpus->buffers[corpus->num_buffers++] = buffer;
+		if (collectIdentifiers(buffer, size, corpus) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void freeIdentifierCorpus(struct IdentifierCorpus* corpus)
+{
+	for (int i = 0; i < corpus->num_buffers; i++) {
+		free(corpus->buffers[i]);
+	}
+	free(corpus->buffers);
+	free(corpus->identifiers);
+}
+
+double now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
@@ -0,0 +1,43 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdint.h>
+
+struct Identifier {
+	const char* string;
+	int length;
+	uint32_t hash;
+};
+
+// All identifiers of a set of source files, in order of appearance
+struct IdentifierCorpus {
+	struct Identifier* identifiers;
+	int num;
+	int capacity;
+	char** buffers;
+	int num_buffers;
+};
+
+int loadIdentifierCorpus(struct IdentifierCorpus* corpus, int num_files,
+                         const char** files);
+
+void freeIdentifierCorpus(struct IdentifierCorpus* corpus);
+
+double now(void);
+
+#endif
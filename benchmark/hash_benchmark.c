@@ -0,0 +1,150 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compares the available hash functions on the identifiers of real source
+// files. Reports the throughput and how many collisions each function
+// produces, both for the full 32 bit hash and for the buckets of a table
+// with a load factor of 0.5.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "corpus.h"
+#include "hash.h"
+#include "memory/allocator.h"
+#include "string_set.h"
+
+#define NUM_ROUNDS 20
+
+static int compareHashes(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static int countFullCollisions(uint32_t* hashes, int num)
+{
+	qsort(hashes, num, sizeof(*hashes), compareHashes);
+	int collisions = 0;
+	for (int i = 1; i < num; i++) {
+		collisions += hashes[i] == hashes[i - 1];
+	}
+	return collisions;
+}
+
+// Counts the keys that land in an already occupied bucket
+static int countBucketCollisions(const uint32_t* hashes, int num,
+                                 uint32_t num_buckets, uint8_t* occupied)
+{
+	int collisions = 0;
+	for (uint32_t i = 0; i < num_buckets; i++) {
+		occupied[i] = 0;
+	}
+	for (int i = 0; i < num; i++) {
+		uint32_t bucket = hashes[i] & (num_buckets - 1);
+		collisions += occupied[bucket];
+		occupied[bucket] = 1;
+	}
+	return collisions;
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <source files>\n", argv[0]);
+		return 1;
+	}
+	struct IdentifierCorpus corpus;
+	if (loadIdentifierCorpus(&corpus, argc - 1, argv + 1) != 0) {
+		return 1;
+	}
+	struct StringSet distinct;
+	if (initStringSet(&distinct, 4096 << 2, 1024, getGlobalAllocator()) != 0) {
+		return 1;
+	}
+	size_t num_bytes = 0;
+	for (int i = 0; i < corpus.num; i++) {
+		const struct Identifier* identifier = &corpus.identifiers[i];
+		addStringAndHash(&distinct, identifier->string, identifier->length,
+		                 identifier->hash, NULL);
+		num_bytes += identifier->length;
+	}
+	int num_distinct = getStringCount(&distinct);
+	uint32_t num_buckets = 1;
+	while (num_buckets < 2 * (uint32_t)num_distinct) {
+		num_buckets <<= 1;
+	}
+	uint32_t* hashes = malloc(sizeof(*hashes) * num_distinct);
+	uint8_t* occupied = malloc(num_buckets);
+	if (hashes == NULL || occupied == NULL) {
+		return 1;
+	}
+	// expected number of bucket collisions of a random function
+	double expected =
+	    num_distinct -
+	    num_buckets * (1.0 - pow(1.0 - 1.0 / num_buckets, num_distinct));
+	printf("identifiers: %d, distinct: %d, bytes: %zu, buckets: %u\n",
+	       corpus.num, num_distinct, num_bytes, num_buckets);
+	printf("expected bucket collisions of a random function: %.0f\n",
+	       expected);
+
+	for (int f = 0; f < num_hash_functions; f++) {
+		HashFunction hash = hash_functions[f].function;
+		volatile uint32_t sink = 0;
+		double start = now();
+#ifdef HAVE_RDTSC
+		uint64_t start_cycles = __rdtsc();
+#endif
+		for (int round = 0; round < NUM_ROUNDS; round++) {
+			for (int i = 0; i < corpus.num; i++) {
+				const struct Identifier* identifier = &corpus.identifiers[i];
+				sink += hash(identifier->string, identifier->length);
+			}
+		}
+#ifdef HAVE_RDTSC
+		double cycles = __rdtsc() - start_cycles;
+#endif
+		double seconds = now() - start;
+		double total_bytes = (double)num_bytes * NUM_ROUNDS;
+
+		for (int i = 0; i < num_distinct; i++) {
+			hashes[i] = hash(getStringAt(&distinct, i), getLengthAt(&distinct, i));
+		}
+		int bucket_collisions =
+		    countBucketCollisions(hashes, num_distinct, num_buckets, occupied);
+		int full_collisions = countFullCollisions(hashes, num_distinct);
+
+		printf("%-8s %6.3f ns/byte", hash_functions[f].name,
+		       seconds * 1e9 / total_bytes);
+#ifdef HAVE_RDTSC
+		printf(" %6.3f cycles/byte", cycles / total_bytes);
+#endif
+		printf(", full collisions: %d, bucket collisions: %d\n",
+		       full_collisions, bucket_collisions);
+	}
+
+	free(hashes);
+	free(occupied);
+	cleanupStringSet(&distinct);
+	freeIdentifierCorpus(&corpus);
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures identifier interning on real source files. The same program is
+// built with SIMD and with scalar group probing of the string set.
+
+#include <stdio.h>
+
+#include "corpus.h"
+#include "memory/allocator.h"
+#include "string_set.h"
+
+#define NUM_ROUNDS 20
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <source files>\n", argv[0]);
+		return 1;
+	}
+	struct IdentifierCorpus corpus;
+	if (loadIdentifierCorpus(&corpus, argc - 1, argv + 1) != 0) {
+		return 1;
+	}
+
+	double total = 0;
+	int num_strings = 0;
+	volatile int checksum = 0;
+	for (int round = 0; round < NUM_ROUNDS; round++) {
+		struct StringSet set;
+		if (initStringSet(&set, 4096 << 2, 1024, getGlobalAllocator()) != 0) {
+			return 1;
+		}
+		double start = now();
+		for (int i = 0; i < corpus.num; i++) {
+			const struct Identifier* identifier = &corpus.identifiers[i];
+			checksum += addStringAndHash(&set, identifier->string,
+			                             identifier->length, identifier->hash,
+			                             NULL);
+		}
+		total += now() - start;
+		num_strings = getStringCount(&set);
+		cleanupStringSet(&set);
+	}
+#if defined(__SSE2__) && !defined(STRING_SET_SCALAR_PROBE)
+	const char* probe = "sse2";
+#else
+	const char* probe = "scalar";
+#endif
+	double lookups = (double)corpus.num * NUM_ROUNDS;
+	printf("probe: %s, identifiers: %d, distinct: %d, %.2f ns/lookup\n", probe,
+	       corpus.num, num_strings, total * 1e9 / lookups);
+
+	freeIdentifierCorpus(&corpus);
+	return 0;
+}
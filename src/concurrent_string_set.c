@@ -0,0 +1,389 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "concurrent_string_set.h"
+
+#include <string.h>
+
+#include "memory/allocator.h"
+
+#define CONCURRENT_STRING_SET_CHUNK_SIZE (4096 << 4)
+#define CONCURRENT_STRING_SET_MIN_SLOTS 16
+
+struct ConcurrentStringSetEntry {
+	const char* string;
+	uint32_t length;
+	uint32_t hash;
+};
+
+// A slot holds the index of its string plus one, zero marks an empty slot
+struct ConcurrentStringSetTable {
+	struct ConcurrentStringSetTable* next;
+	uint32_t mask;
+	atomic_uint slots[];
+};
+
+struct ConcurrentStringSetChunk {
+	struct ConcurrentStringSetChunk* next;
+	uint32_t size;
+	char data[];
+};
+
+// The shard is taken from the upper bits of the mixed hash, the first slot
+// from the lower bits
+static inline uint64_t mixHash(uint32_t hash)
+{
+	return hash * 0x9e3779b97f4a7c15ull;
+}
+
+static inline struct ConcurrentStringSetShard* getShard(
+    struct ConcurrentStringSet* set, uint32_t hash)
+{
+	int shard = mixHash(hash) >> (64 - CONCURRENT_STRING_SET_SHARD_BITS);
+	return &set->shards[shard];
+}
+
+static inline uint32_t getFirstSlot(
+    const struct ConcurrentStringSetTable* table, uint32_t hash)
+{
+	return (uint32_t)mixHash(hash) & table->mask;
+}
+
+// Segment i holds the indices starting at (2^i - 1) << SEGMENT_BITS
+static inline int getSegment(uint32_t index)
+{
+	uint32_t block = (index >> CONCURRENT_STRING_SET_SEGMENT_BITS) + 1;
+	return 31 - __builtin_clz(block);
+}
+
+static inline uint32_t getSegmentStart(int segment)
+{
+	return ((1u << segment) - 1) << CONCURRENT_STRING_SET_SEGMENT_BITS;
+}
+
+static inline uint32_t getSegmentSize(int segment)
+{
+	return 1u << (segment + CONCURRENT_STRING_SET_SEGMENT_BITS);
+}
+
+static struct ConcurrentStringSetEntry* getEntry(
+    struct ConcurrentStringSet* set, uint32_t index)
+{
+	int segment = getSegment(index);
+	struct ConcurrentStringSetEntry* entries =
+	    atomic_load_explicit(&set->segments[segment], memory_order_acquire);
+	return &entries[index - getSegmentStart(segment)];
+}
+
+// Segments are allocated by whichever thread needs them first, a thread that
+// loses the race frees its copy again
+static struct ConcurrentStringSetEntry* getOrCreateEntry(
+    struct ConcurrentStringSet* set, uint32_t index)
+{
+	int segment = getSegment(index);
+	struct ConcurrentStringSetEntry* entries =
+	    atomic_load_explicit(&set->segments[segment], memory_order_acquire);
+	if (entries == NULL) {
+		struct ConcurrentStringSetEntry* new_entries =
+		    ALLOCATE_TYPE(set->parent_allocator, getSegmentSize(segment),
+		                  struct ConcurrentStringSetEntry);
+		if (new_entries == NULL) {
+			return NULL;
+		}
+		if (atomic_compare_exchange_strong_explicit(
+		        &set->segments[segment], &entries, new_entries,
+		        memory_order_acq_rel, memory_order_acquire)) {
+			entries = new_entries;
+		} else {
+			deallocate(set->parent_allocator, new_entries);
+		}
+	}
+	return &entries[index - getSegmentStart(segment)];
+}
+
+static struct ConcurrentStringSetTable* allocateTable(
+    struct ConcurrentStringSet* set, uint32_t num_slots)
+{
+	struct ConcurrentStringSetTable* table =
+	    allocate(set->parent_allocator,
+	             sizeof(*table) + sizeof(atomic_uint) * num_slots);
+	if (table == NULL) {
+		return NULL;
+	}
+	table->next = NULL;
+	table->mask = num_slots - 1;
+	for (uint32_t i = 0; i < num_slots; i++) {
+		atomic_init(&table->slots[i], 0);
+	}
+	return table;
+}
+
+static void freeTables(struct ConcurrentStringSet* set,
+                       struct ConcurrentStringSetTable* table)
+{
+	while (table != NULL) {
+		struct ConcurrentStringSetTable* next = table->next;
+		deallocate(set->parent_allocator, table);
+		table = next;
+	}
+}
+
+int initConcurrentStringSet(struct ConcurrentStringSet* set, int max_strings,
+                            struct Allocator* allocator)
+{
+	set->parent_allocator = allocator;
+	atomic_init(&set->num, 0);
+	for (int i = 0; i < CONCURRENT_STRING_SET_MAX_SEGMENTS; i++) {
+		atomic_init(&set->segments[i], NULL);
+	}
+	// keep every shard at most half full
+	uint32_t num_slots = CONCURRENT_STRING_SET_MIN_SLOTS;
+	while (num_slots * CONCURRENT_STRING_SET_NUM_SHARDS < 2u * max_strings) {
+		num_slots <<= 1;
+	}
+	int num_initialized = 0;
+	for (; num_initialized < CONCURRENT_STRING_SET_NUM_SHARDS;
+	     num_initialized++) {
+		struct ConcurrentStringSetShard* shard = &set->shards[num_initialized];
+		struct ConcurrentStringSetTable* table = allocateTable(set, num_slots);
+		if (table == NULL) {
+			break;
+		}
+		if (pthread_mutex_init(&shard->lock, NULL) != 0) {
+			deallocate(allocator, table);
+			break;
+		}
+		atomic_init(&shard->table, table);
+		shard->retired = NULL;
+		shard->chunks = NULL;
+		shard->offset = 0;
+		shard->num = 0;
+	}
+	if (num_initialized < CONCURRENT_STRING_SET_NUM_SHARDS) {
+		for (int i = 0; i < num_initialized; i++) {
+			pthread_mutex_destroy(&set->shards[i].lock);
+			freeTables(set, atomic_load(&set->shards[i].table));
+		}
+		return -1;
+	}
+	return 0;
+}
+
+void cleanupConcurrentStringSet(struct ConcurrentStringSet* set)
+{
+	for (int i = 0; i < CONCURRENT_STRING_SET_NUM_SHARDS; i++) {
+		struct ConcurrentStringSetShard* shard = &set->shards[i];
+		pthread_mutex_destroy(&shard->lock);
+		freeTables(set, atomic_load(&shard->table));
+		freeTables(set, shard->retired);
+		struct ConcurrentStringSetChunk* chunk = shard->chunks;
+		while (chunk != NULL) {
+			struct ConcurrentStringSetChunk* next = chunk->next;
+			deallocate(set->parent_allocator, chunk);
+			chunk = next;
+		}
+	}
+	for (int i = 0; i < CONCURRENT_STRING_SET_MAX_SEGMENTS; i++) {
+		struct ConcurrentStringSetEntry* entries =
+		    atomic_load(&set->segments[i]);
+		if (entries != NULL) {
+			deallocate(set->parent_allocator, entries);
+		}
+	}
+}
+
+// The slot is loaded with acquire semantics, which makes the entry it points
+// to visible
+static int probe(struct ConcurrentStringSet* set,
+                 struct ConcurrentStringSetTable* table,
+                 const char* string, int length, uint32_t hash)
+{
+	for (uint32_t slot = getFirstSlot(table, hash);;
+	     slot = (slot + 1) & table->mask) {
+		uint32_t value =
+		    atomic_load_explicit(&table->slots[slot], memory_order_acquire);
+		if (value == 0) {
+			return -1;
+		}
+		const struct ConcurrentStringSetEntry* entry = getEntry(set, value - 1);
+		if (entry->hash == hash && entry->length == (uint32_t)length &&
+		    memcmp(entry->string, string, length) == 0) {
+			return value - 1;
+		}
+	}
+}
+
+static void insertSlot(struct ConcurrentStringSetTable* table, uint32_t hash,
+                       uint32_t value)
+{
+	uint32_t slot = getFirstSlot(table, hash);
+	while (atomic_load_explicit(&table->slots[slot], memory_order_relaxed) !=
+	       0) {
+		slot = (slot + 1) & table->mask;
+	}
+	atomic_store_explicit(&table->slots[slot], value, memory_order_release);
+}
+
+// Called with the shard locked. Readers keep probing the old table until they
+// see the new one, so the old table is only retired.
+static int growTable(struct ConcurrentStringSet* set,
+                     struct ConcurrentStringSetShard* shard)
+{
+	struct ConcurrentStringSetTable* table =
+	    atomic_load_explicit(&shard->table, memory_order_relaxed);
+	uint32_t num_slots = table->mask + 1;
+	if ((uint32_t)shard->num + 1 <= num_slots / 2) {
+		return 0;
+	}
+	struct ConcurrentStringSetTable* new_table =
+	    allocateTable(set, num_slots * 2);
+	if (new_table == NULL) {
+		return -1;
+	}
+	for (uint32_t i = 0; i < num_slots; i++) {
+		uint32_t value =
+		    atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+		if (value != 0) {
+			insertSlot(new_table, getEntry(set, value - 1)->hash, value);
+		}
+	}
+	atomic_store_explicit(&shard->table, new_table, memory_order_release);
+	table->next = shard->retired;
+	shard->retired = table;
+	return 0;
+}
+
+// Called with the shard locked. Long strings get a chunk of their own, which
+// is linked behind the current chunk so that it can still be filled.
+static char* copyString(struct ConcurrentStringSet* set,
+                        struct ConcurrentStringSetShard* shard,
+                        const char* string, int length)
+{
+	uint32_t size = length + 1;
+	struct ConcurrentStringSetChunk* chunk = shard->chunks;
+	bool own_chunk = size > CONCURRENT_STRING_SET_CHUNK_SIZE / 4;
+	if (own_chunk || chunk == NULL || shard->offset + size > chunk->size) {
+		uint32_t chunk_size =
+		    own_chunk ? size : CONCURRENT_STRING_SET_CHUNK_SIZE;
+		chunk = allocate(set->parent_allocator, sizeof(*chunk) + chunk_size);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk->size = chunk_size;
+		if (own_chunk && shard->chunks != NULL) {
+			chunk->next = shard->chunks->next;
+			shard->chunks->next = chunk;
+		} else {
+			chunk->next = shard->chunks;
+			shard->chunks = chunk;
+			shard->offset = own_chunk ? size : 0;
+		}
+		if (own_chunk) {
+			memcpy(chunk->data, string, length);
+			chunk->data[length] = '\0';
+			return chunk->data;
+		}
+	}
+	char* copy = chunk->data + shard->offset;
+	memcpy(copy, string, length);
+	copy[length] = '\0';
+	shard->offset += size;
+	return copy;
+}
+
+// An index is only taken once the segment for it exists, so a failed
+// allocation does not leave a hole in the indices
+static struct ConcurrentStringSetEntry* reserveEntry(
+    struct ConcurrentStringSet* set, int* index)
+{
+	int num = atomic_load_explicit(&set->num, memory_order_relaxed);
+	while (true) {
+		struct ConcurrentStringSetEntry* entry = getOrCreateEntry(set, num);
+		if (entry == NULL) {
+			return NULL;
+		}
+		if (atomic_compare_exchange_weak_explicit(&set->num, &num, num + 1,
+		                                          memory_order_relaxed,
+		                                          memory_order_relaxed)) {
+			*index = num;
+			return entry;
+		}
+	}
+}
+
+int internConcurrentString(struct ConcurrentStringSet* set, const char* string,
+                           int length, uint32_t hash, bool* exists)
+{
+	struct ConcurrentStringSetShard* shard = getShard(set, hash);
+	int index = probe(set,
+	                  atomic_load_explicit(&shard->table, memory_order_acquire),
+	                  string, length, hash);
+	if (index < 0) {
+		pthread_mutex_lock(&shard->lock);
+		// another thread may have added the string in the meantime
+		index = probe(set,
+		              atomic_load_explicit(&shard->table, memory_order_relaxed),
+		              string, length, hash);
+		if (index < 0) {
+			if (exists) {
+				*exists = false;
+			}
+			char* copy = NULL;
+			struct ConcurrentStringSetEntry* entry = NULL;
+			if (growTable(set, shard) == 0) {
+				copy = copyString(set, shard, string, length);
+			}
+			if (copy != NULL) {
+				entry = reserveEntry(set, &index);
+			}
+			if (entry == NULL) {
+				pthread_mutex_unlock(&shard->lock);
+				return -1;
+			}
+			entry->string = copy;
+			entry->length = length;
+			entry->hash = hash;
+			struct ConcurrentStringSetTable* table =
+			    atomic_load_explicit(&shard->table, memory_order_relaxed);
+			insertSlot(table, hash, index + 1);
+			shard->num++;
+			pthread_mutex_unlock(&shard->lock);
+			return index;
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+	if (exists) {
+		*exists = true;
+	}
+	return index;
+}
+
+int findConcurrentString(struct ConcurrentStringSet* set, const char* string,
+                         int length, uint32_t hash)
+{
+	struct ConcurrentStringSetShard* shard = getShard(set, hash);
+	return probe(set, atomic_load_explicit(&shard->table, memory_order_acquire),
+	             string, length, hash);
+}
+
+const char* getConcurrentStringAt(struct ConcurrentStringSet* set, int index)
+{
+	return getEntry(set, index)->string;
+}
+
+int getConcurrentLengthAt(struct ConcurrentStringSet* set, int index)
+{
+	return getEntry(set, index)->length;
+}
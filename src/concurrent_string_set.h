@@ -0,0 +1,91 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONCURRENT_STRING_SET_H
+#define CONCURRENT_STRING_SET_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct Allocator;
+struct ConcurrentStringSetEntry;
+struct ConcurrentStringSetTable;
+struct ConcurrentStringSetChunk;
+
+#define CONCURRENT_STRING_SET_SHARD_BITS 4
+#define CONCURRENT_STRING_SET_NUM_SHARDS (1 << CONCURRENT_STRING_SET_SHARD_BITS)
+#define CONCURRENT_STRING_SET_SEGMENT_BITS 10
+#define CONCURRENT_STRING_SET_MAX_SEGMENTS 22
+
+// Every shard owns an open addressing table and the characters of its
+// strings. Inserts lock only the shard the hash selects, lookups never lock.
+// A table that grows is replaced by publishing a new one, the old table is
+// kept until cleanup because a reader may still be probing it.
+struct ConcurrentStringSetShard {
+	pthread_mutex_t lock;
+	_Atomic(struct ConcurrentStringSetTable*) table;
+	struct ConcurrentStringSetTable* retired;
+	struct ConcurrentStringSetChunk* chunks;
+	// write position in the first chunk
+	uint32_t offset;
+	int num;
+};
+
+// A string set that many threads can intern into at the same time. Indices
+// are handed out from one counter, so they are dense, globally unique and
+// never change: threads can compare interned strings by index. The entries
+// live in segments of doubling size which are never moved, so an index can be
+// resolved without locking while other threads insert.
+//
+// The allocator has to be safe to use from multiple threads.
+struct ConcurrentStringSet {
+	struct Allocator* parent_allocator;
+	struct ConcurrentStringSetShard shards[CONCURRENT_STRING_SET_NUM_SHARDS];
+	_Atomic(struct ConcurrentStringSetEntry*)
+	    segments[CONCURRENT_STRING_SET_MAX_SEGMENTS];
+	atomic_int num;
+};
+
+// The number of strings is only an initial capacity
+int initConcurrentStringSet(struct ConcurrentStringSet* set, int max_strings,
+                            struct Allocator* allocator);
+
+// Must not race with any other operation on the set
+void cleanupConcurrentStringSet(struct ConcurrentStringSet* set);
+
+// Returns the index of the string, adding it if it is not in the set yet, or
+// -1 if memory runs out. Safe to call from any number of threads.
+int internConcurrentString(struct ConcurrentStringSet* set, const char* string,
+                           int length, uint32_t hash, bool* exists);
+
+int findConcurrentString(struct ConcurrentStringSet* set, const char* string,
+                         int length, uint32_t hash);
+
+// The index has to come from this set, either from the thread itself or
+// passed on from another thread with proper synchronization
+const char* getConcurrentStringAt(struct ConcurrentStringSet* set, int index);
+
+int getConcurrentLengthAt(struct ConcurrentStringSet* set, int index);
+
+// Counts indices that were handed out, including strings whose insertion
+// is still in progress on another thread
+static inline int getConcurrentStringCount(struct ConcurrentStringSet* set)
+{
+	return atomic_load_explicit(&set->num, memory_order_acquire);
+}
+
+#endif
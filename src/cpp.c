@@ -22,13 +22,16 @@
 #include "lexer.h"
 #include "memory/linear_allocator.h"
 #include "string_set.h"
+#include "token_paste.h"
 
 #define SCRATCHPAD_SIZE (4096 << 0)
 
 enum ExpansionResult {
 	EXPANSION_RESULT_TOKEN = 0,
 	EXPANSION_RESULT_ERROR = 1,
-	EXPANSION_RESULT_CONTINUE = 2
+	EXPANSION_RESULT_CONTINUE = 2,
+	// an invocation continues in the input
+	EXPANSION_RESULT_INPUT = 3
 };
 
 static struct TokenIterator* allocateIterators(struct PreprocessorState* state,
@@ -39,13 +42,223 @@ static struct TokenIterator* allocateIterators(struct PreprocessorState* state,
 }
 
 static int expand(struct PreprocessorState* state,
-                  struct StringSet* identifiers,
                   struct PreprocessorToken* token);
 
-int initPreprocessorState(struct PreprocessorState* state)
+static bool substituteOperators(struct PreprocessorState* state,
+                                struct TokenIterator* it,
+                                const struct ParamContext* params,
+                                bool function_like);
+
+static int addToNameFilter(struct MacroNameFilter* filter, int identifier)
+{
+	int word = identifier >> 6;
+	if (word >= filter->num_words) {
+		int num_words = filter->num_words > 0 ? filter->num_words : 1;
+		while (num_words <= word) {
+			num_words *= 2;
+		}
+		uint64_t* words = reallocate(getGlobalAllocator(), filter->words,
+		                             sizeof(*words) * num_words);
+		if (words == NULL) {
+			return -1;
+		}
+		memset(words + filter->num_words, 0,
+		       sizeof(*words) * (num_words - filter->num_words));
+		filter->words = words;
+		filter->num_words = num_words;
+	}
+	filter->words[word] |= UINT64_C(1) << (identifier & 63);
+	return 0;
+}
+
+// Returns the cache entry of a definition or NULL if there is not enough
+// memory
+static struct ExpansionCacheEntry* getExpansionCacheEntry(
+    struct PreprocessorState* state, int index)
+{
+	struct ExpansionCache* cache = &state->expansion_cache;
+	if (index >= cache->max_entries) {
+		int max_entries = state->definitions.max_definitions;
+		if (max_entries <= index) {
+			max_entries = index + 1;
+		}
+		struct ExpansionCacheEntry* entries =
+		    reallocate(getGlobalAllocator(), cache->entries,
+		               sizeof(*entries) * max_entries);
+		if (entries == NULL) {
+			return NULL;
+		}
+		cache->entries = entries;
+		cache->max_entries = max_entries;
+	}
+	while (cache->num <= index) {
+		cache->entries[cache->num++].depends = -1;
+	}
+	return &cache->entries[index];
+}
+
+static bool containsName(const struct ExpansionCache* cache,
+                         const struct ExpansionCacheEntry* entry,
+                         int identifier)
+{
+	const struct PreprocessorToken* tokens =
+	    &cache->tokens.tokens[entry->token_start];
+	for (int i = 0; i < entry->num_tokens; i++) {
+		if (tokens[i].type == IDENTIFIER &&
+		    tokens[i].value_handle == (uint32_t)identifier) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Drops the cached expansions which expanded the macro or contain its name.
+// Has to be called before the macro is defined, redefined or undefined.
+static void invalidateExpansionCache(struct PreprocessorState* state,
+                                     int identifier)
+{
+	struct ExpansionCache* cache = &state->expansion_cache;
+	bool expanded = mayBeMacroName(state, identifier);
+	bool contained = isInNameFilter(&cache->names, identifier);
+	if (!expanded && !contained) {
+		return;
+	}
+	for (int i = 0; i < cache->num; i++) {
+		struct ExpansionCacheEntry* entry = &cache->entries[i];
+		if (entry->depends < 0) {
+			continue;
+		}
+		if ((expanded && isInHideSet(&state->hide_sets, entry->depends,
+		                             identifier)) ||
+		    (contained && containsName(cache, entry, identifier))) {
+			entry->depends = -1;
+		}
+	}
+}
+
+// Returns the cached expansion of an object like macro if it does not depend
+// on a macro that is hidden in the context
+static const struct ExpansionCacheEntry* findCachedExpansion(
+    struct PreprocessorState* state,
+    const struct PreprocessorDefinition* definition, int hide_set)
+{
+	int index = definition - state->definitions.definitions;
+	const struct ExpansionCache* cache = &state->expansion_cache;
+	if (isFunctionLike(definition) || index >= cache->num) {
+		return NULL;
+	}
+	const struct ExpansionCacheEntry* entry = &cache->entries[index];
+	if (entry->depends < 0 ||
+	    !areHideSetsDisjoint(&state->hide_sets, entry->depends, hide_set)) {
+		return NULL;
+	}
+	return entry;
+}
+
+// Adds macros to the dependencies of the expansion that is being cached
+static int recordDependencies(struct PreprocessorState* state, int hide_set)
+{
+	struct PreprocessorExpansionState* expansion_state =
+	    &state->expansion_state;
+	if (expansion_state->dependencies < 0) {
+		return 0;
+	}
+	int dependencies = mergeHideSets(
+	    &state->hide_sets, expansion_state->dependencies, hide_set);
+	if (dependencies < 0) {
+		generalError("not enough memory to expand macro");
+		return -1;
+	}
+	expansion_state->dependencies = dependencies;
+	return 0;
+}
+
+// Stores the tokens of an expansion in the cache. If there is no room for
+// them, the tokens of the valid entries are moved to a new buffer and those of
+// invalidated entries are dropped.
+static bool storeCachedTokens(struct PreprocessorState* state,
+                              struct ExpansionCacheEntry* entry,
+                              const struct PreprocessorToken* tokens,
+                              int num_tokens)
+{
+	struct ExpansionCache* cache = &state->expansion_cache;
+	struct PreprocessorTokenSet* set = &cache->tokens;
+	if (set->num + num_tokens > set->max_tokens) {
+		int num_valid = num_tokens;
+		for (int i = 0; i < cache->num; i++) {
+			if (cache->entries[i].depends >= 0) {
+				num_valid += cache->entries[i].num_tokens;
+			}
+		}
+		int max_tokens = set->max_tokens;
+		if (max_tokens == 0) {
+			max_tokens = PREPROCESSOR_EXPANSION_CACHE_SIZE;
+		}
+		// leave room for more entries before the next compaction
+		while (max_tokens < num_valid * 2) {
+			max_tokens *= 2;
+		}
+		struct PreprocessorToken* compacted =
+		    ALLOCATE_TYPE(getGlobalAllocator(), max_tokens,
+		                  struct PreprocessorToken);
+		if (compacted == NULL) {
+			return false;
+		}
+		int num = 0;
+		for (int i = 0; i < cache->num; i++) {
+			struct ExpansionCacheEntry* valid = &cache->entries[i];
+			if (valid->depends < 0) {
+				continue;
+			}
+			memcpy(&compacted[num], &set->tokens[valid->token_start],
+			       sizeof(*compacted) * valid->num_tokens);
+			valid->token_start = num;
+			num += valid->num_tokens;
+		}
+		deallocate(getGlobalAllocator(), set->tokens);
+		set->tokens = compacted;
+		set->num = num;
+		set->max_tokens = max_tokens;
+	}
+	memcpy(&set->tokens[set->num], tokens, sizeof(*tokens) * num_tokens);
+	entry->token_start = set->num;
+	entry->num_tokens = num_tokens;
+	set->num += num_tokens;
+	return true;
+}
+
+// Copies a cached expansion behind the other tokens of the expansion, where
+// it is read like a replacement. Returns false if there is no room for it.
+static bool copyCachedTokens(struct PreprocessorState* state,
+                             const struct ExpansionCacheEntry* entry,
+                             struct TokenIterator* it)
+{
+	struct PreprocessorTokenSet* tokens = &state->tokens;
+	if (tokens->num + entry->num_tokens > tokens->max_tokens) {
+		return false;
+	}
+	memcpy(&tokens->tokens[tokens->num],
+	       &state->expansion_cache.tokens.tokens[entry->token_start],
+	       sizeof(*tokens->tokens) * entry->num_tokens);
+	it->start = tokens->num;
+	it->cur = tokens->num;
+	it->end = tokens->num + entry->num_tokens - 1;
+	tokens->num += entry->num_tokens;
+	return true;
+}
+
+int initPreprocessorState(struct PreprocessorState* state,
+                          struct IdentifierTable* identifiers,
+                          struct StringSet* string_literals,
+                          struct StringSet* pp_numbers,
+                          struct LexerConstantSet* constants)
 {
 	struct Allocator* global_allocator = getGlobalAllocator();
 	memset(state, 0, sizeof(*state));
+	state->identifiers = identifiers;
+	state->string_literals = string_literals;
+	state->pp_numbers = pp_numbers;
+	state->constants = constants;
 
 	struct MemoryArena* arena =
 	    allocateArena(global_allocator, SCRATCHPAD_SIZE);
@@ -60,13 +273,40 @@ int initPreprocessorState(struct PreprocessorState* state)
 		cleanupPreprocessorState(state);
 		return -1;
 	}
-	if (createPreprocessorDefinitionSet(
-	        &state->definitions, PREPROCESSOR_MAX_DEFINITION_COUNT,
-	        LEXER_PP_NUMBER_STRINGSET_SIZE, global_allocator) != 0) {
+	if (createPreprocessorTokenSet(&state->argument_tokens,
+	                               PREPROCESSOR_MAX_ARGUMENT_TOKEN_COUNT,
+	                               global_allocator) != 0) {
+		cleanupPreprocessorState(state);
+		return -1;
+	}
+	if (createPreprocessorDefinitionSet(&state->definitions,
+	                                    PREPROCESSOR_MAX_DEFINITION_COUNT,
+	                                    global_allocator) != 0) {
+		cleanupPreprocessorState(state);
+		return -1;
+	}
+	int num_words = PREPROCESSOR_MACRO_NAME_FILTER_SIZE / 64;
+	state->macro_names.words = ALLOCATE_TYPE(global_allocator, num_words,
+	                                         typeof(*state->macro_names.words));
+	if (state->macro_names.words == NULL) {
+		cleanupPreprocessorState(state);
+		return -1;
+	}
+	memset(state->macro_names.words, 0,
+	       sizeof(*state->macro_names.words) * num_words);
+	state->macro_names.num_words = num_words;
+	if (initHideSetTable(&state->hide_sets, global_allocator) != 0) {
+		cleanupPreprocessorState(state);
+		return -1;
+	}
+	state->paste_buffer =
+	    allocate(global_allocator, PREPROCESSOR_PASTE_BUFFER_SIZE);
+	if (state->paste_buffer == NULL) {
 		cleanupPreprocessorState(state);
 		return -1;
 	}
 
+	state->expansion_state.dependencies = -1;
 	state->expansion_state.expansion_stack = allocate(
 	    global_allocator, sizeof(*state->expansion_state.expansion_stack) *
 	                          PREPROCESSOR_MAX_EXPANSION_DEPTH);
@@ -79,12 +319,46 @@ void cleanupPreprocessorState(struct PreprocessorState* state)
 	struct Allocator* global_allocator = getGlobalAllocator();
 
 	deallocate(global_allocator, state->expansion_state.expansion_stack);
+	deallocate(global_allocator, state->paste_buffer);
+	cleanupHideSetTable(&state->hide_sets);
+	deallocate(global_allocator, state->expansion_cache.names.words);
+	deallocate(global_allocator, state->expansion_cache.tokens.tokens);
+	deallocate(global_allocator, state->expansion_cache.entries);
+	deallocate(global_allocator, state->macro_names.words);
 	deallocate(global_allocator, state->definitions.definitions);
-	cleanupStringSet(&state->definitions.pp_definition_names);
+	deallocate(global_allocator, state->argument_tokens.tokens);
 	deallocate(global_allocator, state->tokens.tokens);
 	cleanupLinearAllocator(&state->allocator);
 }
 
+void resetPreprocessorState(struct PreprocessorState* state)
+{
+	state->tokens.num = 0;
+	state->argument_tokens.num = 0;
+	state->definitions.num = 0;
+	clearIdentifierDefinitions(state->identifiers);
+	memset(state->macro_names.words, 0,
+	       sizeof(*state->macro_names.words) * state->macro_names.num_words);
+	resetHideSetTable(&state->hide_sets);
+	state->expansion_cache.num = 0;
+	state->expansion_cache.tokens.num = 0;
+	if (state->expansion_cache.names.num_words > 0) {
+		memset(state->expansion_cache.names.words, 0,
+		       sizeof(*state->expansion_cache.names.words) *
+		           state->expansion_cache.names.num_words);
+	}
+	state->expansion_state.expansion_depth = 0;
+	state->expansion_state.base_depth = 0;
+	state->expansion_state.token_marker = 0;
+	state->expansion_state.function_like = false;
+	state->expansion_state.variadic = false;
+	state->expansion_state.begin_expansion = false;
+	state->expansion_state.apply_operators = false;
+	state->expansion_state.input_follows = false;
+	state->expansion_state.read_arguments = false;
+	resetLinearAllocator(&state->allocator);
+}
+
 int createPreprocessorTokenSet(struct PreprocessorTokenSet* set,
                                size_t max_tokens, struct Allocator* allocator)
 {
@@ -106,7 +380,6 @@ void createPreprocessorTokenSetFromBuffer(struct PreprocessorTokenSet* set,
 }
 int createPreprocessorDefinitionSet(struct PreprocessorDefinitionSet* set,
                                     size_t max_definitions,
-                                    int pp_definition_stringset_size,
                                     struct Allocator* allocator)
 {
 	set->definitions =
@@ -114,11 +387,9 @@ int createPreprocessorDefinitionSet(struct PreprocessorDefinitionSet* set,
 	if (set->definitions == NULL) {
 		return -1;
 	}
-	if (initStringSet(&set->pp_definition_names, pp_definition_stringset_size,
-	                  max_definitions, allocator) != 0) {
-		deallocate(allocator, set->definitions);
-		return -1;
-	}
+	set->allocator = allocator;
+	set->num = 0;
+	set->max_definitions = max_definitions;
 	return 0;
 }
 
@@ -136,9 +407,12 @@ int addPreprocessorToken(struct PreprocessorState* state,
 	pp_token->column = token->column;
 	pp_token->line_pos = token->line_pos;
 	pp_token->type = token->type;
+	pp_token->flags = 0;
 	if (token->literal) {
 		if (token->type == LITERAL_STRING || token->type == PP_NUMBER) {
 			pp_token->value_handle = token->value.string_index;
+		} else if (token->type == LITERAL_EMBED) {
+			pp_token->value_handle = token->value.embed_index;
 		} else {
 			int index = constants->num;
 			if (index == constants->max_count) {
@@ -150,7 +424,8 @@ int addPreprocessorToken(struct PreprocessorState* state,
 			constants->num++;
 		}
 	}
-	if (token->type == IDENTIFIER) {
+	if (token->type <= KEYWORD_CONSTEVAL) {
+		// keywords keep the index of their name for pasting
 		pp_token->value_handle = token->value.string_index;
 	} else if (token->type == PP_PARAM) {
 		pp_token->value_handle = token->value.param_index;
@@ -172,24 +447,40 @@ int getPreprocessorTokenPos(struct PreprocessorState* state)
 
 int createPreprocessorDefinition(struct PreprocessorState* state,
                                  int start_index, int num_tokens,
-                                 int num_params, const char* name,
-                                 int name_length, bool function_like)
+                                 int num_params, int identifier,
+                                 bool function_like, bool variadic)
 {
 	struct PreprocessorDefinitionSet* definitions = &state->definitions;
+	struct IdentifierInfo* info =
+	    getIdentifierInfo(state->identifiers, identifier);
 
-	int hash = hashSubstring(name, name_length);
-
-	bool exists;
-	int index = addStringAndHash(&definitions->pp_definition_names, name,
-	                             name_length, hash, &exists);
-	if (index < 0) {
-		return -1;
-	}
-	if (exists) {
+	int index = info->definition;
+	invalidateExpansionCache(state, identifier);
+	if (index != IDENTIFIER_NO_DEFINITION) {
 		generalWarning("Macro redefined!");
+	} else {
+		if (addToNameFilter(&state->macro_names, identifier) != 0) {
+			generalError("not enough memory to store macro definition");
+			return -1;
+		}
+		if (definitions->num == definitions->max_definitions) {
+			int max_definitions = definitions->max_definitions * 2;
+			struct PreprocessorDefinition* new_definitions =
+			    reallocate(definitions->allocator, definitions->definitions,
+			               sizeof(*new_definitions) * max_definitions);
+			if (new_definitions == NULL) {
+				generalError("not enough memory to store macro definition");
+				return -1;
+			}
+			definitions->definitions = new_definitions;
+			definitions->max_definitions = max_definitions;
+		}
+		index = definitions->num++;
+		info->definition = index;
 	}
 
 	struct PreprocessorDefinition* def = &definitions->definitions[index];
+	def->name = identifier;
 	def->token_start = start_index;
 	def->num_tokens = num_tokens;
 	def->num_params = num_params;
@@ -197,19 +488,40 @@ int createPreprocessorDefinition(struct PreprocessorState* state,
 	if (function_like) {
 		def->flags |= FUNCTION_LIKE;
 	}
+	if (variadic) {
+		def->flags |= VARIADIC;
+	}
+	// '#' is only an operator in function like macros
+	for (int i = start_index; i < start_index + num_tokens; i++) {
+		int type = state->tokens.tokens[i].type;
+		if (type == PP_CONCAT || (function_like && type == PP_STRINGIFY)) {
+			def->flags |= HAS_OPERATORS;
+			break;
+		}
+	}
 	return index;
 }
 
-struct PreprocessorDefinition* findDefinition(struct PreprocessorState* state,
-                                              const char* name, int length,
-                                              uint32_t hash)
+void undefineMacro(struct PreprocessorState* state, int identifier)
 {
-	int index =
-	    findIndex(&state->definitions.pp_definition_names, name, length, hash);
-	if (index < 0) {
-		return NULL;
+	struct IdentifierInfo* info =
+	    getIdentifierInfo(state->identifiers, identifier);
+	if (info->definition == IDENTIFIER_NO_DEFINITION) {
+		return;
+	}
+	invalidateExpansionCache(state, identifier);
+	info->definition = IDENTIFIER_NO_DEFINITION;
+}
+
+int updateMacroNameFilter(struct PreprocessorState* state)
+{
+	for (int i = 0; i < state->definitions.num; i++) {
+		if (addToNameFilter(&state->macro_names,
+		                    state->definitions.definitions[i].name) != 0) {
+			return -1;
+		}
 	}
-	return &state->definitions.definitions[index];
+	return 0;
 }
 
 static void initTokenIterator(struct TokenIterator* it,
@@ -233,7 +545,7 @@ static struct PreprocessorToken* getTokenAt(struct PreprocessorState* state,
 
 static int pushContext(struct PreprocessorState* state,
                        const struct TokenIterator* it,
-                       const struct ParamContext* params)
+                       const struct ParamContext* params, int hide_set)
 {
 	if (++state->expansion_state.expansion_depth ==
 	    PREPROCESSOR_MAX_EXPANSION_DEPTH) {
@@ -248,15 +560,20 @@ static int pushContext(struct PreprocessorState* state,
 	context->iterator.start = it->start;
 	context->iterator.cur = it->start;
 	context->iterator.end = it->end;
+	context->hide_set = hide_set;
 	if (params != NULL) {
 		int num = params->num_params;
 		context->param.num_params = num;
 		context->param.iterators = params->iterators;
+		context->param.expanded = params->expanded;
 		context->param.parent = params->parent;
+		context->param.hide_set = params->hide_set;
 	} else {
 		context->param.iterators = NULL;
+		context->param.expanded = NULL;
 		context->param.num_params = 0;
 		context->param.parent = NULL;
+		context->param.hide_set = HIDE_SET_EMPTY;
 	}
 	return 0;
 }
@@ -270,8 +587,9 @@ static void popContext(struct PreprocessorState* state)
 	int expansion_depth = state->expansion_state.expansion_depth;
 }
 
-void beginExpansion(struct PreprocessorState* state,
-                    struct PreprocessorDefinition* definition)
+static int beginExpansionWithHideSet(
+    struct PreprocessorState* state,
+    const struct PreprocessorDefinition* definition, int hide_set)
 {
 	struct PreprocessorExpansionState* expansion_state =
 	    &state->expansion_state;
@@ -279,32 +597,181 @@ void beginExpansion(struct PreprocessorState* state,
 	expansion_state->token_marker = state->tokens.num;
 
 	expansion_state->function_like = isFunctionLike(definition);
+	expansion_state->variadic = isVariadic(definition);
 	expansion_state->begin_expansion = true;
 
 	expansion_state->expansion_depth = 0;
+	expansion_state->base_depth = 0;
+	expansion_state->input_follows = false;
+	expansion_state->read_arguments = false;
 
 	struct ExpansionContext* current_context =
 	    &expansion_state->expansion_stack[0];
 
+	current_context->hide_set = hide_set;
 	current_context->param.iterators = NULL;
+	current_context->param.expanded = NULL;
 	current_context->param.parent = NULL;
 	current_context->param.num_params = definition->num_params;
+	current_context->param.hide_set = HIDE_SET_EMPTY;
 
 	initTokenIterator(&current_context->iterator, definition);
+
+	expansion_state->apply_operators = definition->flags & HAS_OPERATORS;
+	if (!isFunctionLike(definition) && !applyMacroOperators(state)) {
+		return -1;
+	}
+	return 0;
+}
+
+// Expands an object like macro completely and stores the result in the
+// cache. Nothing is cached if there is no room for it.
+static bool cacheExpansion(struct PreprocessorState* state,
+                           const struct PreprocessorDefinition* definition,
+                           struct ExpansionCacheEntry* entry, int hide_set)
+{
+	bool status = false;
+	struct PreprocessorExpansionState* expansion_state =
+	    &state->expansion_state;
+	struct PreprocessorTokenSet* buffer = &state->argument_tokens;
+	int num_tokens = -1;
+	int dependencies;
+
+	if (beginExpansionWithHideSet(state, definition, hide_set) != 0) {
+		goto out;
+	}
+	expansion_state->dependencies = hide_set;
+	while (true) {
+		struct PreprocessorToken token;
+		int result = expand(state, &token);
+		if (result == EXPANSION_RESULT_ERROR) {
+			goto out;
+		} else if (result == EXPANSION_RESULT_CONTINUE) {
+			continue;
+		} else if (result == EXPANSION_RESULT_INPUT) {
+			// the expansion depends on the tokens after the macro
+			status = true;
+			goto out;
+		} else if (token.type == TOKEN_EOF) {
+			break;
+		}
+		if (buffer->num == buffer->max_tokens) {
+			status = true;
+			goto out;
+		}
+		buffer->tokens[buffer->num++] = token;
+	}
+	num_tokens = buffer->num;
+	status = true;
+	// the expansion is complete, so it is not rescanned when it is read. Only
+	// the last token can still be a macro invocation with the tokens after it.
+	for (int i = 0; i < num_tokens; i++) {
+		struct PreprocessorToken* token = &buffer->tokens[i];
+		if (token->type != IDENTIFIER) {
+			continue;
+		}
+		if (addToNameFilter(&state->expansion_cache.names,
+		                    token->value_handle) != 0) {
+			num_tokens = -1;
+			break;
+		}
+		if (i + 1 < num_tokens) {
+			token->flags |= PP_TOKEN_NO_EXPAND;
+		}
+	}
+out:
+	dependencies = expansion_state->dependencies;
+	expansion_state->dependencies = -1;
+	// removes the temporary tokens, the buffer keeps its content
+	stopExpansion(state);
+	if (num_tokens >= 0 &&
+	    storeCachedTokens(state, entry, buffer->tokens, num_tokens)) {
+		entry->depends = dependencies;
+	}
+	return status;
+}
+
+int beginExpansion(struct PreprocessorState* state,
+                   struct PreprocessorDefinition* definition)
+{
+	int hide_set =
+	    addToHideSet(&state->hide_sets, HIDE_SET_EMPTY, definition->name);
+	if (hide_set < 0) {
+		generalError("not enough memory to expand macro");
+		return -1;
+	}
+	if (!isFunctionLike(definition)) {
+		int index = definition - state->definitions.definitions;
+		struct ExpansionCacheEntry* entry =
+		    getExpansionCacheEntry(state, index);
+		if (entry != NULL && entry->depends < 0 &&
+		    !cacheExpansion(state, definition, entry, hide_set)) {
+			return -1;
+		}
+		struct TokenIterator it;
+		if (entry != NULL && entry->depends >= 0 &&
+		    copyCachedTokens(state, entry, &it)) {
+			// the cached tokens are read like a replacement
+			struct PreprocessorDefinition cached = {
+			    .name = definition->name,
+			    .token_start = it.start,
+			    .num_tokens = entry->num_tokens};
+			int result = beginExpansionWithHideSet(state, &cached, hide_set);
+			state->expansion_state.token_marker = it.start;
+			state->expansion_state.input_follows = true;
+			return result;
+		}
+	}
+	int result = beginExpansionWithHideSet(state, definition, hide_set);
+	state->expansion_state.input_follows = true;
+	return result;
+}
+
+void beginTokenExpansion(struct PreprocessorState* state, int token_start,
+                         int num_tokens)
+{
+	struct PreprocessorDefinition definition = {
+	    .token_start = token_start, .num_tokens = num_tokens};
+	beginExpansionWithHideSet(state, &definition, HIDE_SET_EMPTY);
+	state->expansion_state.token_marker = token_start;
 }
 
 void stopExpansion(struct PreprocessorState* state)
 {
 	state->expansion_state.begin_expansion = false;
 	state->expansion_state.function_like = false;
+	state->expansion_state.variadic = false;
+	state->expansion_state.apply_operators = false;
+	state->expansion_state.input_follows = false;
+	state->expansion_state.read_arguments = false;
 	resetLinearAllocator(&state->allocator);
 	state->tokens.num = state->expansion_state.token_marker;
+	state->argument_tokens.num = 0;
+}
+
+struct TokenIterator* allocateMacroArguments(struct PreprocessorState* state,
+                                             struct ParamContext* params,
+                                             int num_params)
+{
+	struct TokenIterator* iterators = allocateIterators(state, num_params * 2);
+	if (iterators == NULL) {
+		generalError("token iterator allocation failed");
+		return NULL;
+	}
+	struct TokenIterator* expanded = iterators + num_params;
+	for (int i = 0; i < num_params; i++) {
+		expanded[i].start = -1;
+	}
+	params->iterators = iterators;
+	params->expanded = expanded;
+	params->num_params = num_params;
+	return iterators;
 }
 
 bool prepareMacroParamTokens(struct PreprocessorState* state,
                              struct TokenIterator* params,
                              struct TokenIterator* iterator,
-                             int expected_param_count)
+                             int expected_param_count, bool variadic)
 {
 	bool status = false;
 
@@ -331,7 +798,8 @@ bool prepareMacroParamTokens(struct PreprocessorState* state,
 				counter--;
 				break;
 			case PUNCTUATOR_COMMA:
-				if (counter == 1) {
+				if (counter == 1 &&
+				    (!variadic || param_index < expected_param_count - 1)) {
 					if (param_index == expected_param_count - 1) {
 						generalError("to many macro parameters");
 						goto out;
@@ -354,6 +822,13 @@ bool prepareMacroParamTokens(struct PreprocessorState* state,
 
 		token_count++;
 	}
+	if (variadic && param_index == expected_param_count - 2) {
+		// the variable arguments can be left out
+		param_index++;
+		params[param_index].start = iterator->cur - 1;
+		params[param_index].cur = iterator->cur - 1;
+		params[param_index].end = iterator->cur - 2;
+	}
 	if (param_index < expected_param_count - 1) {
 		generalError("more macro parameters expected");
 		goto out;
@@ -363,127 +838,742 @@ out:
 	return status;
 }
 
-int expand(struct PreprocessorState* state, struct StringSet* identifiers,
-           struct PreprocessorToken* token)
+// The operands of # and ## are not expanded
+static bool isOperatorOperand(struct PreprocessorState* state,
+                              const struct TokenIterator* it, int index)
 {
-	int expansion_depth = state->expansion_state.expansion_depth;
+	if (index > it->start) {
+		int type = getTokenAt(state, index - 1)->type;
+		if (type == PP_STRINGIFY || type == PP_CONCAT) {
+			return true;
+		}
+	}
+	return index < it->end && getTokenAt(state, index + 1)->type == PP_CONCAT;
+}
 
-	struct ExpansionContext* current_context =
-	    &state->expansion_state.expansion_stack[expansion_depth];
-	struct TokenIterator* it = &current_context->iterator;
+static bool appendArgumentToken(struct PreprocessorState* state,
+                                const struct PreprocessorToken* token)
+{
+	struct PreprocessorTokenSet* buffer = &state->argument_tokens;
+	if (buffer->num == buffer->max_tokens) {
+		generalError("not enough memory to expand macro argument");
+		return false;
+	}
+	buffer->tokens[buffer->num++] = *token;
+	return true;
+}
 
-	if (it->cur > it->end) {
-		if (state->expansion_state.expansion_depth == 0) {
-			token->type = TOKEN_EOF;
-			return EXPANSION_RESULT_TOKEN;
+// Moves the tokens collected since buffer_start behind the other tokens of the
+// expansion. Arguments expanded in between are stored already, so the tokens
+// can be moved in one piece.
+static bool storeArgumentTokens(struct PreprocessorState* state,
+                                int buffer_start, struct TokenIterator* range)
+{
+	struct PreprocessorTokenSet* buffer = &state->argument_tokens;
+	struct PreprocessorTokenSet* tokens = &state->tokens;
+	int num_tokens = buffer->num - buffer_start;
+	if (tokens->num + num_tokens > tokens->max_tokens) {
+		generalError("not enough memory to store token");
+		return false;
+	}
+	memcpy(&tokens->tokens[tokens->num], &buffer->tokens[buffer_start],
+	       sizeof(*tokens->tokens) * num_tokens);
+	range->start = tokens->num;
+	range->cur = tokens->num;
+	range->end = tokens->num + num_tokens - 1;
+	tokens->num += num_tokens;
+	return true;
+}
+
+static bool needsExpansion(struct PreprocessorState* state,
+                           const struct TokenIterator* it)
+{
+	for (int i = it->start; i <= it->end; i++) {
+		const struct PreprocessorToken* token = getTokenAt(state, i);
+		if (token->type == PP_PARAM || token->type == PP_VA_OPT) {
+			return true;
+		} else if (token->type == IDENTIFIER &&
+		           !(token->flags & PP_TOKEN_NO_EXPAND) &&
+		           getDefinition(state, token->value_handle) != NULL) {
+			return true;
 		}
-		popContext(state);
-		return EXPANSION_RESULT_CONTINUE;
 	}
+	return false;
+}
 
-	struct PreprocessorToken* tok = getTokenAt(state, it->cur);
-	it->cur++;
+// Expands an argument completely, as if it formed the rest of the input. The
+// result is stored behind the other tokens of the expansion and shared by all
+// uses of the parameter. Arguments without macros are their own expansion.
+static bool expandArgument(struct PreprocessorState* state,
+                           const struct ParamContext* params, int index)
+{
+	bool status = false;
+	struct PreprocessorExpansionState* expansion_state =
+	    &state->expansion_state;
+	struct PreprocessorTokenSet* buffer = &state->argument_tokens;
+	int expansion_depth = expansion_state->expansion_depth;
+	int base_depth = expansion_state->base_depth;
+	int buffer_start = buffer->num;
+
+	if (!needsExpansion(state, &params->iterators[index])) {
+		params->expanded[index] = params->iterators[index];
+		return true;
+	}
+	if (pushContext(state, &params->iterators[index], params->parent,
+	                params->hide_set) != 0) {
+		goto out;
+	}
+	expansion_state->base_depth = expansion_state->expansion_depth;
+	while (true) {
+		struct PreprocessorToken token;
+		int result = expand(state, &token);
+		if (result == EXPANSION_RESULT_ERROR) {
+			goto out;
+		} else if (result == EXPANSION_RESULT_CONTINUE) {
+			continue;
+		} else if (token.type == TOKEN_EOF) {
+			break;
+		}
+		if (!appendArgumentToken(state, &token)) {
+			goto out;
+		}
+	}
+	status = storeArgumentTokens(state, buffer_start, &params->expanded[index]);
+out:
+	expansion_state->expansion_depth = expansion_depth;
+	expansion_state->base_depth = base_depth;
+	buffer->num = buffer_start;
+	return status;
+}
 
-	if (tok->type == PP_PARAM) {
-		const struct ParamContext* param_context = &current_context->param;
-		if (param_context == NULL) {
-			generalError("param context is NULL");
-			return EXPANSION_RESULT_ERROR;
+// Returns 1 if the variable arguments do not expand to nothing, 0 if they do
+// and -1 on errors
+static int hasVariableArguments(struct PreprocessorState* state,
+                                const struct ParamContext* params)
+{
+	if (params->iterators == NULL || params->num_params == 0) {
+		generalError("__VA_OPT__ outside of a variadic macro");
+		return -1;
+	}
+	int index = params->num_params - 1;
+	if (params->expanded[index].start < 0 &&
+	    !expandArgument(state, params, index)) {
+		return -1;
+	}
+	return params->expanded[index].end >= params->expanded[index].start;
+}
+
+// Returns the index of the ')' that ends the __VA_OPT__ at index or -1
+static int findVaOptEnd(struct PreprocessorState* state,
+                        const struct TokenIterator* it, int index)
+{
+	int depth = 0;
+	for (int i = index + 1; i <= it->end; i++) {
+		int type = getTokenAt(state, i)->type;
+		if (type == PUNCTUATOR_PARENTHESE_LEFT) {
+			depth++;
+		} else if (depth == 0) {
+			break;
+		} else if (type == PUNCTUATOR_PARENTHESE_RIGHT && --depth == 0) {
+			return i;
 		}
+	}
+	generalError("__VA_OPT__ has to be followed by parentheses");
+	return -1;
+}
 
-		const struct TokenIterator* param_iterators = param_context->iterators;
-		if (param_iterators == NULL) {
-			generalError("Invalid param iterator");
-			return EXPANSION_RESULT_ERROR;
+// The content of __VA_OPT__ is read in place if there are variable arguments
+static int expandVaOpt(struct PreprocessorState* state,
+                       struct ExpansionContext* context)
+{
+	struct TokenIterator* it = &context->iterator;
+	int end = findVaOptEnd(state, it, it->cur - 1);
+	if (end < 0) {
+		return EXPANSION_RESULT_ERROR;
+	}
+	struct TokenIterator content = {it->cur + 1, it->cur + 1, end - 1};
+	it->cur = end + 1;
+	int present = hasVariableArguments(state, &context->param);
+	if (present < 0 ||
+	    (present && pushContext(state, &content, &context->param,
+	                            context->hide_set) != 0)) {
+		return EXPANSION_RESULT_ERROR;
+	}
+	return EXPANSION_RESULT_CONTINUE;
+}
+
+// Appends the tokens of an argument. Parameters in unexpanded arguments refer
+// to the arguments of the invoking macro.
+static bool appendArgument(struct PreprocessorState* state,
+                           const struct ParamContext* params, int index,
+                           bool expanded)
+{
+	if (params == NULL || params->iterators == NULL ||
+	    index >= params->num_params) {
+		generalError("Invalid param iterator");
+		return false;
+	}
+	if (expanded && params->expanded[index].start < 0 &&
+	    !expandArgument(state, params, index)) {
+		return false;
+	}
+	const struct TokenIterator* it =
+	    expanded ? &params->expanded[index] : &params->iterators[index];
+	for (int i = it->start; i <= it->end; i++) {
+		const struct PreprocessorToken* token = getTokenAt(state, i);
+		if (token->type != PP_PARAM) {
+			if (!appendArgumentToken(state, token)) {
+				return false;
+			}
+		} else if (!appendArgument(state, params->parent, token->value_handle,
+		                           !isOperatorOperand(state, it, i))) {
+			return false;
 		}
+	}
+	return true;
+}
 
-		const struct TokenIterator* p = &param_iterators[tok->value_handle];
+// Substitutes the arguments of a replacement and applies # and ## to it. The
+// iterator is moved to the result, which is stored like an expanded argument.
+static bool substituteOperators(struct PreprocessorState* state,
+                                struct TokenIterator* it,
+                                const struct ParamContext* params,
+                                bool function_like)
+{
+	bool status = false;
+	struct PreprocessorTokenSet* buffer = &state->argument_tokens;
+	int buffer_start = buffer->num;
+	const struct PreprocessorToken placemarker = {.type = TOKEN_EMPTY};
+	int va_opt_end = -1;
+
+	for (int i = it->start; i <= it->end; i++) {
+		const struct PreprocessorToken* token = getTokenAt(state, i);
+		if (i == va_opt_end) {
+			continue;
+		} else if (token->type == PP_VA_OPT) {
+			int end = findVaOptEnd(state, it, i);
+			int present = end < 0 ? -1 : hasVariableArguments(state, params);
+			if (present < 0) {
+				goto out;
+			} else if (present) {
+				// only the parentheses are removed
+				va_opt_end = end;
+				i++;
+			} else if (!appendArgumentToken(state, &placemarker)) {
+				goto out;
+			} else {
+				i = end;
+			}
+		} else if (token->type == PP_STRINGIFY && function_like) {
+			if (i == it->end || getTokenAt(state, i + 1)->type != PP_PARAM) {
+				generalError("'#' is not followed by a macro parameter");
+				goto out;
+			}
+			int start = buffer->num;
+			int param = getTokenAt(state, ++i)->value_handle;
+			if (!appendArgument(state, params, param, false)) {
+				goto out;
+			}
+			struct PreprocessorToken string = *token;
+			bool stringified = stringifyPPTokens(
+			    state, &buffer->tokens[start], buffer->num - start, &string);
+			buffer->num = start;
+			if (!stringified || !appendArgumentToken(state, &string)) {
+				goto out;
+			}
+		} else if (token->type == PP_PARAM) {
+			int start = buffer->num;
+			bool operand = isOperatorOperand(state, it, i);
+			if (!appendArgument(state, params, token->value_handle,
+			                    !operand)) {
+				goto out;
+			}
+			// an empty operand of ## is pasted as a placemarker
+			if (operand && buffer->num == start &&
+			    !appendArgumentToken(state, &placemarker)) {
+				goto out;
+			}
+		} else if (!appendArgumentToken(state, token)) {
+			goto out;
+		}
+	}
 
-		const struct ParamContext* param_context_parent = param_context->parent;
-		const struct ParamContext* parent_parent = NULL;
-		if (param_context_parent != NULL) {
-			parent_parent = param_context_parent->parent;
+	// ## is applied from left to right
+	struct PreprocessorToken* tokens = &buffer->tokens[buffer_start];
+	int num_tokens = buffer->num - buffer_start;
+	int num_pasted = 0;
+	for (int i = 0; i < num_tokens; i++) {
+		if (tokens[i].type != PP_CONCAT || num_pasted == 0 ||
+		    i + 1 == num_tokens) {
+			tokens[num_pasted++] = tokens[i];
+			continue;
+		}
+		struct PreprocessorToken* left = &tokens[num_pasted - 1];
+		const struct PreprocessorToken* right = &tokens[++i];
+		if (left->type == TOKEN_EMPTY) {
+			*left = *right;
+		} else if (right->type != TOKEN_EMPTY &&
+		           !pastePPTokens(state, left, right, left)) {
+			goto out;
+		}
+	}
+	int num_result = 0;
+	for (int i = 0; i < num_pasted; i++) {
+		if (tokens[i].type != TOKEN_EMPTY) {
+			tokens[num_result++] = tokens[i];
 		}
+	}
+	buffer->num = buffer_start + num_result;
+	status = storeArgumentTokens(state, buffer_start, it);
+out:
+	buffer->num = buffer_start;
+	return status;
+}
 
-		if (pushContext(state, p, param_context_parent) != 0) {
+bool applyMacroOperators(struct PreprocessorState* state)
+{
+	struct PreprocessorExpansionState* expansion_state =
+	    &state->expansion_state;
+	if (!expansion_state->apply_operators) {
+		return true;
+	}
+	expansion_state->apply_operators = false;
+	struct ExpansionContext* context = &expansion_state->expansion_stack[0];
+	if (!substituteOperators(state, &context->iterator, &context->param,
+	                         expansion_state->function_like)) {
+		return false;
+	}
+	// the arguments are part of the result
+	context->param.iterators = NULL;
+	context->param.expanded = NULL;
+	context->param.num_params = 0;
+	return true;
+}
+
+static int expandParam(struct PreprocessorState* state,
+                       struct ExpansionContext* context, int index)
+{
+	const struct ParamContext* params = &context->param;
+	if (params->iterators == NULL) {
+		generalError("Invalid param iterator");
+		return EXPANSION_RESULT_ERROR;
+	}
+	const struct TokenIterator* it = &context->iterator;
+	if (isOperatorOperand(state, it, it->cur - 1)) {
+		// the arguments are scanned like in the context of the invocation
+		if (pushContext(state, &params->iterators[index], params->parent,
+		                params->hide_set) != 0) {
 			return EXPANSION_RESULT_ERROR;
 		}
 		return EXPANSION_RESULT_CONTINUE;
 	}
+	const struct TokenIterator* expanded = &params->expanded[index];
+	if (expanded->start < 0 && !expandArgument(state, params, index)) {
+		return EXPANSION_RESULT_ERROR;
+	}
+	// the expansion is rescanned with the rest of the replacement
+	if (pushContext(state, expanded, NULL, context->hide_set) != 0) {
+		return EXPANSION_RESULT_ERROR;
+	}
+	return EXPANSION_RESULT_CONTINUE;
+}
 
-	if (tok->type == IDENTIFIER) {
-		int index = tok->value_handle;
-		const char* identifier = getStringAt(identifiers, index);
-		uint32_t hash = getHashAt(identifiers, index);
-		int length = getLengthAt(identifiers, index);
-		struct PreprocessorDefinition* def =
-		    findDefinition(state, identifier, length, hash);
-
-		if (def != NULL) {
-			struct TokenIterator iter;
-			initTokenIterator(&iter, def);
-
-			struct TokenIterator* param_iterators = NULL;
-			int num_params = 0;
-			struct ParamContext param_context = {NULL, NULL, 0};
-			if (isFunctionLike(def)) {
-				if ((it->cur > it->end) || (getTokenAt(state, it->cur)->type !=
-				                            PUNCTUATOR_PARENTHESE_LEFT)) {
-					generalError(
-					    "function like macro must be called like a "
-					    "function");
-					return EXPANSION_RESULT_ERROR;
-				}
-				it->cur++;
-				num_params = def->num_params;
+// Looks for the '(' that follows a function like macro name. Returns the depth
+// of the context it is in, -1 if there is none, -2 on errors or -3 if all
+// contexts are exhausted. The contexts above that depth are exhausted.
+static int findArgumentContext(struct PreprocessorState* state)
+{
+	struct PreprocessorExpansionState* expansion_state =
+	    &state->expansion_state;
+	int depth = expansion_state->expansion_depth;
+	while (depth >= expansion_state->base_depth) {
+		struct ExpansionContext* context =
+		    &expansion_state->expansion_stack[depth];
+		struct TokenIterator* it = &context->iterator;
+		if (it->cur > it->end) {
+			depth--;
+			continue;
+		}
+		const struct PreprocessorToken* token = getTokenAt(state, it->cur);
+		if (token->type != PP_PARAM) {
+			return token->type == PUNCTUATOR_PARENTHESE_LEFT ? depth : -1;
+		}
+		// the expansion of an argument can begin with the '('
+		it->cur++;
+		if (expandParam(state, context, token->value_handle) ==
+		    EXPANSION_RESULT_ERROR) {
+			return -2;
+		}
+		depth = expansion_state->expansion_depth;
+	}
+	return -3;
+}
 
-				if (num_params > 0) {
-					param_iterators = allocateIterators(state, num_params);
+// Returns true if the parentheses of the invocation at the iterator are closed
+// before the end of its context
+static bool closesInvocation(struct PreprocessorState* state,
+                             const struct TokenIterator* it)
+{
+	int depth = 0;
+	for (int i = it->cur; i <= it->end; i++) {
+		int type = getTokenAt(state, i)->type;
+		if (type == PUNCTUATOR_PARENTHESE_LEFT) {
+			depth++;
+		} else if (type == PUNCTUATOR_PARENTHESE_RIGHT && --depth == 0) {
+			return true;
+		}
+	}
+	return false;
+}
 
-					if (param_iterators == NULL) {
-						return EXPANSION_RESULT_ERROR;
-					}
+// Appends the rest of a context with its parameters substituted. The names
+// which are hidden in the context are painted, as the tokens leave it.
+static bool appendContextTokens(struct PreprocessorState* state,
+                                struct TokenIterator* it,
+                                const struct ParamContext* params,
+                                int hide_set)
+{
+	struct PreprocessorTokenSet* buffer = &state->argument_tokens;
+	int start = buffer->num;
+	for (; it->cur <= it->end; it->cur++) {
+		const struct PreprocessorToken* token = getTokenAt(state, it->cur);
+		if (token->type == PP_PARAM) {
+			if (!appendArgument(state, params, token->value_handle,
+			                    !isOperatorOperand(state, it, it->cur))) {
+				return false;
+			}
+		} else if (token->type == PP_VA_OPT) {
+			int end = findVaOptEnd(state, it, it->cur);
+			int present = end < 0 ? -1 : hasVariableArguments(state, params);
+			if (present < 0) {
+				return false;
+			}
+			struct TokenIterator content = {it->cur + 2, it->cur + 2,
+			                                end - 1};
+			if (present &&
+			    !appendContextTokens(state, &content, params, hide_set)) {
+				return false;
+			}
+			it->cur = end;
+		} else if (!appendArgumentToken(state, token)) {
+			return false;
+		}
+	}
+	for (int i = start; i < buffer->num; i++) {
+		struct PreprocessorToken* token = &buffer->tokens[i];
+		if (token->type == IDENTIFIER &&
+		    isInHideSet(&state->hide_sets, hide_set, token->value_handle)) {
+			token->flags |= PP_TOKEN_NO_EXPAND;
+		}
+	}
+	return true;
+}
 
-					prepareMacroParamTokens(state, param_iterators, it,
-					                        num_params);
+// Joins an invocation which continues after the context of its '(' into the
+// context of its ')', with the name in front of it. If the invocation
+// continues in the input, the expansion waits until the lexer appended it.
+static int joinInvocation(struct PreprocessorState* state,
+                          const struct PreprocessorToken* name)
+{
+	struct PreprocessorExpansionState* expansion_state =
+	    &state->expansion_state;
+	struct PreprocessorTokenSet* buffer = &state->argument_tokens;
+	int buffer_start = buffer->num;
+	int result = EXPANSION_RESULT_ERROR;
+	int open = 0;
+	bool closed = false;
+	int depth = expansion_state->expansion_depth;
+
+	if (!appendArgumentToken(state, name)) {
+		goto out;
+	}
+	for (; depth >= expansion_state->base_depth; depth--) {
+		struct ExpansionContext* context =
+		    &expansion_state->expansion_stack[depth];
+		int start = buffer->num;
+		if (!appendContextTokens(state, &context->iterator, &context->param,
+		                         context->hide_set)) {
+			goto out;
+		}
+		for (int i = start; i < buffer->num && !closed; i++) {
+			int type = buffer->tokens[i].type;
+			if (type == PUNCTUATOR_PARENTHESE_LEFT) {
+				open++;
+			} else if (type == PUNCTUATOR_PARENTHESE_RIGHT && --open == 0) {
+				closed = true;
+			}
+		}
+		if (closed) {
+			break;
+		}
+	}
+	if (!closed) {
+		depth = expansion_state->base_depth;
+		if (depth == 0 && expansion_state->dependencies >= 0) {
+			// a cached expansion can not depend on the input
+			result = EXPANSION_RESULT_INPUT;
+			goto out;
+		} else if (depth > 0 || !expansion_state->input_follows) {
+			generalError("macro parantheses not closed");
+			goto out;
+		}
+	}
+	struct ExpansionContext* context =
+	    &expansion_state->expansion_stack[depth];
+	if (!storeArgumentTokens(state, buffer_start, &context->iterator)) {
+		goto out;
+	}
+	context->param.iterators = NULL;
+	context->param.expanded = NULL;
+	context->param.num_params = 0;
+	context->param.parent = NULL;
+	expansion_state->expansion_depth = depth;
+	result = EXPANSION_RESULT_CONTINUE;
+	if (!closed) {
+		// the ')' comes from the input, which hides no macros
+		context->hide_set = HIDE_SET_EMPTY;
+		expansion_state->read_arguments = true;
+		expansion_state->open_parentheses = open;
+		result = EXPANSION_RESULT_INPUT;
+	}
+out:
+	buffer->num = buffer_start;
+	return result;
+}
 
-					param_context.parent = &current_context->param;
-					param_context.iterators = param_iterators;
-					param_context.num_params = num_params;
+// Returns 1 if the substitution of the parameter at index inserts commas or
+// parentheses which separate the arguments of an invocation
+static int separatesArguments(struct PreprocessorState* state,
+                              const struct ParamContext* params,
+                              const struct TokenIterator* it, int index,
+                              bool commas_separate)
+{
+	if (isOperatorOperand(state, it, index)) {
+		return 1;
+	}
+	int param = getTokenAt(state, index)->value_handle;
+	if (params->iterators == NULL || param >= params->num_params) {
+		generalError("Invalid param iterator");
+		return -1;
+	}
+	if (params->expanded[param].start < 0 &&
+	    !expandArgument(state, params, param)) {
+		return -1;
+	}
+	const struct TokenIterator* expanded = &params->expanded[param];
+	int depth = 0;
+	for (int i = expanded->start; i <= expanded->end; i++) {
+		int type = getTokenAt(state, i)->type;
+		if (type == PUNCTUATOR_PARENTHESE_LEFT) {
+			depth++;
+		} else if (type == PUNCTUATOR_PARENTHESE_RIGHT && --depth < 0) {
+			return 1;
+		} else if (type == PUNCTUATOR_COMMA && depth == 0 &&
+		           commas_separate) {
+			return 1;
+		}
+	}
+	return depth != 0;
+}
 
-				} else {
-					if (getTokenAt(state, it->cur)->type !=
-					    PUNCTUATOR_PARENTHESE_RIGHT) {
-						generalError("macro parantheses not closed");
-						return EXPANSION_RESULT_ERROR;
-					}
+// Returns the index of the ')' that ends the invocation in the context or -1.
+// The arguments are substituted before they are separated if the parameters
+// in them would separate them differently, otherwise they are read in place.
+static int findInvocationEnd(struct PreprocessorState* state,
+                             const struct ExpansionContext* context,
+                             const struct PreprocessorDefinition* def,
+                             bool* substitute)
+{
+	const struct TokenIterator* it = &context->iterator;
+	// the commas of the variable arguments do not separate them
+	int num_separated =
+	    isVariadic(def) ? def->num_params - 1 : def->num_params;
+	int depth = 0;
+	int argument = 0;
+	*substitute = false;
+	for (int i = it->cur; i <= it->end; i++) {
+		int type = getTokenAt(state, i)->type;
+		if (type == PUNCTUATOR_PARENTHESE_LEFT) {
+			depth++;
+		} else if (type == PUNCTUATOR_PARENTHESE_RIGHT && --depth == 0) {
+			return i;
+		} else if (type == PUNCTUATOR_COMMA && depth == 1) {
+			argument++;
+		} else if (type == PP_VA_OPT) {
+			*substitute = true;
+		} else if (type == PP_PARAM && !*substitute) {
+			int result = separatesArguments(state, &context->param, it, i,
+			                                argument < num_separated);
+			if (result < 0) {
+				return -1;
+			}
+			*substitute = result;
+		}
+	}
+	generalError("macro parantheses not closed");
+	return -1;
+}
+
+static int expandMacro(struct PreprocessorState* state,
+                       struct PreprocessorDefinition* def,
+                       struct ExpansionContext* context)
+{
+	struct TokenIterator iter;
+	initTokenIterator(&iter, def);
+	struct ParamContext param_context = {NULL, NULL, NULL, 0,
+	                                     context->hide_set};
+	const struct ExpansionCacheEntry* entry =
+	    findCachedExpansion(state, def, context->hide_set);
+	if (entry != NULL && !copyCachedTokens(state, entry, &iter)) {
+		// the macro is expanded again instead
+		entry = NULL;
+	}
+	if (entry != NULL) {
+		if (recordDependencies(state, entry->depends) != 0) {
+			return EXPANSION_RESULT_ERROR;
+		}
+	} else if (isFunctionLike(def)) {
+		struct TokenIterator* it = &context->iterator;
+		int num_params = def->num_params;
+		if (num_params > 0) {
+			bool substitute;
+			int end = findInvocationEnd(state, context, def, &substitute);
+			if (end < 0) {
+				return EXPANSION_RESULT_ERROR;
+			}
+			struct TokenIterator invocation = {it->cur, it->cur, end};
+			const struct ParamContext* parent = &context->param;
+			if (substitute) {
+				if (!substituteOperators(state, &invocation, parent, true)) {
+					return EXPANSION_RESULT_ERROR;
 				}
+				parent = NULL;
 			}
-			if (pushContext(state, &iter, &param_context) != 0) {
+			it->cur = end + 1;
+			invocation.cur = invocation.start + 1;
+			struct TokenIterator* param_iterators =
+			    allocateMacroArguments(state, &param_context, num_params);
+			if (param_iterators == NULL ||
+			    !prepareMacroParamTokens(state, param_iterators, &invocation,
+			                             num_params, isVariadic(def))) {
+				return EXPANSION_RESULT_ERROR;
+			}
+			param_context.parent = parent;
+		} else {
+			it->cur++;
+			if (it->cur > it->end || getTokenAt(state, it->cur)->type !=
+			                             PUNCTUATOR_PARENTHESE_RIGHT) {
+				generalError("macro parantheses not closed");
 				return EXPANSION_RESULT_ERROR;
 			}
+			it->cur++;
+		}
+	}
+	const struct ParamContext* params = &param_context;
+	if (entry == NULL && (def->flags & HAS_OPERATORS)) {
+		if (!substituteOperators(state, &iter, params, isFunctionLike(def))) {
+			return EXPANSION_RESULT_ERROR;
+		}
+		// the arguments are part of the result
+		params = NULL;
+	}
+	int hide_set =
+	    addToHideSet(&state->hide_sets, context->hide_set, def->name);
+	if (hide_set < 0 ||
+	    recordDependencies(state, hide_set) != 0 ||
+	    pushContext(state, &iter, params, hide_set) != 0) {
+		return EXPANSION_RESULT_ERROR;
+	}
+	return EXPANSION_RESULT_CONTINUE;
+}
+
+int expand(struct PreprocessorState* state, struct PreprocessorToken* token)
+{
+	struct PreprocessorExpansionState* expansion_state =
+	    &state->expansion_state;
+	int expansion_depth = expansion_state->expansion_depth;
 
-			return EXPANSION_RESULT_CONTINUE;
+	struct ExpansionContext* current_context =
+	    &expansion_state->expansion_stack[expansion_depth];
+	struct TokenIterator* it = &current_context->iterator;
+
+	if (it->cur > it->end) {
+		if (expansion_depth == expansion_state->base_depth) {
+			token->type = TOKEN_EOF;
+			return EXPANSION_RESULT_TOKEN;
 		}
+		popContext(state);
+		return EXPANSION_RESULT_CONTINUE;
 	}
+
+	struct PreprocessorToken* tok = getTokenAt(state, it->cur);
+	it->cur++;
+
+	if (tok->type == PP_PARAM) {
+		return expandParam(state, current_context, tok->value_handle);
+	} else if (tok->type == PP_VA_OPT) {
+		return expandVaOpt(state, current_context);
+	}
+
 	*token = *tok;
-	return EXPANSION_RESULT_TOKEN;
+	if (tok->type != IDENTIFIER || (tok->flags & PP_TOKEN_NO_EXPAND)) {
+		return EXPANSION_RESULT_TOKEN;
+	}
+	struct PreprocessorDefinition* def =
+	    getDefinition(state, tok->value_handle);
+	if (def == NULL) {
+		return EXPANSION_RESULT_TOKEN;
+	}
+	// a macro is not expanded again inside of its own replacement
+	if (isInHideSet(&state->hide_sets, current_context->hide_set,
+	                def->name)) {
+		token->flags |= PP_TOKEN_NO_EXPAND;
+		return EXPANSION_RESULT_TOKEN;
+	}
+	if (isFunctionLike(def)) {
+		// without arguments the name is an ordinary identifier, unless they
+		// can still follow in the input
+		int depth = findArgumentContext(state);
+		bool input_follows = expansion_state->base_depth == 0 &&
+		                     expansion_state->input_follows;
+		if (depth == -2) {
+			return EXPANSION_RESULT_ERROR;
+		} else if (depth == -1 || (depth == -3 && !input_follows)) {
+			return EXPANSION_RESULT_TOKEN;
+		} else if (depth == -3) {
+			return joinInvocation(state, token);
+		}
+		current_context = &expansion_state->expansion_stack[depth];
+		if (!closesInvocation(state, &current_context->iterator)) {
+			// the arguments continue after the context
+			return joinInvocation(state, token);
+		}
+		expansion_state->expansion_depth = depth;
+	}
+	return expandMacro(state, def, current_context);
 }
 
 bool getExpandedToken(struct PreprocessorState* state,
-                      struct StringSet* identifier,
                       struct PreprocessorToken* token)
 {
 	int result;
 	int count = 0;
 	do {
-		result = expand(state, identifier, token);
+		result = expand(state, token);
 		count++;
 	} while (result == EXPANSION_RESULT_CONTINUE);
 
 	return result == EXPANSION_RESULT_ERROR ? false : true;
 }
 
+void continueExpansion(struct PreprocessorState* state)
+{
+	struct PreprocessorExpansionState* expansion_state =
+	    &state->expansion_state;
+	expansion_state->expansion_stack[0].iterator.end = state->tokens.num - 1;
+	expansion_state->read_arguments = false;
+}
+
 void printPPToken(struct LexerState* state,
                   const struct PreprocessorToken* pp_token)
 {
@@ -18,6 +18,8 @@
 
 #include <stdint.h>
 
+#include "hide_set.h"
+#include "identifier_table.h"
 #include "memory/linear_allocator.h"
 #include "string_set.h"
 
@@ -25,8 +27,26 @@
 
 #define PREPROCESSOR_MAX_DEFINITION_COUNT 1024
 #define PREPROCESSOR_MAX_DEFINITION_TOKEN_COUNT (4096 << 2)
+#define PREPROCESSOR_MAX_ARGUMENT_TOKEN_COUNT 4096
+// longest spelling of a pasted token or a stringified argument
+#define PREPROCESSOR_PASTE_BUFFER_SIZE 4096
+// initial number of identifiers covered by the macro name filter
+#define PREPROCESSOR_MACRO_NAME_FILTER_SIZE 4096
+// initial number of tokens of the cached expansions
+#define PREPROCESSOR_EXPANSION_CACHE_SIZE 1024
+
+// Replacements with # or ## are substituted completely before they are
+// rescanned, all others are read in place. The variable arguments of a
+// variadic macro are its last parameter.
+enum PPDefinitionFlags {
+	FUNCTION_LIKE = 0x1,
+	HAS_OPERATORS = 0x2,
+	VARIADIC = 0x4
+};
 
-enum PPDefinitionFlags { FUNCTION_LIKE = 0x1 };
+// A macro name that was not expanded because of its hide set is never
+// expanded again
+enum PPTokenFlags { PP_TOKEN_NO_EXPAND = 0x1 };
 
 struct LexerState;
 struct LexerToken;
@@ -35,9 +55,10 @@ struct LexerConstantSet;
 struct PreprocessorToken {
 	uint16_t line;
 	uint16_t column;
-	uint16_t value_handle;
+	uint32_t value_handle;
 	uint16_t line_pos;
 	uint8_t type;
+	uint8_t flags;
 };
 
 struct PreprocessorTokenSet {
@@ -47,15 +68,57 @@ struct PreprocessorTokenSet {
 };
 
 struct PreprocessorDefinition {
+	// identifier index of the macro name
+	uint32_t name;
 	uint16_t token_start;
 	uint16_t num_tokens;
 	uint8_t num_params;
 	uint8_t flags;
 };
 
+// The identifier table refers to the current definition of a name
 struct PreprocessorDefinitionSet {
 	struct PreprocessorDefinition* definitions;
-	struct StringSet pp_definition_names;
+	struct Allocator* allocator;
+	int num;
+	int max_definitions;
+};
+
+// One bit per identifier which was defined as a macro at some point. Most
+// identifiers never are, so they are rejected without touching their info.
+struct MacroNameFilter {
+	uint64_t* words;
+	int num_words;
+};
+
+static inline bool isInNameFilter(const struct MacroNameFilter* filter,
+                                  int identifier)
+{
+	int word = identifier >> 6;
+	return word < filter->num_words &&
+	       (filter->words[word] >> (identifier & 63)) & 1;
+}
+
+// The complete expansion of an object like macro. It stays valid until one of
+// the macros that were expanded for it or a name in it is defined again.
+// Only its last token can be expanded when the expansion is read.
+struct ExpansionCacheEntry {
+	// hide set of the expanded macros, -1 if nothing is cached
+	int32_t depends;
+	// position in the tokens of the cache
+	int32_t token_start;
+	uint16_t num_tokens;
+};
+
+// Indexed like the definitions, entries after num are empty. The tokens of
+// invalidated entries are dropped once there is no room for another one.
+struct ExpansionCache {
+	struct ExpansionCacheEntry* entries;
+	int num;
+	int max_entries;
+	struct PreprocessorTokenSet tokens;
+	// the identifiers which occur in the tokens
+	struct MacroNameFilter names;
 };
 
 struct TokenIterator {
@@ -67,34 +130,70 @@ struct TokenIterator {
 struct ParamContext {
 	const struct ParamContext* parent;
 	const struct TokenIterator* iterators;
+	// the expanded arguments, start is -1 until an argument is used
+	struct TokenIterator* expanded;
 	uint8_t num_params;
+	// hide set of the context the arguments were read from
+	int32_t hide_set;
 };
 
 struct ExpansionContext {
 	struct TokenIterator iterator;
 	struct ParamContext param;
+	// macros which are not expanded while reading from this context
+	int32_t hide_set;
 };
 
 struct PreprocessorExpansionState {
 	struct ExpansionContext* expansion_stack;
 	int expansion_depth;
+	// the context an argument is expanded in ends the expansion
+	int base_depth;
+	// macros expanded while an expansion is cached, -1 otherwise
+	int32_t dependencies;
 	int token_marker;
 	bool function_like;
+	bool variadic;
 	bool begin_expansion;
+	// the operators are applied once the arguments are known
+	bool apply_operators;
+	// the input follows the expansion, as for macros used in the source
+	bool input_follows;
+	// an invocation continues in the input and the expansion waits for it
+	bool read_arguments;
+	// parentheses of that invocation which are not closed yet
+	int open_parentheses;
 };
 
 struct PreprocessorState {
 	struct PreprocessorTokenSet tokens;
+	// arguments which are being expanded, nested ones at the end
+	struct PreprocessorTokenSet argument_tokens;
 	struct PreprocessorDefinitionSet definitions;
+	struct MacroNameFilter macro_names;
+	struct HideSetTable hide_sets;
+	struct ExpansionCache expansion_cache;
 	struct PreprocessorExpansionState expansion_state;
 	struct LinearAllocator allocator;
+	struct IdentifierTable* identifiers;
+	// sets of the lexer which hold the values of pasted and stringified tokens
+	struct StringSet* string_literals;
+	struct StringSet* pp_numbers;
+	struct LexerConstantSet* constants;
+	char* paste_buffer;
 };
 
-static inline bool isFunctionLike(struct PreprocessorDefinition* definition)
+static inline bool isFunctionLike(
+    const struct PreprocessorDefinition* definition)
 {
 	return definition->flags & FUNCTION_LIKE;
 }
 
+static inline bool isVariadic(const struct PreprocessorDefinition* definition)
+{
+	return definition->flags & VARIADIC;
+}
+
 void createPreprocessorTokenSetFromBuffer(struct PreprocessorTokenSet* set,
                                           size_t max_tokens, void* buffer);
 
@@ -103,7 +202,6 @@ int createPreprocessorTokenSet(struct PreprocessorTokenSet* set,
 
 int createPreprocessorDefinitionSet(struct PreprocessorDefinitionSet* set,
                                     size_t max_definition,
-                                    int pp_definition_stringset_size,
                                     struct Allocator* allocator);
 
 int addPreprocessorToken(struct PreprocessorState* state,
@@ -115,34 +213,93 @@ int getPreprocessorTokenPos(struct PreprocessorState* state);
 struct PreprocessorTokenSet* getPreprocessorTokenSet(
     struct PreprocessorState* state);
 
+// Defines or redefines the macro with the given identifier index
 int createPreprocessorDefinition(struct PreprocessorState* state,
                                  int start_index, int num_tokens,
-                                 int num_params, const char* name,
-                                 int name_length, bool function_like);
+                                 int num_params, int identifier,
+                                 bool function_like, bool variadic);
+
+// Removes the definition of a macro, names without one are ignored. The slot
+// of the old definition is not reused.
+void undefineMacro(struct PreprocessorState* state, int identifier);
 
-struct PreprocessorDefinition* findDefinition(struct PreprocessorState* state,
-                                              const char* name, int length,
-                                              uint32_t hash);
+// Marks the names of all definitions in the macro name filter. Has to be
+// called when definitions are added without createPreprocessorDefinition.
+int updateMacroNameFilter(struct PreprocessorState* state);
 
-int initPreprocessorState(struct PreprocessorState* state);
+static inline bool mayBeMacroName(const struct PreprocessorState* state,
+                                  int identifier)
+{
+	return isInNameFilter(&state->macro_names, identifier);
+}
+
+// Returns the current definition of an identifier or NULL
+static inline struct PreprocessorDefinition* getDefinition(
+    struct PreprocessorState* state, int identifier)
+{
+	if (!mayBeMacroName(state, identifier)) {
+		return NULL;
+	}
+	int index = getIdentifierInfo(state->identifiers, identifier)->definition;
+	if (index == IDENTIFIER_NO_DEFINITION) {
+		return NULL;
+	}
+	return &state->definitions.definitions[index];
+}
+
+// The identifier table holds the macro names and has to outlive the state, as
+// do the sets of the lexer
+int initPreprocessorState(struct PreprocessorState* state,
+                          struct IdentifierTable* identifiers,
+                          struct StringSet* string_literals,
+                          struct StringSet* pp_numbers,
+                          struct LexerConstantSet* constants);
 
 void cleanupPreprocessorState(struct PreprocessorState* state);
 
-void beginExpansion(struct PreprocessorState* state,
-                    struct PreprocessorDefinition* definition);
+// Removes all macro definitions but keeps the memory for reuse
+void resetPreprocessorState(struct PreprocessorState* state);
+
+// The macro itself is not expanded again while its replacement is rescanned.
+// Object like macros are expanded completely on their first use and the
+// result is reused afterwards.
+int beginExpansion(struct PreprocessorState* state,
+                   struct PreprocessorDefinition* definition);
+
+// Expands a temporary token sequence stored at the end of the token set. The
+// tokens are removed when the expansion stops.
+void beginTokenExpansion(struct PreprocessorState* state, int token_start,
+                         int num_tokens);
 
+// Applies # and ## in the replacement of a function like macro. Has to be
+// called once its arguments are prepared.
+bool applyMacroOperators(struct PreprocessorState* state);
+
+// Returns the name of the invoked macro if the expansion waits for the rest of
+// an invocation from the input
 bool getExpandedToken(struct PreprocessorState* state,
-                      struct StringSet* identifier,
                       struct PreprocessorToken* token);
 
+// Continues an expansion which waited for an invocation. The tokens of the
+// input up to the end of the invocation have to be appended to the token set.
+void continueExpansion(struct PreprocessorState* state);
+
 void stopExpansion(struct PreprocessorState* state);
 
 void printPPToken(struct LexerState* state,
                   const struct PreprocessorToken* token);
 
+// Allocates the arguments of a macro invocation for the expansion. Returns the
+// iterators of the unexpanded arguments or NULL.
+struct TokenIterator* allocateMacroArguments(struct PreprocessorState* state,
+                                             struct ParamContext* params,
+                                             int num_params);
+
+// Splits the tokens of an invocation into its arguments. The variable
+// arguments are one range which includes their commas.
 bool prepareMacroParamTokens(struct PreprocessorState* state,
                              struct TokenIterator* params,
                              struct TokenIterator* iterator,
-                             int expected_param_count);
+                             int expected_param_count, bool variadic);
 
 #endif
@@ -0,0 +1,185 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file_table.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "input_file.h"
+
+// file ids are too long to be stored inline, the chunks can be small
+#define FILE_TABLE_BUFFER_SIZE 4096
+#define FILE_TABLE_ONCE_COUNT 64
+
+int initFileTable(struct FileTable* table, int max_files,
+                  struct Allocator* allocator)
+{
+	if (initStringSet(&table->ids, FILE_TABLE_BUFFER_SIZE, max_files,
+	                  allocator) != 0) {
+		return -1;
+	}
+	if (initStringSet(&table->once_sizes, FILE_TABLE_BUFFER_SIZE,
+	                  FILE_TABLE_ONCE_COUNT, allocator) != 0) {
+		cleanupStringSet(&table->ids);
+		return -1;
+	}
+	if (initStringSet(&table->once_paths, FILE_TABLE_BUFFER_SIZE,
+	                  FILE_TABLE_ONCE_COUNT, allocator) != 0) {
+		cleanupStringSet(&table->once_sizes);
+		cleanupStringSet(&table->ids);
+		return -1;
+	}
+	table->max_infos = table->ids.max_num;
+	table->infos = ALLOCATE_TYPE(allocator, table->max_infos,
+	                             typeof(*table->infos));
+	if (table->infos == NULL) {
+		cleanupFileTable(table);
+		return -1;
+	}
+	return 0;
+}
+
+void cleanupFileTable(struct FileTable* table)
+{
+	deallocate(table->ids.parent_allocator, table->infos);
+	cleanupStringSet(&table->ids);
+	cleanupStringSet(&table->once_sizes);
+	cleanupStringSet(&table->once_paths);
+	table->infos = NULL;
+	table->max_infos = 0;
+}
+
+static void initFileInfo(struct FileInfo* info)
+{
+	info->guard = FILE_TABLE_NO_GUARD;
+	info->once = false;
+	info->checked = false;
+}
+
+void resetFileTable(struct FileTable* table)
+{
+	resetStringSet(&table->ids);
+	resetStringSet(&table->once_sizes);
+	resetStringSet(&table->once_paths);
+	for (int i = 0; i < table->ids.base_num; i++) {
+		initFileInfo(&table->infos[i]);
+	}
+}
+
+int setFileTableBase(struct FileTable* table, const struct StringSet* ids,
+                     const struct FileInfo* infos)
+{
+	int num = getStringCount(ids);
+	if (num > table->max_infos) {
+		struct FileInfo* new_infos = reallocate(
+		    table->ids.parent_allocator, table->infos, sizeof(*infos) * num);
+		if (new_infos == NULL) {
+			return -1;
+		}
+		table->infos = new_infos;
+		table->max_infos = num;
+	}
+	resetStringSet(&table->ids);
+	setStringSetBase(&table->ids, ids);
+	memcpy(table->infos, infos, sizeof(*infos) * num);
+	return 0;
+}
+
+int internFile(struct FileTable* table, const struct FileId* id)
+{
+	if (getStringCount(&table->ids) == table->max_infos) {
+		int max_infos = table->max_infos * 2;
+		struct FileInfo* infos =
+		    reallocate(table->ids.parent_allocator, table->infos,
+		               sizeof(*infos) * max_infos);
+		if (infos == NULL) {
+			return -1;
+		}
+		table->infos = infos;
+		table->max_infos = max_infos;
+	}
+	bool exists;
+	int index = addStringAndHash(&table->ids, (const char*)id, sizeof(*id),
+	                             hashBytes(id, sizeof(*id)), &exists);
+	if (index >= 0 && !exists) {
+		initFileInfo(&table->infos[index]);
+	}
+	return index;
+}
+
+static bool getFileSize(const char* path, uint64_t* size)
+{
+	struct stat file_stat;
+	if (stat(path, &file_stat) != 0) {
+		return false;
+	}
+	*size = file_stat.st_size;
+	return true;
+}
+
+int markFileOnce(struct FileTable* table, int index, const char* path)
+{
+	struct FileInfo* info = &table->infos[index];
+	if (info->once) {
+		return 0;
+	}
+	info->once = true;
+	uint64_t size;
+	if (!getFileSize(path, &size) ||
+	    addString(&table->once_sizes, (const char*)&size, sizeof(size)) < 0 ||
+	    addString(&table->once_paths, path, strlen(path)) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static bool haveSameContent(const struct MappedFile* file, const char* path)
+{
+	struct MappedFile other;
+	if (mapFile(&other, path, SIZE_MAX) != 0) {
+		return false;
+	}
+	bool same = other.size == file->size &&
+	            memcmp(other.data, file->data, file->size) == 0;
+	unmapFile(&other);
+	return same;
+}
+
+bool isCopyOfOnceFile(struct FileTable* table, const char* path)
+{
+	uint64_t size;
+	if (getStringCount(&table->once_sizes) == 0 ||
+	    !getFileSize(path, &size) ||
+	    findIndex(&table->once_sizes, (const char*)&size, sizeof(size),
+	              hashBytes(&size, sizeof(size))) < 0) {
+		return false;
+	}
+	struct MappedFile file;
+	if (mapFile(&file, path, SIZE_MAX) != 0) {
+		return false;
+	}
+	bool copy = false;
+	int num_once = getStringCount(&table->once_paths);
+	for (int i = 0; i < num_once && !copy; i++) {
+		uint64_t once_size;
+		const char* once_path = getStringAt(&table->once_paths, i);
+		copy = getFileSize(once_path, &once_size) && once_size == size &&
+		       haveSameContent(&file, once_path);
+	}
+	unmapFile(&file);
+	return copy;
+}
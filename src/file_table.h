@@ -0,0 +1,75 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_TABLE_H
+#define FILE_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "include_search.h"
+#include "memory/allocator.h"
+#include "string_set.h"
+
+#define FILE_TABLE_NO_GUARD (-1)
+
+// What is known about an included file from previous inclusions
+struct FileInfo {
+	// identifier index of the macro that guards the whole file
+	int32_t guard;
+	// contains #pragma once
+	bool once;
+	// compared against the contents of the files with #pragma once
+	bool checked;
+};
+
+// Maps the identities of included files to dense indices. The files with
+// #pragma once are remembered by size and path as well, to recognize copies
+// that have another identity, like files on overlay file systems.
+struct FileTable {
+	struct StringSet ids;
+	struct FileInfo* infos;
+	int max_infos;
+	// only files with one of these sizes are compared with the once files
+	struct StringSet once_sizes;
+	struct StringSet once_paths;
+};
+
+int initFileTable(struct FileTable* table, int max_files,
+                  struct Allocator* allocator);
+
+void cleanupFileTable(struct FileTable* table);
+
+// Forgets everything about the files, including the ones of the base
+void resetFileTable(struct FileTable* table);
+
+// Returns the index of the file, or -1 if it could not be stored
+int internFile(struct FileTable* table, const struct FileId* id);
+
+// Uses the files of a precompiled header as base. The table has to be empty.
+int setFileTableBase(struct FileTable* table, const struct StringSet* ids,
+                     const struct FileInfo* infos);
+
+static inline struct FileInfo* getFileInfo(struct FileTable* table, int index)
+{
+	return &table->infos[index];
+}
+
+int markFileOnce(struct FileTable* table, int index, const char* path);
+
+// Returns true if the file has the same content as a file with #pragma once
+bool isCopyOfOnceFile(struct FileTable* table, const char* path);
+
+#endif
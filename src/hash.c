@@ -0,0 +1,136 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hash.h"
+
+#include <string.h>
+
+static const uint64_t wyhash_secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull,
+    0x4d5a2da51de1aa47ull};
+
+static inline void multiply128(uint64_t* a, uint64_t* b)
+{
+	__uint128_t product = (__uint128_t)*a * *b;
+	*a = (uint64_t)product;
+	*b = (uint64_t)(product >> 64);
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+	multiply128(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t read64(const uint8_t* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+// reads 1 to 3 bytes
+static inline uint64_t readSmall(const uint8_t* p, size_t length)
+{
+	return ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) |
+	       p[length - 1];
+}
+
+uint32_t hashWyhash(const void* data, size_t length)
+{
+	const uint8_t* p = data;
+	const uint64_t* secret = wyhash_secret;
+	uint64_t seed = mix(secret[0], secret[1]);
+	uint64_t a;
+	uint64_t b;
+	if (length <= 16) {
+		// typical identifiers are handled with two overlapping reads
+		if (length >= 4) {
+			size_t offset = (length >> 3) << 2;
+			a = (read32(p) << 32) | read32(p + offset);
+			b = (read32(p + length - 4) << 32) |
+			    read32(p + length - 4 - offset);
+		} else if (length > 0) {
+			a = readSmall(p, length);
+			b = 0;
+		} else {
+			a = 0;
+			b = 0;
+		}
+	} else {
+		size_t remaining = length;
+		if (remaining > 48) {
+			uint64_t seed1 = seed;
+			uint64_t seed2 = seed;
+			do {
+				seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+				seed1 = mix(read64(p + 16) ^ secret[2], read64(p + 24) ^ seed1);
+				seed2 = mix(read64(p + 32) ^ secret[3], read64(p + 40) ^ seed2);
+				p += 48;
+				remaining -= 48;
+			} while (remaining > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (remaining > 16) {
+			seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+			p += 16;
+			remaining -= 16;
+		}
+		a = read64(p + remaining - 16);
+		b = read64(p + remaining - 8);
+	}
+	a ^= secret[1];
+	b ^= seed;
+	multiply128(&a, &b);
+	uint64_t hash = mix(a ^ secret[0] ^ length, b ^ secret[1]);
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+uint32_t hashFnv1a(const void* data, size_t length)
+{
+	const uint8_t* p = data;
+	uint32_t hash = 2166136261;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= p[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+uint32_t hashDjb2(const void* data, size_t length)
+{
+	const uint8_t* p = data;
+	uint32_t hash = 5381;
+	for (size_t i = 0; i < length; i++) {
+		hash = ((hash << 5) + hash) ^ p[i];
+	}
+	return hash;
+}
+
+const struct NamedHashFunction hash_functions[] = {
+    {"wyhash", hashWyhash},
+    {"fnv1a", hashFnv1a},
+    {"djb2", hashDjb2},
+};
+
+const int num_hash_functions =
+    sizeof(hash_functions) / sizeof(hash_functions[0]);
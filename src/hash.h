@@ -0,0 +1,51 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t (*HashFunction)(const void* data, size_t length);
+
+struct NamedHashFunction {
+	const char* name;
+	HashFunction function;
+};
+
+// wyhash, reads 8 bytes at a time
+uint32_t hashWyhash(const void* data, size_t length);
+
+uint32_t hashFnv1a(const void* data, size_t length);
+
+uint32_t hashDjb2(const void* data, size_t length);
+
+// All available functions, for comparing them
+extern const struct NamedHashFunction hash_functions[];
+extern const int num_hash_functions;
+
+// The hash used for all interned strings. Another function can be selected at
+// build time by defining HASH_FUNCTION.
+#ifndef HASH_FUNCTION
+#define HASH_FUNCTION hashWyhash
+#endif
+
+static inline uint32_t hashBytes(const void* data, size_t length)
+{
+	return HASH_FUNCTION(data, length);
+}
+
+#endif
@@ -0,0 +1,210 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hide_set.h"
+
+#include <string.h>
+
+static uint32_t hashEntry(int set, int name)
+{
+	uint32_t hash = (uint32_t)set * 0x9E3779B1u ^ (uint32_t)name * 0x85EBCA77u;
+	return hash ^ (hash >> 15);
+}
+
+// Returns the entry of the key or the empty entry where it belongs
+static struct HideSetEntry* findEntry(const struct HideSetTable* table,
+                                      int set, int name)
+{
+	uint32_t mask = table->max_entries - 1;
+	uint32_t index = hashEntry(set, name) & mask;
+	while (true) {
+		struct HideSetEntry* entry = &table->entries[index];
+		if (entry->set < 0 || (entry->set == set && entry->name == name)) {
+			return entry;
+		}
+		index = (index + 1) & mask;
+	}
+}
+
+static void clearEntries(struct HideSetEntry* entries, int num)
+{
+	memset(entries, 0xff, sizeof(*entries) * num);
+}
+
+static int growEntries(struct HideSetTable* table)
+{
+	struct HideSetEntry* old_entries = table->entries;
+	int old_max_entries = table->max_entries;
+	int max_entries = old_max_entries * 2;
+	struct HideSetEntry* entries =
+	    ALLOCATE_TYPE(table->allocator, max_entries, typeof(*entries));
+	if (entries == NULL) {
+		return -1;
+	}
+	clearEntries(entries, max_entries);
+	table->entries = entries;
+	table->max_entries = max_entries;
+	for (int i = 0; i < old_max_entries; i++) {
+		const struct HideSetEntry* entry = &old_entries[i];
+		if (entry->set >= 0) {
+			*findEntry(table, entry->set, entry->name) = *entry;
+		}
+	}
+	deallocate(table->allocator, old_entries);
+	return 0;
+}
+
+static int insertEntry(struct HideSetTable* table, int set, int name,
+                       int result)
+{
+	if ((table->num_entries + 1) * 2 > table->max_entries &&
+	    growEntries(table) != 0) {
+		return -1;
+	}
+	struct HideSetEntry* entry = findEntry(table, set, name);
+	if (entry->set < 0) {
+		table->num_entries++;
+	}
+	entry->set = set;
+	entry->name = name;
+	entry->result = result;
+	return 0;
+}
+
+// Returns the set made of the parent and a name larger than all of its
+// elements. The node is only created once, so equal sets share their index.
+static int internNode(struct HideSetTable* table, int parent, int name)
+{
+	const struct HideSetEntry* entry = findEntry(table, parent, name);
+	if (entry->set >= 0) {
+		return entry->result;
+	}
+	if (table->num_nodes == table->max_nodes) {
+		int max_nodes = table->max_nodes * 2;
+		struct HideSetNode* nodes = reallocate(
+		    table->allocator, table->nodes, sizeof(*nodes) * max_nodes);
+		if (nodes == NULL) {
+			return -1;
+		}
+		table->nodes = nodes;
+		table->max_nodes = max_nodes;
+	}
+	int set = table->num_nodes++;
+	table->nodes[set].parent = parent;
+	table->nodes[set].name = name;
+	if (insertEntry(table, parent, name, set) != 0) {
+		return -1;
+	}
+	for (int it = set; it != HIDE_SET_EMPTY; it = table->nodes[it].parent) {
+		if (insertEntry(table, set, table->nodes[it].name, set) != 0) {
+			return -1;
+		}
+	}
+	return set;
+}
+
+int initHideSetTable(struct HideSetTable* table, struct Allocator* allocator)
+{
+	memset(table, 0, sizeof(*table));
+	table->allocator = allocator;
+	table->max_nodes = HIDE_SET_INITIAL_COUNT;
+	table->nodes =
+	    ALLOCATE_TYPE(allocator, table->max_nodes, typeof(*table->nodes));
+	table->max_entries = HIDE_SET_INITIAL_COUNT * 4;
+	table->entries =
+	    ALLOCATE_TYPE(allocator, table->max_entries, typeof(*table->entries));
+	if (table->nodes == NULL || table->entries == NULL) {
+		cleanupHideSetTable(table);
+		return -1;
+	}
+	resetHideSetTable(table);
+	return 0;
+}
+
+void cleanupHideSetTable(struct HideSetTable* table)
+{
+	if (table->allocator == NULL) {
+		return;
+	}
+	deallocate(table->allocator, table->nodes);
+	deallocate(table->allocator, table->entries);
+	table->nodes = NULL;
+	table->entries = NULL;
+}
+
+void resetHideSetTable(struct HideSetTable* table)
+{
+	table->nodes[HIDE_SET_EMPTY].parent = HIDE_SET_EMPTY;
+	table->nodes[HIDE_SET_EMPTY].name = -1;
+	table->num_nodes = 1;
+	clearEntries(table->entries, table->max_entries);
+	table->num_entries = 0;
+}
+
+int addToHideSet(struct HideSetTable* table, int set, int name)
+{
+	// the results are cached, for elements of the set this is the set itself
+	const struct HideSetEntry* entry = findEntry(table, set, name);
+	if (entry->set >= 0) {
+		return entry->result;
+	}
+	struct HideSetNode node = table->nodes[set];
+	if (set == HIDE_SET_EMPTY || name > node.name) {
+		return internNode(table, set, name);
+	}
+	// keep the elements sorted, the name goes below the largest element
+	int parent = addToHideSet(table, node.parent, name);
+	if (parent < 0) {
+		return -1;
+	}
+	int result = internNode(table, parent, node.name);
+	if (result < 0 || insertEntry(table, set, name, result) != 0) {
+		return -1;
+	}
+	return result;
+}
+
+bool isInHideSet(const struct HideSetTable* table, int set, int name)
+{
+	if (set == HIDE_SET_EMPTY) {
+		return false;
+	}
+	const struct HideSetEntry* entry = findEntry(table, set, name);
+	return entry->set >= 0 && entry->result == set;
+}
+
+int mergeHideSets(struct HideSetTable* table, int set, int other)
+{
+	while (other != HIDE_SET_EMPTY && set >= 0) {
+		struct HideSetNode node = table->nodes[other];
+		set = addToHideSet(table, set, node.name);
+		other = node.parent;
+	}
+	return set;
+}
+
+bool areHideSetsDisjoint(const struct HideSetTable* table, int set,
+                         int other)
+{
+	if (other == HIDE_SET_EMPTY) {
+		return true;
+	}
+	for (int it = set; it != HIDE_SET_EMPTY; it = table->nodes[it].parent) {
+		if (isInHideSet(table, other, table->nodes[it].name)) {
+			return false;
+		}
+	}
+	return true;
+}
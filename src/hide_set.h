@@ -0,0 +1,75 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HIDE_SET_H
+#define HIDE_SET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory/allocator.h"
+
+// the set without any macro names
+#define HIDE_SET_EMPTY 0
+
+#define HIDE_SET_INITIAL_COUNT 64
+
+// A set is stored as a node which adds the largest element to its parent set.
+// Equal sets are interned to the same node, so a set is identified by the
+// index of its node.
+struct HideSetNode {
+	int32_t parent;
+	int32_t name;
+};
+
+// Maps a set and a name to the set with the name added. The set itself is
+// stored for all of its elements, which answers membership queries.
+struct HideSetEntry {
+	int32_t set;
+	int32_t name;
+	int32_t result;
+};
+
+// The hide sets of the macro names which must not be expanded again while
+// their replacement is rescanned
+struct HideSetTable {
+	struct HideSetNode* nodes;
+	int num_nodes;
+	int max_nodes;
+	struct HideSetEntry* entries;
+	int num_entries;
+	int max_entries;
+	struct Allocator* allocator;
+};
+
+int initHideSetTable(struct HideSetTable* table, struct Allocator* allocator);
+
+void cleanupHideSetTable(struct HideSetTable* table);
+
+// Removes all sets except the empty one
+void resetHideSetTable(struct HideSetTable* table);
+
+// Returns the set with the name added or -1 if there is not enough memory
+int addToHideSet(struct HideSetTable* table, int set, int name);
+
+bool isInHideSet(const struct HideSetTable* table, int set, int name);
+
+// Returns the union of both sets or -1 if there is not enough memory
+int mergeHideSets(struct HideSetTable* table, int set, int other);
+
+bool areHideSetsDisjoint(const struct HideSetTable* table, int set,
+                         int other);
+
+#endif
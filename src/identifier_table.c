@@ -0,0 +1,182 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "identifier_table.h"
+
+#include <string.h>
+
+#include "lexer.h"
+#include "memory/allocator.h"
+
+struct Keyword {
+	const char* name;
+	enum TokenType type;
+};
+
+static const struct Keyword keywords[] = {
+    {"auto", KEYWORD_AUTO},
+    {"break", KEYWORD_BREAK},
+    {"case", KEYWORD_CASE},
+    {"char", KEYWORD_CHAR},
+    {"const", KEYWORD_CONST},
+    {"continue", KEYWORD_CONTINUE},
+    {"default", KEYWORD_DEFAULT},
+    {"do", KEYWORD_DO},
+    {"double", KEYWORD_DOUBLE},
+    {"else", KEYWORD_ELSE},
+    {"enum", KEYWORD_ENUM},
+    {"extern", KEYWORD_EXTERN},
+    {"float", KEYWORD_FLOAT},
+    {"for", KEYWORD_FOR},
+    {"goto", KEYWORD_GOTO},
+    {"if", KEYWORD_IF},
+    {"inline", KEYWORD_INLINE},
+    {"int", KEYWORD_INT},
+    {"long", KEYWORD_LONG},
+    {"register", KEYWORD_REGISTER},
+    {"restrict", KEYWORD_RESTRICT},
+    {"return", KEYWORD_RETURN},
+    {"short", KEYWORD_SHORT},
+    {"signed", KEYWORD_SIGNED},
+    {"sizeof", KEYWORD_SIZEOF},
+    {"static", KEYWORD_STATIC},
+    {"struct", KEYWORD_STRUCT},
+    {"switch", KEYWORD_SWITCH},
+    {"typedef", KEYWORD_TYPEDEF},
+    {"union", KEYWORD_UNION},
+    {"unsigned", KEYWORD_UNSIGNED},
+    {"void", KEYWORD_VOID},
+    {"volatile", KEYWORD_VOLATILE},
+    {"while", KEYWORD_WHILE},
+    {"_Alignas", KEYWORD_ALIGNAS},
+    {"_Alignof", KEYWORD_ALIGNOF},
+    {"_Bool", KEYWORD_BOOL},
+    {"_Complex", KEYWORD_COMPLEX},
+    {"_Generic", KEYWORD_GENERIC},
+    {"_Imaginary", KEYWORD_IMAGINARY},
+    {"_Noreturn", KEYWORD_NORETURN},
+    {"_Static_assert", KEYWORD_STATIC_ASSERT},
+    {"__constexpr", KEYWORD_CONSTEXPR},
+};
+
+#define NUM_KEYWORDS (int)(sizeof(keywords) / sizeof(keywords[0]))
+
+static int internKeywords(struct IdentifierTable* table)
+{
+	for (int i = 0; i < NUM_KEYWORDS; i++) {
+		const char* name = keywords[i].name;
+		int length = strlen(name);
+		int index = internIdentifier(table, name, length,
+		                             hashSubstring(name, length));
+		if (index < 0) {
+			return -1;
+		}
+		table->infos[index].keyword = keywords[i].type;
+	}
+	return 0;
+}
+
+int initIdentifierTable(struct IdentifierTable* table,
+                        size_t string_buffer_size, int max_identifiers,
+                        struct Allocator* allocator)
+{
+	if (initStringSet(&table->names, string_buffer_size, max_identifiers,
+	                  allocator) != 0) {
+		return -1;
+	}
+	table->max_infos = table->names.max_num;
+	table->infos = ALLOCATE_TYPE(allocator, table->max_infos,
+	                             typeof(*table->infos));
+	if (table->infos == NULL || internKeywords(table) != 0) {
+		cleanupIdentifierTable(table);
+		return -1;
+	}
+	return 0;
+}
+
+void cleanupIdentifierTable(struct IdentifierTable* table)
+{
+	deallocate(table->names.parent_allocator, table->infos);
+	cleanupStringSet(&table->names);
+	table->infos = NULL;
+	table->max_infos = 0;
+}
+
+void resetIdentifierTable(struct IdentifierTable* table)
+{
+	resetStringSet(&table->names);
+	// interning the keywords again can not fail, the memory is still there
+	internKeywords(table);
+}
+
+void clearIdentifierDefinitions(struct IdentifierTable* table)
+{
+	for (int i = 0; i < getStringCount(&table->names); i++) {
+		table->infos[i].definition = IDENTIFIER_NO_DEFINITION;
+	}
+}
+
+static int reserveInfos(struct IdentifierTable* table, int num)
+{
+	if (num <= table->max_infos) {
+		return 0;
+	}
+	int max_infos = table->max_infos;
+	while (max_infos < num) {
+		max_infos *= 2;
+	}
+	struct IdentifierInfo* infos =
+	    reallocate(table->names.parent_allocator, table->infos,
+	               sizeof(*infos) * max_infos);
+	if (infos == NULL) {
+		return -1;
+	}
+	table->infos = infos;
+	table->max_infos = max_infos;
+	return 0;
+}
+
+int setIdentifierTableBase(struct IdentifierTable* table,
+                           const struct StringSet* base,
+                           const struct IdentifierInfo* infos)
+{
+	int num = getStringCount(base);
+	if (reserveInfos(table, num) != 0) {
+		return -1;
+	}
+	resetStringSet(&table->names);
+	setStringSetBase(&table->names, base);
+	memcpy(table->infos, infos, sizeof(*infos) * num);
+	return 0;
+}
+
+int internIdentifier(struct IdentifierTable* table, const char* string,
+                     int length, uint32_t hash)
+{
+	// make room before a new name is added
+	if (reserveInfos(table, getStringCount(&table->names) + 1) != 0) {
+		return -1;
+	}
+	bool exists;
+	int index = addStringAndHash(&table->names, string, length, hash, &exists);
+	if (index < 0 || exists) {
+		return index;
+	}
+	struct IdentifierInfo* info = &table->infos[index];
+	info->definition = IDENTIFIER_NO_DEFINITION;
+	info->keyword = IDENTIFIER;
+	info->flags = 0;
+	return index;
+}
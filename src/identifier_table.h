@@ -0,0 +1,80 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDENTIFIER_TABLE_H
+#define IDENTIFIER_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "string_set.h"
+
+#define IDENTIFIER_NO_DEFINITION (-1)
+
+// Everything the lexer and preprocessor need to know about an identifier
+struct IdentifierInfo {
+	// index of the current macro definition
+	int32_t definition;
+	// token type of a keyword, IDENTIFIER for other names
+	uint8_t keyword;
+	// reserved, always 0
+	uint8_t flags;
+};
+
+// Interns identifiers and keywords. Keywords are interned first, so they have
+// the same indices in every table. Classifying a word takes a single lookup.
+struct IdentifierTable {
+	struct StringSet names;
+	struct IdentifierInfo* infos;
+	int max_infos;
+};
+
+int initIdentifierTable(struct IdentifierTable* table,
+                        size_t string_buffer_size, int max_identifiers,
+                        struct Allocator* allocator);
+
+void cleanupIdentifierTable(struct IdentifierTable* table);
+
+// Removes all identifiers except the keywords
+void resetIdentifierTable(struct IdentifierTable* table);
+
+// Removes the macro definitions of all identifiers
+void clearIdentifierDefinitions(struct IdentifierTable* table);
+
+// Uses the names of another table as base, like a precompiled header. The
+// table has to be empty except for the keywords, which are in the base as
+// well. The infos of the base are copied because definitions can change.
+int setIdentifierTableBase(struct IdentifierTable* table,
+                           const struct StringSet* base,
+                           const struct IdentifierInfo* infos);
+
+// Returns the index of the identifier, or -1 if it could not be stored
+int internIdentifier(struct IdentifierTable* table, const char* string,
+                     int length, uint32_t hash);
+
+static inline struct IdentifierInfo* getIdentifierInfo(
+    struct IdentifierTable* table, int index)
+{
+	return &table->infos[index];
+}
+
+static inline const char* getIdentifierName(struct IdentifierTable* table,
+                                            int index)
+{
+	return getStringAt(&table->names, index);
+}
+
+#endif
@@ -0,0 +1,460 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "if_expression.h"
+
+#include <stdint.h>
+
+#include "cpp.h"
+#include "error.h"
+
+// Binding strength of the operators, higher binds stronger
+enum IfPrecedence {
+	IF_PRECEDENCE_NONE,
+	IF_PRECEDENCE_CONDITIONAL,
+	IF_PRECEDENCE_LOGICAL_OR,
+	IF_PRECEDENCE_LOGICAL_AND,
+	IF_PRECEDENCE_OR,
+	IF_PRECEDENCE_XOR,
+	IF_PRECEDENCE_AND,
+	IF_PRECEDENCE_EQUALITY,
+	IF_PRECEDENCE_RELATIONAL,
+	IF_PRECEDENCE_SHIFT,
+	IF_PRECEDENCE_ADDITIVE,
+	IF_PRECEDENCE_MULTIPLICATIVE,
+	IF_PRECEDENCE_UNARY,
+};
+
+// Operands have the type intmax_t or uintmax_t, the bits are the same for
+// both
+struct IfValue {
+	uint64_t bits;
+	bool is_unsigned;
+};
+
+struct IfOperator {
+	// token type of the operator, PUNCTUATOR_PARENTHESE_LEFT for groups
+	uint8_t type;
+	uint8_t precedence;
+	bool unary;
+	// the operator keeps its right operand from being evaluated, like the
+	// right side of 0 && x
+	bool skips_operand;
+	// condition of ?:, stored when the : is reached
+	bool condition;
+};
+
+struct IfEvaluation {
+	struct LexerState* state;
+	struct IfValue values[IF_EXPRESSION_STACK_SIZE];
+	struct IfOperator operators[IF_EXPRESSION_STACK_SIZE];
+	int num_values;
+	int num_operators;
+	// number of operators on the stack whose operand is not evaluated,
+	// errors like a division by zero are ignored in these operands
+	int num_skipping;
+};
+
+static int getBinaryPrecedence(int type)
+{
+	switch (type) {
+		case PUNCTUATOR_ASTERISC:
+		case PUNCTUATOR_DIV:
+		case PUNCTUATOR_MODULO:
+			return IF_PRECEDENCE_MULTIPLICATIVE;
+		case PUNCTUATOR_PLUS:
+		case PUNCTUATOR_MINUS:
+			return IF_PRECEDENCE_ADDITIVE;
+		case PUNCTUATOR_SHIFT_LEFT:
+		case PUNCTUATOR_SHIFT_RIGHT:
+			return IF_PRECEDENCE_SHIFT;
+		case PUNCTUATOR_LESS:
+		case PUNCTUATOR_GREATER:
+		case PUNCTUATOR_LESS_OR_EQUAL:
+		case PUNCTUATOR_GREATER_OR_EQUAL:
+			return IF_PRECEDENCE_RELATIONAL;
+		case PUNCTUATOR_EQUAL:
+		case PUNCTUATOR_NOT_EQUAL:
+			return IF_PRECEDENCE_EQUALITY;
+		case PUNCTUATOR_AND:
+			return IF_PRECEDENCE_AND;
+		case PUNCTUATOR_XOR:
+			return IF_PRECEDENCE_XOR;
+		case PUNCTUATOR_OR:
+			return IF_PRECEDENCE_OR;
+		case PUNCTUATOR_LOGICAL_AND:
+			return IF_PRECEDENCE_LOGICAL_AND;
+		case PUNCTUATOR_LOGICAL_OR:
+			return IF_PRECEDENCE_LOGICAL_OR;
+		case PUNCTUATOR_CONDITIONAL:
+		case PUNCTUATOR_COLON:
+			return IF_PRECEDENCE_CONDITIONAL;
+		default:
+			return IF_PRECEDENCE_NONE;
+	}
+}
+
+static bool isUnaryOperator(int type)
+{
+	return type == PUNCTUATOR_PLUS || type == PUNCTUATOR_MINUS ||
+	       type == PUNCTUATOR_NEGATE || type == PUNCTUATOR_LOGICAL_NOT;
+}
+
+static bool pushValue(struct IfEvaluation* eval, struct IfValue value)
+{
+	if (eval->num_values == IF_EXPRESSION_STACK_SIZE) {
+		lexerError(eval->state, "Expression in #if nested too deeply");
+		return false;
+	}
+	eval->values[eval->num_values++] = value;
+	return true;
+}
+
+static bool pushOperator(struct IfEvaluation* eval, int type, int precedence,
+                         bool unary, bool skips_operand)
+{
+	if (eval->num_operators == IF_EXPRESSION_STACK_SIZE) {
+		lexerError(eval->state, "Expression in #if nested too deeply");
+		return false;
+	}
+	struct IfOperator* op = &eval->operators[eval->num_operators++];
+	op->type = type;
+	op->precedence = precedence;
+	op->unary = unary;
+	op->skips_operand = skips_operand;
+	op->condition = false;
+	eval->num_skipping += skips_operand;
+	return true;
+}
+
+static struct IfValue createBool(bool value)
+{
+	struct IfValue result = {value, false};
+	return result;
+}
+
+static bool isLess(struct IfValue a, struct IfValue b, bool is_unsigned)
+{
+	return is_unsigned ? a.bits < b.bits : (int64_t)a.bits < (int64_t)b.bits;
+}
+
+static bool applyUnary(int type, struct IfValue* value)
+{
+	switch (type) {
+		case PUNCTUATOR_PLUS:
+			break;
+		case PUNCTUATOR_MINUS:
+			value->bits = -value->bits;
+			break;
+		case PUNCTUATOR_NEGATE:
+			value->bits = ~value->bits;
+			break;
+		case PUNCTUATOR_LOGICAL_NOT:
+			*value = createBool(value->bits == 0);
+			break;
+	}
+	return true;
+}
+
+static uint64_t shiftLeft(uint64_t bits, uint64_t count)
+{
+	return count >= 64 ? 0 : bits << count;
+}
+
+static uint64_t shiftRight(struct IfValue value, uint64_t count)
+{
+	bool negative = !value.is_unsigned && (int64_t)value.bits < 0;
+	if (count >= 64) {
+		return negative ? UINT64_MAX : 0;
+	}
+	if (negative) {
+		return ~(~value.bits >> count);
+	}
+	return value.bits >> count;
+}
+
+static bool applyBinary(struct IfEvaluation* eval, int type, struct IfValue a,
+                        struct IfValue b, struct IfValue* result)
+{
+	// the usual arithmetic conversions, shifts keep the type of the left
+	// operand
+	bool is_unsigned = a.is_unsigned || b.is_unsigned;
+	result->is_unsigned = is_unsigned;
+	switch (type) {
+		case PUNCTUATOR_ASTERISC:
+			result->bits = a.bits * b.bits;
+			break;
+		case PUNCTUATOR_DIV:
+		case PUNCTUATOR_MODULO:
+			if (b.bits == 0) {
+				if (eval->num_skipping > 0) {
+					result->bits = 0;
+					break;
+				}
+				lexerError(eval->state, "Division by zero in #if");
+				return false;
+			}
+			if (is_unsigned) {
+				result->bits = type == PUNCTUATOR_DIV ? a.bits / b.bits
+				                                      : a.bits % b.bits;
+			} else if ((int64_t)a.bits == INT64_MIN &&
+			           (int64_t)b.bits == -1) {
+				// overflows, wraps around like the other operators
+				result->bits = type == PUNCTUATOR_DIV ? a.bits : 0;
+			} else {
+				int64_t x = a.bits;
+				int64_t y = b.bits;
+				result->bits = type == PUNCTUATOR_DIV ? x / y : x % y;
+			}
+			break;
+		case PUNCTUATOR_PLUS:
+			result->bits = a.bits + b.bits;
+			break;
+		case PUNCTUATOR_MINUS:
+			result->bits = a.bits - b.bits;
+			break;
+		case PUNCTUATOR_SHIFT_LEFT:
+			result->bits = shiftLeft(a.bits, b.bits);
+			result->is_unsigned = a.is_unsigned;
+			break;
+		case PUNCTUATOR_SHIFT_RIGHT:
+			result->bits = shiftRight(a, b.bits);
+			result->is_unsigned = a.is_unsigned;
+			break;
+		case PUNCTUATOR_LESS:
+			*result = createBool(isLess(a, b, is_unsigned));
+			break;
+		case PUNCTUATOR_GREATER:
+			*result = createBool(isLess(b, a, is_unsigned));
+			break;
+		case PUNCTUATOR_LESS_OR_EQUAL:
+			*result = createBool(!isLess(b, a, is_unsigned));
+			break;
+		case PUNCTUATOR_GREATER_OR_EQUAL:
+			*result = createBool(!isLess(a, b, is_unsigned));
+			break;
+		case PUNCTUATOR_EQUAL:
+			*result = createBool(a.bits == b.bits);
+			break;
+		case PUNCTUATOR_NOT_EQUAL:
+			*result = createBool(a.bits != b.bits);
+			break;
+		case PUNCTUATOR_AND:
+			result->bits = a.bits & b.bits;
+			break;
+		case PUNCTUATOR_XOR:
+			result->bits = a.bits ^ b.bits;
+			break;
+		case PUNCTUATOR_OR:
+			result->bits = a.bits | b.bits;
+			break;
+		case PUNCTUATOR_LOGICAL_AND:
+			*result = createBool(a.bits != 0 && b.bits != 0);
+			break;
+		case PUNCTUATOR_LOGICAL_OR:
+			*result = createBool(a.bits != 0 || b.bits != 0);
+			break;
+	}
+	return true;
+}
+
+// Applies the operator on top of the stack to its operands
+static bool reduce(struct IfEvaluation* eval)
+{
+	struct IfOperator op = eval->operators[--eval->num_operators];
+	eval->num_skipping -= op.skips_operand;
+	struct IfValue* values = eval->values;
+	if (op.unary) {
+		return applyUnary(op.type, &values[eval->num_values - 1]);
+	}
+	struct IfValue b = values[--eval->num_values];
+	struct IfValue a = values[eval->num_values - 1];
+	if (op.type == PUNCTUATOR_COLON) {
+		// the condition was already taken from the stack
+		struct IfValue result = op.condition ? a : b;
+		result.is_unsigned = a.is_unsigned || b.is_unsigned;
+		values[eval->num_values - 1] = result;
+		return true;
+	}
+	return applyBinary(eval, op.type, a, b, &values[eval->num_values - 1]);
+}
+
+// Reduces all operators that bind at least as strong as the precedence.
+// Groups and unfinished conditionals are kept.
+static bool reduceOperators(struct IfEvaluation* eval, int precedence)
+{
+	while (eval->num_operators > 0) {
+		const struct IfOperator* top =
+		    &eval->operators[eval->num_operators - 1];
+		if (top->type == PUNCTUATOR_PARENTHESE_LEFT ||
+		    top->type == PUNCTUATOR_CONDITIONAL ||
+		    top->precedence < precedence) {
+			break;
+		}
+		if (!reduce(eval)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool readOperand(struct IfEvaluation* eval,
+                        const struct PreprocessorToken* pp_token)
+{
+	struct LexerToken token;
+	if (!createLexerTokenFromPPToken(eval->state, pp_token, &token)) {
+		return false;
+	}
+	struct IfValue value = {0, false};
+	switch (token.type) {
+		case CONSTANT_INT:
+			value.bits = token.value.int_literal;
+			// too large for intmax_t
+			value.is_unsigned = (int64_t)value.bits < 0;
+			break;
+		case CONSTANT_UNSIGNED_INT:
+			value.bits = token.value.int_literal;
+			value.is_unsigned = true;
+			break;
+		case CONSTANT_CHAR:
+		case CONSTANT_UNSIGNED_CHAR:
+			value.bits = (int64_t)token.value.character_literal;
+			break;
+		case CONSTANT_FLOAT:
+		case CONSTANT_DOUBLE:
+			lexerError(eval->state, "Floating point constant in #if");
+			return false;
+		default:
+			if (token.type > KEYWORD_CONSTEVAL) {
+				lexerError(eval->state, "Expression expected in #if");
+				return false;
+			}
+			// identifiers and keywords that were not expanded
+			break;
+	}
+	return pushValue(eval, value);
+}
+
+static bool readOperator(struct IfEvaluation* eval, int type)
+{
+	if (type == PUNCTUATOR_PARENTHESE_RIGHT) {
+		if (!reduceOperators(eval, IF_PRECEDENCE_NONE)) {
+			return false;
+		}
+		if (eval->num_operators == 0 ||
+		    eval->operators[eval->num_operators - 1].type !=
+		        PUNCTUATOR_PARENTHESE_LEFT) {
+			lexerError(eval->state, "Unbalanced ')' in #if");
+			return false;
+		}
+		eval->num_operators--;
+		return true;
+	}
+	int precedence = getBinaryPrecedence(type);
+	if (precedence == IF_PRECEDENCE_NONE) {
+		lexerError(eval->state, "Operator expected in #if");
+		return false;
+	}
+	if (type == PUNCTUATOR_COLON) {
+		// turns the ? into the : that selects between both operands
+		if (!reduceOperators(eval, IF_PRECEDENCE_CONDITIONAL)) {
+			return false;
+		}
+		if (eval->num_operators == 0 ||
+		    eval->operators[eval->num_operators - 1].type !=
+		        PUNCTUATOR_CONDITIONAL) {
+			lexerError(eval->state, "Missing '?' in #if");
+			return false;
+		}
+		struct IfOperator* op = &eval->operators[eval->num_operators - 1];
+		struct IfValue second = eval->values[--eval->num_values];
+		bool condition = eval->values[eval->num_values - 1].bits != 0;
+		eval->values[eval->num_values - 1] = second;
+		eval->num_skipping -= op->skips_operand;
+		eval->num_operators--;
+		if (!pushOperator(eval, PUNCTUATOR_COLON, precedence, false,
+		                  condition)) {
+			return false;
+		}
+		eval->operators[eval->num_operators - 1].condition = condition;
+		return true;
+	}
+	// ?: groups from the right, the other binary operators from the left
+	if (!reduceOperators(eval, type == PUNCTUATOR_CONDITIONAL ? precedence + 1
+	                                                           : precedence)) {
+		return false;
+	}
+	const struct IfValue* left = &eval->values[eval->num_values - 1];
+	bool skips_operand = false;
+	if (type == PUNCTUATOR_LOGICAL_AND || type == PUNCTUATOR_CONDITIONAL) {
+		skips_operand = left->bits == 0;
+	} else if (type == PUNCTUATOR_LOGICAL_OR) {
+		skips_operand = left->bits != 0;
+	}
+	return pushOperator(eval, type, precedence, false, skips_operand);
+}
+
+bool evaluateIfExpression(struct LexerState* state, bool* value)
+{
+	struct IfEvaluation eval;
+	eval.state = state;
+	eval.num_values = 0;
+	eval.num_operators = 0;
+	eval.num_skipping = 0;
+	bool expect_operand = true;
+	while (true) {
+		struct PreprocessorToken token;
+		if (!getExpandedToken(&state->pp_state, &token)) {
+			return false;
+		}
+		int type = token.type;
+		if (type == TOKEN_EOF) {
+			break;
+		}
+		bool success;
+		if (expect_operand && type == PUNCTUATOR_PARENTHESE_LEFT) {
+			success = pushOperator(&eval, type, IF_PRECEDENCE_NONE, false,
+			                       false);
+		} else if (expect_operand && isUnaryOperator(type)) {
+			success = pushOperator(&eval, type, IF_PRECEDENCE_UNARY, true,
+			                       false);
+		} else if (expect_operand) {
+			success = readOperand(&eval, &token);
+			expect_operand = false;
+		} else {
+			success = readOperator(&eval, type);
+			expect_operand = type != PUNCTUATOR_PARENTHESE_RIGHT;
+		}
+		if (!success) {
+			return false;
+		}
+	}
+	if (expect_operand) {
+		lexerError(state, "Expression expected in #if");
+		return false;
+	}
+	if (!reduceOperators(&eval, IF_PRECEDENCE_NONE)) {
+		return false;
+	}
+	if (eval.num_operators > 0) {
+		int type = eval.operators[eval.num_operators - 1].type;
+		lexerError(state, type == PUNCTUATOR_CONDITIONAL
+		                      ? "Missing ':' in #if"
+		                      : "Unbalanced '(' in #if");
+		return false;
+	}
+	*value = eval.values[0].bits != 0;
+	return true;
+}
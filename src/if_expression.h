@@ -0,0 +1,32 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IF_EXPRESSION_H
+#define IF_EXPRESSION_H
+
+#include <stdbool.h>
+
+#include "lexer.h"
+
+#define IF_EXPRESSION_STACK_SIZE 64
+
+// Evaluates the condition of #if or #elif. The tokens are pulled from the
+// current token expansion of the preprocessor, which has to hold the
+// condition with the operands of defined already replaced. Identifiers that
+// remain after the expansion are 0. The evaluation works on fixed size
+// stacks and does not allocate.
+bool evaluateIfExpression(struct LexerState* state, bool* value);
+
+#endif
@@ -0,0 +1,316 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "include_search.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "helper.h"
+
+enum ListingState {
+	LISTING_NOT_READ,
+	LISTING_READ,
+	// the directory does not exist
+	LISTING_MISSING,
+	// the directory could not be read, it is probed like without a cache
+	LISTING_UNAVAILABLE,
+};
+
+#define INCLUDE_CACHE_NOT_STORED (-2)
+
+void initIncludeSearchPath(struct IncludeSearchPath* search_path)
+{
+	search_path->num = 0;
+	search_path->num_user = 0;
+}
+
+int addIncludeDirectory(struct IncludeSearchPath* search_path,
+                        const char* directory, bool system)
+{
+	if (search_path->num == INCLUDE_SEARCH_MAX_DIRECTORIES) {
+		return -1;
+	}
+	int index = search_path->num;
+	if (!system) {
+		index = search_path->num_user++;
+		memmove(&search_path->directories[index + 1],
+		        &search_path->directories[index],
+		        sizeof(*search_path->directories) * (search_path->num - index));
+	}
+	search_path->directories[index] = directory;
+	search_path->num++;
+	return 0;
+}
+
+bool getFileId(const char* path, struct FileId* id)
+{
+	struct stat file_stat;
+	if (stat(path, &file_stat) != 0 || S_ISDIR(file_stat.st_mode)) {
+		return false;
+	}
+	id->device = file_stat.st_dev;
+	id->inode = file_stat.st_ino;
+	return true;
+}
+
+// Joins directory and name. A directory of length 0 is the working directory.
+static bool tryPath(const char* directory, size_t dir_length, const char* name,
+                    char* path_buffer, size_t buffer_size, struct FileId* id)
+{
+	size_t name_length = strlen(name);
+	bool separator = dir_length > 0 && directory[dir_length - 1] != '/';
+	if (dir_length + separator + name_length >= buffer_size) {
+		return false;
+	}
+	memcpy(path_buffer, directory, dir_length);
+	if (separator) {
+		path_buffer[dir_length++] = '/';
+	}
+	memcpy(path_buffer + dir_length, name, name_length + 1);
+	return getFileId(path_buffer, id);
+}
+
+static void readListing(struct IncludeDirectoryListing* listing,
+                        const char* directory, struct Allocator* allocator)
+{
+	listing->state = LISTING_UNAVAILABLE;
+	DIR* dir = opendir(directory);
+	if (dir == NULL) {
+		if (errno == ENOENT || errno == ENOTDIR) {
+			listing->state = LISTING_MISSING;
+		}
+		return;
+	}
+	if (initStringSet(&listing->names, INCLUDE_CACHE_STRINGSET_SIZE,
+	                  INCLUDE_CACHE_LISTING_COUNT, allocator) != 0) {
+		closedir(dir);
+		return;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (addString(&listing->names, entry->d_name,
+		              strlen(entry->d_name)) < 0) {
+			cleanupStringSet(&listing->names);
+			closedir(dir);
+			return;
+		}
+	}
+	closedir(dir);
+	listing->state = LISTING_READ;
+}
+
+// Checks whether the first component of the name exists in the directory
+static bool mayContain(struct IncludeCache* cache, int index,
+                       const char* directory, const char* name)
+{
+	if (cache == NULL) {
+		return true;
+	}
+	struct IncludeDirectoryListing* listing = &cache->listings[index];
+	if (listing->state == LISTING_NOT_READ) {
+		readListing(listing, directory, cache->allocator);
+	}
+	if (listing->state == LISTING_MISSING) {
+		return false;
+	} else if (listing->state == LISTING_UNAVAILABLE) {
+		return true;
+	}
+	const char* separator = strchr(name, '/');
+	int length = separator != NULL ? separator - name : (int)strlen(name);
+	return findIndex(&listing->names, name, length,
+	                 hashSubstring(name, length)) >= 0;
+}
+
+static int searchIncludeFile(const struct IncludeSearchPath* search_path,
+                             struct IncludeCache* cache, const char* name,
+                             bool quoted, const char* including_path,
+                             char* path_buffer, size_t buffer_size,
+                             struct FileId* id)
+{
+	if (name[0] == '/') {
+		return tryPath("", 0, name, path_buffer, buffer_size, id) ? 0 : -1;
+	}
+	if (quoted) {
+		size_t dir_length = fileName(including_path) - including_path;
+		if (tryPath(including_path, dir_length, name, path_buffer,
+		            buffer_size, id)) {
+			return 0;
+		}
+	}
+	if (search_path == NULL) {
+		return -1;
+	}
+	for (int i = 0; i < search_path->num; i++) {
+		const char* directory = search_path->directories[i];
+		if (mayContain(cache, i, directory, name) &&
+		    tryPath(directory, strlen(directory), name, path_buffer,
+		            buffer_size, id)) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int findIncludeFile(const struct IncludeSearchPath* search_path,
+                    const char* name, bool quoted, const char* including_path,
+                    char* path_buffer, size_t buffer_size, struct FileId* id)
+{
+	return searchIncludeFile(search_path, NULL, name, quoted, including_path,
+	                         path_buffer, buffer_size, id);
+}
+
+void initIncludeCache(struct IncludeCache* cache, struct Allocator* allocator)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->allocator = allocator;
+}
+
+void cleanupIncludeCache(struct IncludeCache* cache)
+{
+	if (!cache->initialized) {
+		return;
+	}
+	for (int i = 0; i < INCLUDE_SEARCH_MAX_DIRECTORIES; i++) {
+		if (cache->listings[i].state == LISTING_READ) {
+			cleanupStringSet(&cache->listings[i].names);
+		}
+	}
+	deallocate(cache->allocator, cache->listings);
+	deallocate(cache->allocator, cache->entries);
+	cleanupStringSet(&cache->keys);
+	cleanupStringSet(&cache->paths);
+	cache->initialized = false;
+}
+
+static int setUpIncludeCache(struct IncludeCache* cache,
+                             const struct IncludeSearchPath* search_path)
+{
+	struct Allocator* allocator = cache->allocator;
+	cleanupIncludeCache(cache);
+	cache->search_path = search_path;
+	if (initStringSet(&cache->keys, INCLUDE_CACHE_STRINGSET_SIZE,
+	                  INCLUDE_CACHE_COUNT, allocator) != 0) {
+		goto err1;
+	}
+	if (initStringSet(&cache->paths, INCLUDE_CACHE_STRINGSET_SIZE,
+	                  INCLUDE_CACHE_COUNT, allocator) != 0) {
+		goto err2;
+	}
+	cache->max_entries = cache->keys.max_num;
+	cache->entries =
+	    ALLOCATE_TYPE(allocator, cache->max_entries, struct IncludeCacheEntry);
+	if (cache->entries == NULL) {
+		goto err3;
+	}
+	cache->listings = ALLOCATE_TYPE(allocator, INCLUDE_SEARCH_MAX_DIRECTORIES,
+	                                struct IncludeDirectoryListing);
+	if (cache->listings == NULL) {
+		goto err4;
+	}
+	for (int i = 0; i < INCLUDE_SEARCH_MAX_DIRECTORIES; i++) {
+		cache->listings[i].state = LISTING_NOT_READ;
+	}
+	cache->initialized = true;
+	return 0;
+err4:
+	deallocate(allocator, cache->entries);
+err3:
+	cleanupStringSet(&cache->paths);
+err2:
+	cleanupStringSet(&cache->keys);
+err1:
+	return -1;
+}
+
+// Returns the index of the cache entry, or -1 if it could not be stored
+static int addCacheKey(struct IncludeCache* cache, const char* key,
+                       int length, bool* exists)
+{
+	if (getStringCount(&cache->keys) == cache->max_entries) {
+		int max_entries = cache->max_entries * 2;
+		struct IncludeCacheEntry* entries =
+		    reallocate(cache->allocator, cache->entries,
+		               sizeof(*entries) * max_entries);
+		if (entries == NULL) {
+			return -1;
+		}
+		cache->entries = entries;
+		cache->max_entries = max_entries;
+	}
+	return addStringAndHash(&cache->keys, key, length,
+	                        hashSubstring(key, length), exists);
+}
+
+int findCachedIncludeFile(struct IncludeCache* cache,
+                          const struct IncludeSearchPath* search_path,
+                          const char* name, bool quoted,
+                          const char* including_path, char* path_buffer,
+                          size_t buffer_size, struct FileId* id)
+{
+	if ((!cache->initialized || cache->search_path != search_path) &&
+	    setUpIncludeCache(cache, search_path) != 0) {
+		return findIncludeFile(search_path, name, quoted, including_path,
+		                       path_buffer, buffer_size, id);
+	}
+	// the key is the kind of the name, the directory of the including file
+	// for quoted names, and the name itself
+	size_t dir_length = 0;
+	if (quoted && name[0] != '/') {
+		dir_length = fileName(including_path) - including_path;
+	}
+	size_t name_length = strlen(name);
+	size_t key_length = dir_length + name_length + 2;
+	int index = -1;
+	bool exists = false;
+	if (key_length <= buffer_size) {
+		path_buffer[0] = quoted ? '"' : '<';
+		memcpy(path_buffer + 1, including_path, dir_length);
+		path_buffer[dir_length + 1] = 0;
+		memcpy(path_buffer + dir_length + 2, name, name_length);
+		index = addCacheKey(cache, path_buffer, key_length, &exists);
+	}
+	if (index < 0) {
+		return searchIncludeFile(search_path, cache, name, quoted,
+		                         including_path, path_buffer, buffer_size, id);
+	}
+
+	struct IncludeCacheEntry* entry = &cache->entries[index];
+	if (!exists || entry->path == INCLUDE_CACHE_NOT_STORED) {
+		entry->path = -1;
+		if (searchIncludeFile(search_path, cache, name, quoted,
+		                      including_path, path_buffer, buffer_size,
+		                      &entry->id) != 0) {
+			return -1;
+		}
+		entry->path =
+		    addString(&cache->paths, path_buffer, strlen(path_buffer));
+		if (entry->path < 0) {
+			entry->path = INCLUDE_CACHE_NOT_STORED;
+		}
+		*id = entry->id;
+		return 0;
+	}
+	if (entry->path < 0) {
+		return -1;
+	}
+	const char* path = getStringAt(&cache->paths, entry->path);
+	int length = getLengthAt(&cache->paths, entry->path);
+	memcpy(path_buffer, path, length + 1);
+	*id = entry->id;
+	return 0;
+}
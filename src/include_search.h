@@ -0,0 +1,104 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDE_SEARCH_H
+#define INCLUDE_SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory/allocator.h"
+#include "string_set.h"
+
+#define INCLUDE_SEARCH_MAX_DIRECTORIES 64
+#define INCLUDE_CACHE_STRINGSET_SIZE (4096 << 2)
+#define INCLUDE_CACHE_COUNT 256
+#define INCLUDE_CACHE_LISTING_COUNT 256
+
+// Directories that are searched for included files. Directories added with -I
+// come before the ones added with -isystem, both groups keep the order in
+// which they were added.
+struct IncludeSearchPath {
+	int num;
+	int num_user;
+	const char* directories[INCLUDE_SEARCH_MAX_DIRECTORIES];
+};
+
+// Identifies a file independent of the path it was found with
+struct FileId {
+	uint64_t device;
+	uint64_t inode;
+};
+
+// Returns false if the path does not exist or is a directory
+bool getFileId(const char* path, struct FileId* id);
+
+void initIncludeSearchPath(struct IncludeSearchPath* search_path);
+
+// The directory is not copied and has to stay valid as long as the search
+// path is used.
+int addIncludeDirectory(struct IncludeSearchPath* search_path,
+                        const char* directory, bool system);
+
+// Writes the path of the file a header name refers to into path_buffer and
+// its identity into id. Quoted names are looked up relative to the directory
+// of the including file before the search path is used. The search path may
+// be NULL. Returns -1 if no file was found.
+int findIncludeFile(const struct IncludeSearchPath* search_path,
+                    const char* name, bool quoted, const char* including_path,
+                    char* path_buffer, size_t buffer_size, struct FileId* id);
+
+struct IncludeCacheEntry {
+	// index into the cached paths, -1 if the file was not found
+	int path;
+	struct FileId id;
+};
+
+struct IncludeDirectoryListing {
+	struct StringSet names;
+	uint8_t state;
+};
+
+// Remembers the results of include lookups by header name and the directory
+// of the including file, whether the file was found or not. The entries of
+// every search directory are read once, so directories that can not contain
+// a header are skipped without touching the file system. The cache belongs to
+// one search path and is cleared when it is used with another one.
+struct IncludeCache {
+	bool initialized;
+	struct Allocator* allocator;
+	const struct IncludeSearchPath* search_path;
+	struct StringSet keys;
+	struct IncludeCacheEntry* entries;
+	int max_entries;
+	struct StringSet paths;
+	struct IncludeDirectoryListing* listings;
+};
+
+// The cache allocates its memory on first use
+void initIncludeCache(struct IncludeCache* cache, struct Allocator* allocator);
+
+void cleanupIncludeCache(struct IncludeCache* cache);
+
+// Same as findIncludeFile, but only the first lookup of a header name touches
+// the file system
+int findCachedIncludeFile(struct IncludeCache* cache,
+                          const struct IncludeSearchPath* search_path,
+                          const char* name, bool quoted,
+                          const char* including_path, char* path_buffer,
+                          size_t buffer_size, struct FileId* id);
+
+#endif
@@ -15,7 +15,11 @@
 
 #include "input_file.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "helper.h"
 #include "memory/allocator.h"
@@ -50,16 +54,90 @@ int openInputFile(struct InputFile* file, const char* path, const char* name)
 		return -1;
 	}
 	file->buffer = buffer;
+	file->owns_buffer = true;
+	return 0;
+}
+
+int loadInputFile(struct InputFile* file, const char* path, const char* name)
+{
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		return -1;
+	}
+	size_t size = getFileSize(f);
+	char* buffer = allocate(getGlobalAllocator(), MAX(size, 1));
+	if (!buffer) {
+		fclose(f);
+		return -1;
+	}
+	if (size > 0 && fread(buffer, size, 1, f) != 1) {
+		deallocate(getGlobalAllocator(), buffer);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	file->name = name;
+	file->full_path = path;
+	file->file = NULL;
+	file->read_pos = 0;
+	file->file_size = size;
+	file->buffer = buffer;
+	file->owns_buffer = true;
+	return 0;
+}
+
+void createInputFileView(struct InputFile* view, const struct InputFile* file,
+                         size_t read_pos)
+{
+	view->name = file->name;
+	view->full_path = file->full_path;
+	view->file = NULL;
+	view->read_pos = read_pos;
+	view->file_size = file->file_size;
+	view->buffer = file->buffer;
+	view->owns_buffer = false;
+}
+
+int reopenInputFile(struct InputFile* file, const char* path,
+                    const char* name)
+{
+	if (isInputFileInMemory(file) || !file->owns_buffer) {
+		closeInputFile(file);
+		return openInputFile(file, path, name);
+	}
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		return -1;
+	}
+	fclose(file->file);
+	file->name = name;
+	file->full_path = path;
+	file->file = f;
+	file->read_pos = 0;
+	file->file_size = getFileSize(f);
 	return 0;
 }
 
 void closeInputFile(struct InputFile* file)
 {
-	deallocate(getGlobalAllocator(), file->buffer);
+	if (file->owns_buffer) {
+		deallocate(getGlobalAllocator(), file->buffer);
+	}
+	if (file->file != NULL) {
+		fclose(file->file);
+	}
+	file->buffer = NULL;
+	file->file = NULL;
 }
 
 char readChar(struct InputFile* file)
 {
+	if (isInputFileInMemory(file)) {
+		if (file->read_pos == file->file_size) {
+			return INPUT_EOF;
+		}
+		return file->buffer[file->read_pos++];
+	}
 	size_t chunk_pos = file->read_pos % INPUT_CHUNK_SIZE;
 	if (chunk_pos == 0) {
 		readChunk(file);
@@ -71,3 +149,38 @@ char readChar(struct InputFile* file)
 	file->read_pos++;
 	return c;
 }
+
+int mapFile(struct MappedFile* file, const char* path, size_t max_size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		close(fd);
+		return -1;
+	}
+	file->size = MIN((size_t)file_stat.st_size, max_size);
+	file->data = NULL;
+	if (file->size > 0) {
+		void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		file->data = data;
+	}
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+	return 0;
+}
+
+void unmapFile(struct MappedFile* file)
+{
+	if (file->data != NULL) {
+		munmap((void*)file->data, file->size);
+	}
+	file->data = NULL;
+	file->size = 0;
+}
@@ -21,6 +21,8 @@
 #define INPUT_CHUNK_SIZE (4096 << 2)
 #define INPUT_EOF 0x4
 
+#include <stdbool.h>
+
 struct InputFile {
 	const char* name;
 	const char* full_path;
@@ -28,11 +30,62 @@ struct InputFile {
 	size_t read_pos;
 	size_t file_size;
 	FILE* file;
+	bool owns_buffer;
+};
+
+// A read only memory mapping of a whole file or of its beginning
+struct MappedFile {
+	const unsigned char* data;
+	size_t size;
 };
 
 int openInputFile(struct InputFile* file, const char* path, const char* name);
 
+// Reads the whole file into memory instead of streaming it in chunks.
+int loadInputFile(struct InputFile* file, const char* path, const char* name);
+
+// Creates a file that reads from the in memory buffer of an already loaded
+// file. The view does not own the buffer.
+void createInputFileView(struct InputFile* view, const struct InputFile* file,
+                         size_t read_pos);
+
+static inline bool isInputFileInMemory(const struct InputFile* file)
+{
+	return file->file == NULL;
+}
+
+// Opens another file for reading while reusing the read buffer of the
+// previously opened one.
+int reopenInputFile(struct InputFile* file, const char* path,
+                    const char* name);
+
 void closeInputFile(struct InputFile* file);
 
 char readChar(struct InputFile* file);
+
+// Returns the bytes that were read into memory but not returned by readChar
+// yet. Nothing is buffered at the end of a chunk of a streamed file.
+static inline const char* getBufferedInput(const struct InputFile* file,
+                                           size_t* size)
+{
+	size_t begin = file->read_pos;
+	size_t end = file->file_size;
+	if (!isInputFileInMemory(file)) {
+		begin = file->read_pos % INPUT_CHUNK_SIZE;
+		end = file->file_size - file->read_pos + begin;
+		if (begin == 0) {
+			end = 0;
+		} else if (end > INPUT_CHUNK_SIZE) {
+			end = INPUT_CHUNK_SIZE;
+		}
+	}
+	*size = end - begin;
+	return file->buffer + begin;
+}
+
+// Maps at most max_size bytes of a file into memory. Empty files are not
+// mapped and have a NULL data pointer.
+int mapFile(struct MappedFile* file, const char* path, size_t max_size);
+
+void unmapFile(struct MappedFile* file);
 #endif
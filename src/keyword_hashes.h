@@ -1,63 +0,0 @@
-/*	Copyright (C) 2021 David Leiter
- *	This program is free software: you can redistribute it and/or modify
- *	it under the terms of the GNU General Public License as published by
- *	the Free Software Foundation, either version 3 of the License, or
- *	(at your option) any later version.
- *
- *	This program is distributed in the hope that it will be useful,
- *	but WITHOUT ANY WARRANTY; without even the implied warranty of
- *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *	GNU General Public License for more details.
- *
- *	You should have received a copy of the GNU General Public License
- *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
- */
-
-#ifndef KEYWORD_HASHES
-#define KEYWORD_HASHES
-
-#define KEYWORD_HASH_AUTO 0x7c6db8aa
-#define KEYWORD_HASH_BREAK 0xa7dd9fa
-#define KEYWORD_HASH_CASE 0x7c70c251
-#define KEYWORD_HASH_CHAR 0x7c70e6dd
-#define KEYWORD_HASH_CONST 0xa8bffc0
-#define KEYWORD_HASH_CONTINUE 0x8f091da4
-#define KEYWORD_HASH_DEFAULT 0x9ce67dce
-#define KEYWORD_HASH_DO 0x596d8e
-#define KEYWORD_HASH_DOUBLE 0x4348b570
-#define KEYWORD_HASH_ELSE 0x7c6b8f5a
-#define KEYWORD_HASH_ENUM 0x7c6b8616
-#define KEYWORD_HASH_EXTERN 0x4653eaf5
-#define KEYWORD_HASH_FLOAT 0xa364435
-#define KEYWORD_HASH_FOR 0xb8737be
-#define KEYWORD_HASH_GOTO 0x7c6ecbf6
-#define KEYWORD_HASH_IF 0x596f2a
-#define KEYWORD_HASH_INLINE 0x5fb1876c
-#define KEYWORD_HASH_INT 0xb875316
-#define KEYWORD_HASH_LONG 0x7c6f244f
-#define KEYWORD_HASH_REGISTER 0xaceca1ac
-#define KEYWORD_HASH_RESTRICT 0x7f9a6ad9
-#define KEYWORD_HASH_RETURN 0x7e985a8f
-#define KEYWORD_HASH_SHORT 0xbaefa97
-#define KEYWORD_HASH_SIGNED 0x81830137
-#define KEYWORD_HASH_SIZEOF 0x81777349
-#define KEYWORD_HASH_STATIC 0x7f9e0cfd
-#define KEYWORD_HASH_STRUCT 0x7fa39012
-#define KEYWORD_HASH_SWITCH 0x7fb03db7
-#define KEYWORD_HASH_TYPEDEF 0x518da1fa
-#define KEYWORD_HASH_UNION 0xafd7cf6
-#define KEYWORD_HASH_UNSIGNED 0xbb22c08c
-#define KEYWORD_HASH_VOID 0x7c76f231
-#define KEYWORD_HASH_VOLATILE 0xdf12d9c5
-#define KEYWORD_HASH_WHILE 0xb66c65a
-#define KEYWORD_HASH_ALIGNAS 0x2c73aba5
-#define KEYWORD_HASH_ALIGNOF 0x2c73ac7e
-#define KEYWORD_HASH_BOOL 0xe2179f4
-#define KEYWORD_HASH_COMPLEX 0xbaba7a7a
-#define KEYWORD_HASH_GENERIC 0xe053168b
-#define KEYWORD_HASH_IMAGINARY 0xa0e51975
-#define KEYWORD_HASH_NORETURN 0x5bdbc511
-#define KEYWORD_HASH_STATIC_ASSERT 0x58f1edbf
-#define KEYWORD_HASH_CONSTEXPR 0x1ce614df
-
-#endif
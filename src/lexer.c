@@ -19,15 +19,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "cpp.h"
 #include "error.h"
 #include "helper.h"
-#include "keyword_hashes.h"
+#include "if_expression.h"
 #include "memory/scratchpad.h"
 
 #define MAX_STRING_LENGTH 2048
 #define MAX_PP_NUMBER_LENGTH 1024
 #define MAX_IDENTIFIER_LENGTH 256
+#define MAX_PATH_LENGTH 4096
 
 #define NEXT(lexer_state, out_label)        \
 	if (!consumeLexableChar(lexer_state)) { \
@@ -85,8 +90,11 @@ bool createLexerTokenFromPPToken(struct LexerState* state,
 	token->line = pp_token->line;
 	token->column = pp_token->column;
 	token->line_pos = pp_token->line_pos;
-	if (pp_token->type == LITERAL_STRING || pp_token->type == IDENTIFIER) {
+	if (pp_token->type == LITERAL_STRING ||
+	    pp_token->type <= KEYWORD_CONSTEVAL) {
 		token->value.string_index = pp_token->value_handle;
+	} else if (pp_token->type == LITERAL_EMBED) {
+		token->value.embed_index = pp_token->value_handle;
 	} else if (pp_token->type >= CONSTANT_CHAR &&
 	           pp_token->type <= CONSTANT_DOUBLE) {
 		token->value = state->constants.constants[pp_token->value_handle];
@@ -168,7 +176,7 @@ static int createFloatingpointConstantToken(struct LexerToken* token,
 }
 
 static int createIdentifierToken(struct LexerToken* token,
-                                 const struct FileContext* ctx, uint16_t index)
+                                 const struct FileContext* ctx, uint32_t index)
 {
 	token->line = ctx->line;
 	token->column = ctx->column;
@@ -181,7 +189,7 @@ static int createIdentifierToken(struct LexerToken* token,
 
 static int createStringConstantToken(struct LexerToken* token,
                                      const struct FileContext* ctx,
-                                     uint16_t index)
+                                     uint32_t index)
 {
 	token->line = ctx->line;
 	token->column = ctx->column;
@@ -205,7 +213,7 @@ static int createCharacterConstantToken(struct LexerToken* token,
 }
 
 static int createPPNumberToken(struct LexerToken* token,
-                               const struct FileContext* ctx, uint16_t index)
+                               const struct FileContext* ctx, uint32_t index)
 {
 	token->line = ctx->line;
 	token->column = ctx->column;
@@ -216,274 +224,6 @@ static int createPPNumberToken(struct LexerToken* token,
 	return 0;
 }
 
-static bool matchKeyword(const char* buffer, uint32_t buffer_hash,
-                         const struct FileContext* ctx,
-                         struct LexerToken* token)
-{
-	switch (buffer_hash) {
-		case KEYWORD_HASH_AUTO:
-			if (strcmp("auto", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_AUTO);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_BREAK:
-			if (strcmp("break", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_BREAK);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_CASE:
-			if (strcmp("case", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_CASE);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_CHAR:
-			if (strcmp("char", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_CHAR);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_CONST:
-			if (strcmp("const", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_CONST);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_CONTINUE:
-			if (strcmp("continue", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_CONTINUE);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_DEFAULT:
-			if (strcmp("default", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_DEFAULT);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_DO:
-			if (strcmp("do", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_DO);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_DOUBLE:
-			if (strcmp("double", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_DOUBLE);
-				return true;
-			}
-		case KEYWORD_HASH_ELSE:
-			if (strcmp("else", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_ELSE);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_ENUM:
-			if (strcmp("enum", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_ENUM);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_EXTERN:
-			if (strcmp("extern", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_EXTERN);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_FLOAT:
-			if (strcmp("float", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_FLOAT);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_FOR:
-			if (strcmp("for", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_FOR);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_GOTO:
-			if (strcmp("goto", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_GOTO);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_IF:
-			if (strcmp("if", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_IF);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_INLINE:
-			if (strcmp("inline", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_INLINE);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_INT:
-			if (strcmp("int", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_INT);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_LONG:
-			if (strcmp("long", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_LONG);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_REGISTER:
-			if (strcmp("register", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_REGISTER);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_RESTRICT:
-			if (strcmp("restrict", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_RESTRICT);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_RETURN:
-			if (strcmp("return", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_RETURN);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_SHORT:
-			if (strcmp("short", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_SHORT);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_SIGNED:
-			if (strcmp("signed", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_SIGNED);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_SIZEOF:
-			if (strcmp("sizeof", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_SIZEOF);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_STATIC:
-			if (strcmp("static", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_STATIC);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_STRUCT:
-			if (strcmp("struct", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_STRUCT);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_SWITCH:
-			if (strcmp("switch", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_SWITCH);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_TYPEDEF:
-			if (strcmp("typedef", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_TYPEDEF);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_UNION:
-			if (strcmp("union", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_UNION);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_UNSIGNED:
-			if (strcmp("unsigned", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_UNSIGNED);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_VOID:
-			if (strcmp("void", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_VOID);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_VOLATILE:
-			if (strcmp("volatile", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_VOLATILE);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_WHILE:
-			if (strcmp("while", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_WHILE);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_ALIGNAS:
-			if (strcmp("_Alignas", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_ALIGNAS);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_ALIGNOF:
-			if (strcmp("_Alignof", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_ALIGNOF);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_BOOL:
-			if (strcmp("_Bool", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_BOOL);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_COMPLEX:
-			if (strcmp("_Complex", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_COMPLEX);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_GENERIC:
-			if (strcmp("_Generic", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_GENERIC);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_IMAGINARY:
-			if (strcmp("_Imaginary", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_IMAGINARY);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_NORETURN:
-			if (strcmp("_Noreturn", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_NORETURN);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_STATIC_ASSERT:
-			if (strcmp("_Static_assert", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_STATIC_ASSERT);
-				return true;
-			}
-			break;
-		case KEYWORD_HASH_CONSTEXPR:
-			if (strcmp("__constexpr", buffer) == 0) {
-				createSimpleToken(token, ctx, KEYWORD_CONSTEXPR);
-				return true;
-			}
-			break;
-		default:
-			break;
-	}
-	return false;
-}
-
 static void readInputAndHandleLineEndings(struct LexerState* state)
 {
 	// support unix, dos and legacy mac text files
@@ -525,31 +265,54 @@ static void consumeInput(struct LexerState* state)
 	}
 	readInputAndHandleLineEndings(state);
 }
+static void startReading(struct LexerState* state)
+{
+	memset(&state->current_pos, 0, sizeof(state->current_pos));
+	memset(&state->lookahead_pos, 0, sizeof(state->lookahead_pos));
+	state->line_beginning = true;
+	readInputAndHandleLineEndings(state);
+	consumeInput(state);
+	state->carriage_return = false;
+	state->macro_body = false;
+	state->expand_macro = false;
+	state->raw_mode = false;
+	state->error_handled = false;
+	state->guard.state = LEXER_GUARD_START;
+}
+
 int initLexer(struct LexerState* state, const char* file_path)
+{
+	struct InputFile file;
+	if (openInputFile(&file, file_path, fileName(file_path)) != 0) {
+		fprintf(stderr, "Could not open file\n");
+		return -1;
+	}
+	return initLexerWithInputFile(state, &file);
+}
+
+int initLexerWithInputFile(struct LexerState* state,
+                           const struct InputFile* file)
 {
 	struct Allocator* global_allocator = getGlobalAllocator();
 
 	memset(state, 0, sizeof(*state));
-	state->line_beginning = true;
 	state->scratchpad = (struct LinearAllocator*)getScratchpadAllocator();
+	state->current_file = *file;
+	initIncludeCache(&state->include_cache, global_allocator);
 
-	if (openInputFile(&state->current_file, file_path, fileName(file_path)) !=
-	    0) {
-		fprintf(stderr, "Could not open file\n");
-		return -1;
-	}
-	if (initStringSet(&state->identifiers, LEXER_IDENTIFIER_STRINGSET_SIZE,
-	                  LEXER_MAX_IDENTIFIER_COUNT, global_allocator) != 0) {
+	if (initIdentifierTable(&state->identifiers,
+	                        LEXER_IDENTIFIER_STRINGSET_SIZE,
+	                        LEXER_IDENTIFIER_COUNT, global_allocator) != 0) {
 		cleanupLexer(state);
 		return -1;
 	}
 	if (initStringSet(&state->string_literals, LEXER_LITERAL_STRINGSET_SIZE,
-	                  LEXER_MAX_STRING_LITERAL_COUNT, global_allocator) != 0) {
+	                  LEXER_STRING_LITERAL_COUNT, global_allocator) != 0) {
 		cleanupLexer(state);
 		return -1;
 	}
 	if (initStringSet(&state->pp_numbers, LEXER_PP_NUMBER_STRINGSET_SIZE,
-	                  LEXER_MAX_PP_NUMBER_COUNT, global_allocator) != 0) {
+	                  LEXER_PP_NUMBER_COUNT, global_allocator) != 0) {
 		cleanupLexer(state);
 		return -1;
 	}
@@ -562,27 +325,128 @@ int initLexer(struct LexerState* state, const char* file_path)
 		cleanupLexer(state);
 		return -1;
 	}
-	readInputAndHandleLineEndings(state);
-	consumeInput(state);
-	state->carriage_return = false;
-	state->macro_body = false;
-	state->expand_macro = false;
-	state->error_handled = false;
+	state->embeds.num = 0;
+	state->embeds.max_count = LEXER_MAX_EMBED_COUNT;
+	state->embeds.files = allocate(
+	    global_allocator, sizeof(*state->embeds.files) * LEXER_MAX_EMBED_COUNT);
+	if (state->embeds.files == NULL) {
+		cleanupLexer(state);
+		return -1;
+	}
+	state->includes.num = 0;
+	state->includes.max_count = LEXER_MAX_INCLUDE_DEPTH;
+	state->includes.files =
+	    allocate(global_allocator,
+	             sizeof(*state->includes.files) * LEXER_MAX_INCLUDE_DEPTH);
+	if (state->includes.files == NULL) {
+		cleanupLexer(state);
+		return -1;
+	}
+	if (initFileTable(&state->files, LEXER_FILE_COUNT, global_allocator) !=
+	    0) {
+		cleanupLexer(state);
+		return -1;
+	}
+	state->conditionals.num = 0;
+	state->conditionals.max_count = LEXER_MAX_CONDITIONAL_DEPTH;
+	state->conditionals.conditionals =
+	    allocate(global_allocator, sizeof(*state->conditionals.conditionals) *
+	                                   LEXER_MAX_CONDITIONAL_DEPTH);
+	if (state->conditionals.conditionals == NULL) {
+		cleanupLexer(state);
+		return -1;
+	}
+	state->file_index = -1;
+	startReading(state);
 
-	if (initPreprocessorState(&state->pp_state) != 0) {
+	if (initPreprocessorState(&state->pp_state, &state->identifiers,
+	                          &state->string_literals, &state->pp_numbers,
+	                          &state->constants) != 0) {
 		cleanupLexer(state);
 		return -1;
 	}
 	return 0;
 }
 
+static void unmapEmbeddedFiles(struct LexerEmbedSet* embeds)
+{
+	for (int i = 0; i < embeds->num; i++) {
+		unmapFile(&embeds->files[i]);
+	}
+	embeds->num = 0;
+}
+
+static void popIncludedFile(struct LexerState* state)
+{
+	struct LexerIncludedFile* included =
+	    &state->includes.files[--state->includes.num];
+	if (state->guard.state == LEXER_GUARD_CLOSED) {
+		getFileInfo(&state->files, state->file_index)->guard =
+		    state->guard.macro;
+	}
+	closeInputFile(&state->current_file);
+	deallocate(getGlobalAllocator(), included->path);
+	state->current_file = included->parent;
+	state->current_pos = included->current_pos;
+	state->lookahead_pos = included->lookahead_pos;
+	state->carriage_return = included->carriage_return;
+	state->c = included->c;
+	state->lookahead = included->lookahead;
+	state->guard = included->guard;
+	state->file_index = included->file_index;
+	// directives end with a new line
+	state->line_beginning = true;
+}
+
+static void closeIncludedFiles(struct LexerState* state)
+{
+	while (state->includes.num > 0) {
+		popIncludedFile(state);
+	}
+}
+
+int resetLexer(struct LexerState* state, const char* file_path,
+               bool keep_identifiers)
+{
+	closeIncludedFiles(state);
+	if (reopenInputFile(&state->current_file, file_path,
+	                    fileName(file_path)) != 0) {
+		fprintf(stderr, "Could not open file\n");
+		return -1;
+	}
+	if (!keep_identifiers) {
+		resetIdentifierTable(&state->identifiers);
+	}
+	resetStringSet(&state->string_literals);
+	resetStringSet(&state->pp_numbers);
+	state->constants.num = 0;
+	unmapEmbeddedFiles(&state->embeds);
+	resetPreprocessorState(&state->pp_state);
+	resetFileTable(&state->files);
+	state->file_index = -1;
+	state->conditionals.num = 0;
+	startReading(state);
+	return 0;
+}
+
 void cleanupLexer(struct LexerState* state)
 {
 	cleanupPreprocessorState(&state->pp_state);
-	cleanupStringSet(&state->identifiers);
+	cleanupIdentifierTable(&state->identifiers);
 	cleanupStringSet(&state->string_literals);
 	cleanupStringSet(&state->pp_numbers);
 	deallocate(getGlobalAllocator(), state->constants.constants);
+	if (state->embeds.files != NULL) {
+		unmapEmbeddedFiles(&state->embeds);
+		deallocate(getGlobalAllocator(), state->embeds.files);
+	}
+	if (state->includes.files != NULL) {
+		closeIncludedFiles(state);
+		deallocate(getGlobalAllocator(), state->includes.files);
+	}
+	cleanupFileTable(&state->files);
+	deallocate(getGlobalAllocator(), state->conditionals.conditionals);
+	cleanupIncludeCache(&state->include_cache);
 	closeInputFile(&state->current_file);
 }
 
@@ -941,21 +805,19 @@ static int readWord(struct LexerState* state, const struct FileContext* ctx,
 	return length;
 }
 
-static bool createKeywordOrIdentifierToken(struct LexerState* state,
+// Keyword tokens keep the identifier index of the keyword as well
+static void createKeywordOrIdentifierToken(struct LexerState* state,
                                            struct LexerToken* token,
                                            const struct FileContext* ctx,
-                                           const char* string, int length,
-                                           uint32_t hash)
+                                           int index)
 {
-	if (!matchKeyword(string, hash, ctx, token)) {
-		int index =
-		    addStringAndHash(&state->identifiers, string, length, hash, NULL);
-		if (index < 0) {
-			return false;
-		}
+	int keyword = getIdentifierInfo(&state->identifiers, index)->keyword;
+	if (keyword != IDENTIFIER) {
+		createSimpleToken(token, ctx, keyword);
+		token->value.string_index = index;
+	} else {
 		createIdentifierToken(token, ctx, index);
 	}
-	return true;
 }
 
 static bool lexWord(struct LexerState* state, struct LexerToken* token,
@@ -974,21 +836,35 @@ static bool lexWord(struct LexerState* state, struct LexerToken* token,
 		goto out;
 	}
 
-	uint32_t hash = hashString(read_buffer);
+	// a single lookup classifies the word
+	int index = internIdentifier(&state->identifiers, read_buffer, length,
+	                             hashSubstring(read_buffer, length));
+	if (index < 0) {
+		goto out;
+	}
 	struct PreprocessorDefinition* definition = NULL;
-	if (!state->macro_body && !state->expand_macro) {
-		definition =
-		    findDefinition(&state->pp_state, read_buffer, length, hash);
+	if (!state->macro_body && !state->expand_macro && !state->raw_mode) {
+		definition = getDefinition(&state->pp_state, index);
+	}
+	// a function like macro name without arguments is an identifier
+	if (definition != NULL && isFunctionLike(definition)) {
+		if (!skipWhiteSpaceOrComments(state)) {
+			goto out;
+		}
+		if (state->c != '(') {
+			definition = NULL;
+		}
 	}
 	if (definition != NULL) {
+		if (beginExpansion(&state->pp_state, definition) != 0) {
+			goto out;
+		}
 		state->expand_macro = true;
-		beginExpansion(&state->pp_state, definition);
 		createSimpleToken(token, ctx, TOKEN_EMPTY);
-		status = true;
 	} else {
-		status = createKeywordOrIdentifierToken(state, token, ctx, read_buffer,
-		                                        length, hash);
+		createKeywordOrIdentifierToken(state, token, ctx, index);
 	}
+	status = true;
 out:
 	resetLinearAllocatorState(state->scratchpad, &marker);
 	return status;
@@ -1267,8 +1143,8 @@ static bool parseNumber(struct StringIterator* it, struct LexerToken* token,
 				if (!parseOctalNumber(it, token, ctx)) {
 					return LEXER_RESULT_FAIL;
 				}
-			} else {
-				createIntegerConstantToken(token, ctx, 0, false);
+			} else if (!parseIntegerSuffix(it, token, ctx, 0)) {
+				return false;
 			}
 			break;
 		default:
@@ -1345,6 +1221,8 @@ bool lexTokens(struct LexerState* state, struct LexerToken* token,
                const struct FileContext* ctx)
 {
 	bool status = false;
+	// numbers in replacements and arguments keep their spelling for pasting
+	bool parse_number = !state->macro_body && !state->expand_macro;
 	switch (state->c) {
 		case '/':
 			NEXT(state, out);
@@ -1583,7 +1461,7 @@ bool lexTokens(struct LexerState* state, struct LexerToken* token,
 			break;
 		case '.':
 			if (isDecimalDigit(state->lookahead)) {
-				if (!lexPPNumber(state, token, ctx, !state->macro_body)) {
+				if (!lexPPNumber(state, token, ctx, parse_number)) {
 					goto out;
 				}
 			} else {
@@ -1599,7 +1477,7 @@ bool lexTokens(struct LexerState* state, struct LexerToken* token,
 				}
 			} else if (isDecimalDigit(state->c)) {
 				// number
-				if (!lexPPNumber(state, token, ctx, !state->macro_body)) {
+				if (!lexPPNumber(state, token, ctx, parse_number)) {
 					goto out;
 				}
 			} else {
@@ -1617,7 +1495,8 @@ out:
 
 static bool lexMacroBody(struct LexerState* state, struct FileContext* ctx,
                          const char* macro_name, int macro_name_length,
-                         bool function_like, struct StringSet* params)
+                         bool function_like, bool variadic,
+                         struct StringSet* params)
 {
 	bool status = false;
 	state->macro_body = true;
@@ -1653,11 +1532,20 @@ static bool lexMacroBody(struct LexerState* state, struct FileContext* ctx,
 			}
 			uint32_t hash = hashSubstring(read_buffer, length);
 			int index = findIndex(params, read_buffer, length, hash);
-			if (index >= 0) {
-				createPPParamRefToken(&token, &macro_context, index);
-			} else {
+			if (index < 0 && variadic &&
+			    strcmp(read_buffer, "__VA_OPT__") == 0) {
+				createSimpleToken(&token, &macro_context, PP_VA_OPT);
+			} else if (index < 0) {
+				index = internIdentifier(&state->identifiers, read_buffer,
+				                         length, hash);
+				if (index < 0) {
+					resetLinearAllocatorState(state->scratchpad, &marker);
+					goto out;
+				}
 				createKeywordOrIdentifierToken(state, &token, &macro_context,
-				                               read_buffer, length, hash);
+				                               index);
+			} else {
+				createPPParamRefToken(&token, &macro_context, index);
 			}
 			resetLinearAllocatorState(state->scratchpad, &marker);
 		} else {
@@ -1673,9 +1561,15 @@ static bool lexMacroBody(struct LexerState* state, struct FileContext* ctx,
 		num++;
 		skipWhiteSpaceOrComments(state);
 	}
-	createPreprocessorDefinition(&state->pp_state, start_index, num,
-	                             params->num, macro_name, macro_name_length,
-	                             function_like);
+	int name = internIdentifier(&state->identifiers, macro_name,
+	                            macro_name_length,
+	                            hashSubstring(macro_name, macro_name_length));
+	if (name < 0 ||
+	    createPreprocessorDefinition(&state->pp_state, start_index, num,
+	                                 params->num, name, function_like,
+	                                 variadic) < 0) {
+		goto out;
+	}
 	consumeInput(state);
 	status = true;
 out:
@@ -1683,6 +1577,20 @@ out:
 	return status;
 }
 
+static bool readEllipsis(struct LexerState* state)
+{
+	for (int i = 0; i < 3; i++) {
+		if (state->c != '.') {
+			lexerError(state, "'...' expected");
+			return false;
+		}
+		NEXT(state, out);
+	}
+	return true;
+out:
+	return false;
+}
+
 static bool handleDefineDirective(struct LexerState* state,
                                   struct FileContext* ctx, char* read_buffer)
 {
@@ -1703,6 +1611,7 @@ static bool handleDefineDirective(struct LexerState* state,
 
 	bool exists = false;
 	bool function_like = false;
+	bool variadic = false;
 	bool status = false;
 
 	struct StringSet params;
@@ -1720,49 +1629,43 @@ static bool handleDefineDirective(struct LexerState* state,
 		if (!skipWhiteSpaceOrComments(state)) {
 			goto out;
 		}
-		if (isAlphabetic(state->c)) {
-			int len = readWord(state, ctx, read_buffer);
-			if (len < 0) {
-				lexerError(state, "identifier is to long");
+		while (state->c != ')') {
+			if (params.num > 0) {
+				// nothing follows the variable arguments
+				if (variadic || state->c != ',') {
+					goto out;
+				}
+				NEXT(state, out);
+				if (!skipWhiteSpaceOrComments(state)) {
+					goto out;
+				}
+			}
+			int len;
+			if (state->c == '.') {
+				if (!readEllipsis(state)) {
+					goto out;
+				}
+				// the variable arguments are the last parameter
+				variadic = true;
+				strcpy(read_buffer, "__VA_ARGS__");
+				len = strlen(read_buffer);
+			} else if (isAlphabetic(state->c)) {
+				len = readWord(state, ctx, read_buffer);
+				if (len < 0) {
+					lexerError(state, "identifier is to long");
+					goto out;
+				}
+			} else {
 				goto out;
 			}
 			uint32_t hash = hashSubstring(read_buffer, len);
 			addStringAndHash(&params, read_buffer, len, hash, &exists);
-			if (exists == true) {
+			if (exists) {
 				goto out;
 			}
 			if (!skipWhiteSpaceOrComments(state)) {
 				goto out;
 			}
-			while (state->c != ')') {
-				if (state->c == ',') {
-					NEXT(state, out);
-					if (!skipWhiteSpaceOrComments(state)) {
-						goto out;
-					}
-					if (!isAlphabetic(state->c)) {
-						goto out;
-					}
-					int len = readWord(state, ctx, read_buffer);
-					if (len < 0) {
-						goto out;
-					}
-					uint32_t hash = hashSubstring(read_buffer, len);
-					addStringAndHash(&params, read_buffer, len, hash, &exists);
-					if (exists) {
-						goto out;
-					}
-					if (!skipWhiteSpaceOrComments(state)) {
-						goto out;
-					}
-				} else {
-					goto out;
-				}
-			}
-		} else {
-			if (state->c != ')') {
-				goto out;
-			}
 		}
 
 		NEXT(state, out);
@@ -1770,7 +1673,7 @@ static bool handleDefineDirective(struct LexerState* state,
 		goto out;
 	}
 	if (!lexMacroBody(state, ctx, macro_name, macro_name_length, function_like,
-	                  &params)) {
+	                  variadic, &params)) {
 		goto out;
 	}
 	status = true;
@@ -1781,7 +1684,7 @@ out:
 
 static bool skipLine(struct LexerState* state)
 {
-	while (state->c != '\n') {
+	while (state->c != '\n' && state->c != INPUT_EOF) {
 		// skip preprocessor lines
 		if (!consumeLexableChar(state)) {
 			return false;
@@ -1790,6 +1693,943 @@ static bool skipLine(struct LexerState* state)
 	return true;
 }
 
+enum EmbedParameter {
+	EMBED_PARAM_LIMIT,
+	EMBED_PARAM_PREFIX,
+	EMBED_PARAM_SUFFIX,
+	EMBED_PARAM_IF_EMPTY,
+	EMBED_PARAM_COUNT
+};
+
+static const char* const embed_parameter_names[EMBED_PARAM_COUNT] = {
+    "limit", "prefix", "suffix", "if_empty"};
+
+struct EmbedTokenRange {
+	int start;
+	int num;
+};
+
+static bool readHeaderName(struct LexerState* state, char* buffer)
+{
+	char terminator;
+	if (state->c == '"') {
+		terminator = '"';
+	} else if (state->c == '<') {
+		terminator = '>';
+	} else {
+		lexerError(state, "Header name expected");
+		return false;
+	}
+	if (!consumeLexableChar(state)) {
+		return false;
+	}
+	int length = 0;
+	while (state->c != terminator) {
+		if (state->c == '\n' || state->c == INPUT_EOF) {
+			lexerError(state, "Header name not terminated");
+			return false;
+		}
+		if (length == MAX_PATH_LENGTH - 1) {
+			lexerError(state, "Header name is to long");
+			return false;
+		}
+		buffer[length++] = state->c;
+		if (!consumeLexableChar(state)) {
+			return false;
+		}
+	}
+	buffer[length] = 0;
+	return consumeLexableChar(state);
+}
+
+// Resources are searched like included files. Names that are not found are
+// opened relative to the working directory.
+static int mapEmbeddedFile(struct LexerState* state, const char* name,
+                           bool quoted, size_t limit, char* path_buffer)
+{
+	struct LexerEmbedSet* embeds = &state->embeds;
+	if (embeds->num == embeds->max_count) {
+		lexerError(state, "Too many embedded files");
+		return -1;
+	}
+	struct MappedFile* file = &embeds->files[embeds->num];
+	struct FileId id;
+	if (findCachedIncludeFile(&state->include_cache, state->include_path, name,
+	                          quoted, state->current_file.full_path,
+	                          path_buffer, MAX_PATH_LENGTH, &id) == 0 &&
+	    mapFile(file, path_buffer, limit) == 0) {
+		return embeds->num++;
+	}
+	if (mapFile(file, name, limit) != 0) {
+		lexerError(state, "Could not open embedded file");
+		return -1;
+	}
+	return embeds->num++;
+}
+
+static int findEmbedParameter(const char* name, int length)
+{
+	// __name__ is an alternative spelling of every parameter
+	if (length > 4 && name[0] == '_' && name[1] == '_' &&
+	    name[length - 1] == '_' && name[length - 2] == '_') {
+		name += 2;
+		length -= 4;
+	}
+	for (int i = 0; i < EMBED_PARAM_COUNT; i++) {
+		if (strncmp(embed_parameter_names[i], name, length) == 0 &&
+		    embed_parameter_names[i][length] == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Lexes the balanced tokens between the parentheses of an embed parameter
+static bool lexEmbedParamTokens(struct LexerState* state,
+                                struct EmbedTokenRange* range)
+{
+	if (!consumeLexableChar(state) || !skipWhiteSpaceOrComments(state)) {
+		return false;
+	}
+	range->start = getPreprocessorTokenPos(&state->pp_state);
+	range->num = 0;
+	int bracket_count = 1;
+	while (true) {
+		if (state->c == INPUT_EOF) {
+			lexerError(state, "Embed parameter not closed");
+			return false;
+		}
+		struct LexerToken token;
+		struct FileContext param_context;
+		getFileContext(state, &param_context);
+		if (!lexTokens(state, &token, &param_context)) {
+			return false;
+		}
+		if (token.type == PUNCTUATOR_PARENTHESE_LEFT) {
+			bracket_count++;
+		} else if (token.type == PUNCTUATOR_PARENTHESE_RIGHT) {
+			bracket_count--;
+		}
+		if (bracket_count == 0) {
+			break;
+		}
+		if (addPreprocessorToken(&state->pp_state, &state->constants, &token) <
+		    0) {
+			return false;
+		}
+		range->num++;
+		if (!skipWhiteSpaceOrComments(state)) {
+			return false;
+		}
+	}
+	return skipWhiteSpaceOrComments(state);
+}
+
+static bool parseEmbedLimit(struct LexerState* state,
+                            const struct EmbedTokenRange* range, size_t* limit)
+{
+	struct LexerToken token;
+	if (range->num != 1 ||
+	    !createLexerTokenFromPPToken(
+	        state, &state->pp_state.tokens.tokens[range->start], &token) ||
+	    (token.type != CONSTANT_INT && token.type != CONSTANT_UNSIGNED_INT)) {
+		lexerError(state, "Embed limit must be an integer constant");
+		return false;
+	}
+	*limit = token.value.int_literal;
+	return true;
+}
+
+static bool appendEmbedTokens(struct PreprocessorState* pp_state,
+                              const struct EmbedTokenRange* range)
+{
+	struct PreprocessorTokenSet* tokens = &pp_state->tokens;
+	if (tokens->num + range->num > tokens->max_tokens) {
+		generalError("not enough memory to store token");
+		return false;
+	}
+	memcpy(&tokens->tokens[tokens->num], &tokens->tokens[range->start],
+	       sizeof(*tokens->tokens) * range->num);
+	tokens->num += range->num;
+	return true;
+}
+
+// The embedded file is mapped and represented by a single LITERAL_EMBED token
+// that is surrounded by the prefix and suffix tokens. The resulting tokens
+// are returned through the macro expansion.
+static bool handleEmbedDirective(struct LexerState* state,
+                                 struct FileContext* ctx, char* read_buffer)
+{
+	bool status = false;
+	struct PreprocessorState* pp_state = &state->pp_state;
+	int token_marker = getPreprocessorTokenPos(pp_state);
+	struct EmbedTokenRange params[EMBED_PARAM_COUNT] = {0};
+	bool has_param[EMBED_PARAM_COUNT] = {0};
+
+	char* name = ALLOCATE_STRING(state->scratchpad, MAX_PATH_LENGTH);
+	char* path_buffer = ALLOCATE_STRING(state->scratchpad, MAX_PATH_LENGTH);
+	if (name == NULL || path_buffer == NULL) {
+		generalError("Memory allocation failed");
+		return false;
+	}
+	state->macro_body = true;
+	if (!skipWhiteSpaceOrComments(state)) {
+		goto out;
+	}
+	bool quoted = state->c == '"';
+	if (!readHeaderName(state, name) || !skipWhiteSpaceOrComments(state)) {
+		goto out;
+	}
+	while (state->c != INPUT_EOF) {
+		if (!isAlphabetic(state->c)) {
+			lexerError(state, "Embed parameter expected");
+			goto out;
+		}
+		int length = readWord(state, ctx, read_buffer);
+		if (length < 0) {
+			lexerError(state, "Identifier is to long");
+			goto out;
+		}
+		int param = findEmbedParameter(read_buffer, length);
+		if (param < 0) {
+			lexerError(state, "Unknown embed parameter");
+			goto out;
+		}
+		if (has_param[param]) {
+			lexerError(state, "Duplicate embed parameter");
+			goto out;
+		}
+		has_param[param] = true;
+		if (!skipWhiteSpaceOrComments(state)) {
+			goto out;
+		}
+		if (state->c != '(') {
+			lexerError(state, "Embed parameter must be followed by '('");
+			goto out;
+		}
+		if (!lexEmbedParamTokens(state, &params[param])) {
+			goto out;
+		}
+	}
+
+	size_t limit = SIZE_MAX;
+	if (has_param[EMBED_PARAM_LIMIT] &&
+	    !parseEmbedLimit(state, &params[EMBED_PARAM_LIMIT], &limit)) {
+		goto out;
+	}
+	int embed_index = mapEmbeddedFile(state, name, quoted, limit, path_buffer);
+	if (embed_index < 0) {
+		goto out;
+	}
+
+	// build the replacement behind the parameter tokens and move it to the
+	// start of the temporary tokens afterwards
+	int replacement_start = getPreprocessorTokenPos(pp_state);
+	if (state->embeds.files[embed_index].size > 0) {
+		struct LexerToken token;
+		createSimpleToken(&token, ctx, LITERAL_EMBED);
+		token.literal = true;
+		token.value.embed_index = embed_index;
+		if (!appendEmbedTokens(pp_state, &params[EMBED_PARAM_PREFIX]) ||
+		    addPreprocessorToken(pp_state, &state->constants, &token) < 0 ||
+		    !appendEmbedTokens(pp_state, &params[EMBED_PARAM_SUFFIX])) {
+			goto out;
+		}
+	} else if (!appendEmbedTokens(pp_state, &params[EMBED_PARAM_IF_EMPTY])) {
+		goto out;
+	}
+	int num_tokens = getPreprocessorTokenPos(pp_state) - replacement_start;
+	struct PreprocessorToken* tokens = pp_state->tokens.tokens;
+	memmove(&tokens[token_marker], &tokens[replacement_start],
+	        sizeof(*tokens) * num_tokens);
+	pp_state->tokens.num = token_marker + num_tokens;
+	if (num_tokens > 0) {
+		beginTokenExpansion(pp_state, token_marker, num_tokens);
+		state->expand_macro = true;
+	}
+	// skip the end of the line
+	consumeInput(state);
+	status = true;
+out:
+	if (!status) {
+		pp_state->tokens.num = token_marker;
+	}
+	state->macro_body = false;
+	return status;
+}
+
+// Include guards are detected while a file is lexed. A file is guarded if
+// nothing but white space and comments is outside of its first #ifndef.
+static void breakIncludeGuard(struct LexerState* state)
+{
+	if (state->guard.state != LEXER_GUARD_OPEN) {
+		state->guard.state = LEXER_GUARD_NONE;
+	}
+}
+
+// The macro is the one tested by #ifndef, -1 for other conditionals
+static void beginGuardConditional(struct LexerState* state, int macro)
+{
+	struct LexerIncludeGuard* guard = &state->guard;
+	if (guard->state == LEXER_GUARD_OPEN) {
+		guard->depth++;
+	} else if (guard->state == LEXER_GUARD_START && macro >= 0) {
+		guard->state = LEXER_GUARD_OPEN;
+		guard->depth = 1;
+		guard->macro = macro;
+	} else {
+		guard->state = LEXER_GUARD_NONE;
+	}
+}
+
+static void elseGuardConditional(struct LexerState* state)
+{
+	struct LexerIncludeGuard* guard = &state->guard;
+	if (guard->state != LEXER_GUARD_OPEN || guard->depth == 1) {
+		guard->state = LEXER_GUARD_NONE;
+	}
+}
+
+static void endGuardConditional(struct LexerState* state)
+{
+	struct LexerIncludeGuard* guard = &state->guard;
+	if (guard->state != LEXER_GUARD_OPEN) {
+		guard->state = LEXER_GUARD_NONE;
+	} else if (--guard->depth == 0) {
+		guard->state = LEXER_GUARD_CLOSED;
+	}
+}
+
+// Returns the identifier index of the macro name behind #ifndef, -1 if the
+// directive does not look like an include guard
+static int readGuardMacro(struct LexerState* state, struct FileContext* ctx,
+                          char* read_buffer)
+{
+	while (state->c == ' ' || state->c == '\t') {
+		consumeInput(state);
+	}
+	if (!isAlphabetic(state->c)) {
+		return -1;
+	}
+	int length = readWord(state, ctx, read_buffer);
+	if (length < 0) {
+		return -1;
+	}
+	return internIdentifier(&state->identifiers, read_buffer, length,
+	                        hashSubstring(read_buffer, length));
+}
+
+// Conditional directives that can end a skipped group
+enum ConditionalDirective {
+	CONDITIONAL_NONE,
+	CONDITIONAL_IF,
+	CONDITIONAL_ELIF,
+	CONDITIONAL_ELSE,
+	CONDITIONAL_ENDIF,
+};
+
+static int classifyConditionalDirective(const char* name)
+{
+	if (strcmp("if", name) == 0 || strcmp("ifdef", name) == 0 ||
+	    strcmp("ifndef", name) == 0) {
+		return CONDITIONAL_IF;
+	} else if (strcmp("elif", name) == 0 || strcmp("elifdef", name) == 0 ||
+	           strcmp("elifndef", name) == 0) {
+		return CONDITIONAL_ELIF;
+	} else if (strcmp("else", name) == 0) {
+		return CONDITIONAL_ELSE;
+	} else if (strcmp("endif", name) == 0) {
+		return CONDITIONAL_ENDIF;
+	}
+	return CONDITIONAL_NONE;
+}
+
+// Characters that have a meaning in a skipped group: line endings, line
+// continuations, comments and literals
+static inline bool isSkippedGroupStop(char c)
+{
+	return c == '\n' || c == '\r' || c == '\\' || c == '/' || c == '*' ||
+	       c == '"' || c == '\'';
+}
+
+// Returns the number of bytes before the first one that has a meaning in a
+// skipped group
+static size_t countPlainBytes(const char* data, size_t size)
+{
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i carriage_return = _mm_set1_epi8('\r');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i asterisk = _mm_set1_epi8('*');
+	const __m128i double_quote = _mm_set1_epi8('"');
+	const __m128i quote = _mm_set1_epi8('\'');
+	for (; i + 16 <= size; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i stop = _mm_or_si128(
+		    _mm_or_si128(_mm_cmpeq_epi8(bytes, newline),
+		                 _mm_cmpeq_epi8(bytes, carriage_return)),
+		    _mm_or_si128(_mm_cmpeq_epi8(bytes, backslash),
+		                 _mm_cmpeq_epi8(bytes, slash)));
+		stop = _mm_or_si128(
+		    stop, _mm_or_si128(_mm_cmpeq_epi8(bytes, asterisk),
+		                       _mm_or_si128(_mm_cmpeq_epi8(bytes, double_quote),
+		                                    _mm_cmpeq_epi8(bytes, quote))));
+		int mask = _mm_movemask_epi8(stop);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	while (i < size && !isSkippedGroupStop(data[i])) {
+		i++;
+	}
+	return i;
+}
+
+// Jumps over the bytes of a skipped group that can not end the current line
+// without passing them through the regular input handling
+static void skipPlainInput(struct LexerState* state)
+{
+	if (isSkippedGroupStop(state->c) || state->c == INPUT_EOF ||
+	    isSkippedGroupStop(state->lookahead) ||
+	    state->lookahead == INPUT_EOF || state->carriage_return) {
+		return;
+	}
+	size_t size;
+	const char* data = getBufferedInput(&state->current_file, &size);
+	size_t num = countPlainBytes(data, size);
+	if (num == 0) {
+		return;
+	}
+	// the current character and the lookahead are skipped as well
+	struct LexerSourcePos pos = state->current_pos;
+	pos.column += num + 2;
+	pos.file_pos += num + 2;
+	seekLexer(state, &pos, state->line_beginning);
+}
+
+enum SkippedTextState {
+	SKIPPED_TEXT,
+	SKIPPED_LINE_COMMENT,
+	SKIPPED_BLOCK_COMMENT,
+	SKIPPED_LITERAL,
+};
+
+// Moves to the beginning of the next line of a skipped group. Comments and
+// literals are tracked so that their contents can not end the group, but no
+// tokens are built. Unterminated literals end at the end of the line.
+static void skipGroupLine(struct LexerState* state)
+{
+	int text_state = SKIPPED_TEXT;
+	char quote = 0;
+	while (true) {
+		skipPlainInput(state);
+		char c = state->c;
+		if (c == INPUT_EOF) {
+			return;
+		}
+		consumeInput(state);
+		if (c == '\n') {
+			if (text_state != SKIPPED_BLOCK_COMMENT) {
+				state->line_beginning = true;
+				return;
+			}
+		} else if (c == '\\') {
+			// escaped characters only exist in literals, elsewhere only line
+			// continuations are skipped
+			if (state->c != INPUT_EOF &&
+			    (text_state == SKIPPED_LITERAL || state->c == '\n')) {
+				consumeInput(state);
+			}
+		} else if (text_state == SKIPPED_TEXT) {
+			if (c == '/' && state->c == '/') {
+				text_state = SKIPPED_LINE_COMMENT;
+			} else if (c == '/' && state->c == '*') {
+				text_state = SKIPPED_BLOCK_COMMENT;
+				consumeInput(state);
+			} else if (c == '"' || c == '\'') {
+				text_state = SKIPPED_LITERAL;
+				quote = c;
+			}
+		} else if (text_state == SKIPPED_BLOCK_COMMENT) {
+			if (c == '*' && state->c == '/') {
+				text_state = SKIPPED_TEXT;
+				consumeInput(state);
+			}
+		} else if (text_state == SKIPPED_LITERAL && c == quote) {
+			text_state = SKIPPED_TEXT;
+		}
+	}
+}
+
+// Skips the lines of a group up to the #elif, #else or #endif that ends it.
+// Nested conditionals are only counted. The name of the directive is left in
+// the read buffer, the input is positioned behind it.
+static bool skipConditionalGroup(struct LexerState* state,
+                                 char* read_buffer, int* directive)
+{
+	int depth = 0;
+	while (true) {
+		while (state->c == ' ' || state->c == '\t') {
+			consumeInput(state);
+		}
+		if (state->c == INPUT_EOF) {
+			lexerError(state, "Unterminated conditional directive");
+			return false;
+		}
+		if (state->c == '#') {
+			struct FileContext ctx;
+			getFileContext(state, &ctx);
+			consumeInput(state);
+			while (state->c == ' ' || state->c == '\t') {
+				consumeInput(state);
+			}
+			int type = CONDITIONAL_NONE;
+			if (isAlphabetic(state->c) &&
+			    readWord(state, &ctx, read_buffer) > 0) {
+				type = classifyConditionalDirective(read_buffer);
+			}
+			if (type == CONDITIONAL_IF) {
+				depth++;
+			} else if (type == CONDITIONAL_ENDIF && depth > 0) {
+				depth--;
+			} else if (type != CONDITIONAL_NONE && depth == 0) {
+				state->line_beginning = false;
+				*directive = type;
+				return true;
+			}
+		}
+		skipGroupLine(state);
+	}
+}
+
+static int getConditionalBase(const struct LexerState* state)
+{
+	const struct LexerIncludeStack* includes = &state->includes;
+	if (includes->num == 0) {
+		return 0;
+	}
+	return includes->files[includes->num - 1].num_conditionals;
+}
+
+// Returns the innermost conditional of the current file or NULL
+static struct LexerConditional* getOpenConditional(struct LexerState* state)
+{
+	struct LexerConditionalStack* conditionals = &state->conditionals;
+	if (conditionals->num == getConditionalBase(state)) {
+		return NULL;
+	}
+	return &conditionals->conditionals[conditionals->num - 1];
+}
+
+// Ends the line of a conditional directive and moves to the next one
+static bool endConditionalLine(struct LexerState* state)
+{
+	if (!skipLine(state)) {
+		return false;
+	}
+	if (state->c == '\n') {
+		consumeInput(state);
+		state->line_beginning = true;
+	}
+	return true;
+}
+
+// Reads the macro name behind #ifdef, #ifndef, #elifdef or #elifndef
+static bool isMacroNameDefined(struct LexerState* state,
+                               struct FileContext* ctx, char* read_buffer,
+                               bool* defined)
+{
+	if (!skipWhiteSpaceOrComments(state)) {
+		return false;
+	}
+	if (!isAlphabetic(state->c)) {
+		lexerError(state, "Macro name expected");
+		return false;
+	}
+	int length = readWord(state, ctx, read_buffer);
+	if (length < 0) {
+		lexerError(state, "Identifier is to long");
+		return false;
+	}
+	int index = internIdentifier(&state->identifiers, read_buffer, length,
+	                             hashSubstring(read_buffer, length));
+	if (index < 0) {
+		generalError("Memory allocation failed");
+		return false;
+	}
+	*defined = getDefinition(&state->pp_state, index) != NULL;
+	return true;
+}
+
+// The operand of defined must not be expanded, so the operator is replaced
+// by its result while the line is lexed
+static bool lexDefinedOperator(struct LexerState* state,
+                               struct FileContext* ctx,
+                               struct LexerToken* token)
+{
+	if (!skipWhiteSpaceOrComments(state)) {
+		return false;
+	}
+	bool parenthesized = state->c == '(';
+	if (parenthesized && !consumeLexableChar(state)) {
+		return false;
+	}
+	char* read_buffer =
+	    ALLOCATE_STRING(state->scratchpad, MAX_IDENTIFIER_LENGTH);
+	if (read_buffer == NULL) {
+		generalError("Memory allocation failed");
+		return false;
+	}
+	bool defined;
+	if (!isMacroNameDefined(state, ctx, read_buffer, &defined)) {
+		return false;
+	}
+	if (parenthesized) {
+		if (!skipWhiteSpaceOrComments(state)) {
+			return false;
+		}
+		if (state->c != ')') {
+			lexerError(state, "Missing ')' after defined");
+			return false;
+		}
+		if (!consumeLexableChar(state)) {
+			return false;
+		}
+	}
+	createIntegerConstantToken(token, ctx, defined, false);
+	return true;
+}
+
+// Lexes the condition of #if or #elif into temporary preprocessor tokens and
+// evaluates it while the macros in it are expanded
+static bool evaluateIfCondition(struct LexerState* state, bool* value)
+{
+	bool status = false;
+	struct PreprocessorState* pp_state = &state->pp_state;
+	int token_start = getPreprocessorTokenPos(pp_state);
+	int num_constants = state->constants.num;
+	state->macro_body = true;
+	if (!skipWhiteSpaceOrComments(state)) {
+		goto out;
+	}
+	while (state->c != INPUT_EOF) {
+		struct LexerToken token;
+		struct FileContext token_context;
+		getFileContext(state, &token_context);
+		if (!lexTokens(state, &token, &token_context)) {
+			goto out;
+		}
+		if (token.type == IDENTIFIER &&
+		    strcmp("defined", getIdentifierName(&state->identifiers,
+		                                        token.value.string_index)) ==
+		        0 &&
+		    !lexDefinedOperator(state, &token_context, &token)) {
+			goto out;
+		}
+		if (addPreprocessorToken(pp_state, &state->constants, &token) < 0 ||
+		    !skipWhiteSpaceOrComments(state)) {
+			goto out;
+		}
+	}
+	int num_tokens = getPreprocessorTokenPos(pp_state) - token_start;
+	if (num_tokens == 0) {
+		lexerError(state, "Expression expected in #if");
+		goto out;
+	}
+	beginTokenExpansion(pp_state, token_start, num_tokens);
+	bool evaluated = evaluateIfExpression(state, value);
+	stopExpansion(pp_state);
+	if (!evaluated) {
+		goto out;
+	}
+	// skip the end of the line
+	consumeInput(state);
+	status = true;
+out:
+	pp_state->tokens.num = token_start;
+	state->constants.num = num_constants;
+	state->macro_body = false;
+	return status;
+}
+
+// Evaluates the condition of #if, #ifdef, #ifndef or one of the #elif
+// variants and moves to the next line
+static bool evaluateCondition(struct LexerState* state,
+                              struct FileContext* ctx, char* read_buffer,
+                              bool* value)
+{
+	if (strcmp("if", read_buffer) == 0 || strcmp("elif", read_buffer) == 0) {
+		return evaluateIfCondition(state, value);
+	}
+	bool negate = strcmp("ifndef", read_buffer) == 0 ||
+	              strcmp("elifndef", read_buffer) == 0;
+	if (!isMacroNameDefined(state, ctx, read_buffer, value)) {
+		return false;
+	}
+	*value = *value != negate;
+	return endConditionalLine(state);
+}
+
+// Skips groups until one of them is taken or the #endif is reached
+static bool skipConditionalGroups(struct LexerState* state,
+                                  struct FileContext* ctx, char* read_buffer)
+{
+	while (true) {
+		int directive;
+		if (!skipConditionalGroup(state, read_buffer, &directive)) {
+			return false;
+		}
+		struct LexerConditional* conditional = getOpenConditional(state);
+		if (directive == CONDITIONAL_ENDIF) {
+			endGuardConditional(state);
+			state->conditionals.num--;
+			return endConditionalLine(state);
+		}
+		if (conditional->has_else) {
+			lexerError(state, "Conditional group after #else");
+			return false;
+		}
+		elseGuardConditional(state);
+		bool taken = false;
+		if (directive == CONDITIONAL_ELSE) {
+			conditional->has_else = true;
+			taken = conditional->state == LEXER_CONDITIONAL_PENDING;
+			if (!endConditionalLine(state)) {
+				return false;
+			}
+		} else if (conditional->state == LEXER_CONDITIONAL_PENDING) {
+			if (!evaluateCondition(state, ctx, read_buffer, &taken)) {
+				return false;
+			}
+		} else if (!endConditionalLine(state)) {
+			return false;
+		}
+		if (taken) {
+			conditional->state = LEXER_CONDITIONAL_ACTIVE;
+			return true;
+		}
+	}
+}
+
+static bool handleConditionalDirective(struct LexerState* state,
+                                       struct FileContext* ctx,
+                                       char* read_buffer, int directive)
+{
+	struct LexerConditionalStack* conditionals = &state->conditionals;
+	if (directive == CONDITIONAL_IF) {
+		int macro = -1;
+		if (strcmp("ifndef", read_buffer) == 0 &&
+		    state->guard.state == LEXER_GUARD_START) {
+			macro = readGuardMacro(state, ctx, read_buffer);
+			if (macro < 0) {
+				lexerError(state, "Macro name expected");
+				return false;
+			}
+			beginGuardConditional(state, macro);
+		} else {
+			beginGuardConditional(state, -1);
+		}
+		if (conditionals->num == conditionals->max_count) {
+			lexerError(state, "Conditional directives nested too deeply");
+			return false;
+		}
+		struct LexerConditional* conditional =
+		    &conditionals->conditionals[conditionals->num++];
+		conditional->has_else = false;
+		bool taken;
+		if (macro >= 0) {
+			taken = getDefinition(&state->pp_state, macro) == NULL;
+			if (!endConditionalLine(state)) {
+				return false;
+			}
+		} else if (!evaluateCondition(state, ctx, read_buffer, &taken)) {
+			return false;
+		}
+		if (taken) {
+			conditional->state = LEXER_CONDITIONAL_ACTIVE;
+			return true;
+		}
+		conditional->state = LEXER_CONDITIONAL_PENDING;
+		return skipConditionalGroups(state, ctx, read_buffer);
+	}
+
+	struct LexerConditional* conditional = getOpenConditional(state);
+	if (conditional == NULL) {
+		lexerError(state, "Conditional directive without #if");
+		return false;
+	}
+	if (directive == CONDITIONAL_ENDIF) {
+		endGuardConditional(state);
+		conditionals->num--;
+		return endConditionalLine(state);
+	}
+	if (conditional->has_else) {
+		lexerError(state, "Conditional group after #else");
+		return false;
+	}
+	// the group before was lexed, so all remaining ones are skipped
+	elseGuardConditional(state);
+	conditional->has_else = directive == CONDITIONAL_ELSE;
+	conditional->state = LEXER_CONDITIONAL_DONE;
+	if (!endConditionalLine(state)) {
+		return false;
+	}
+	return skipConditionalGroups(state, ctx, read_buffer);
+}
+
+static bool pushIncludedFile(struct LexerState* state, const char* path,
+                             int file_index)
+{
+	struct LexerIncludeStack* includes = &state->includes;
+	if (includes->num == includes->max_count) {
+		lexerError(state, "#include nested too deeply");
+		return false;
+	}
+	size_t length = strlen(path);
+	char* owned_path = allocate(getGlobalAllocator(), length + 1);
+	if (owned_path == NULL) {
+		generalError("Memory allocation failed");
+		return false;
+	}
+	memcpy(owned_path, path, length + 1);
+	struct InputFile file;
+	if (openInputFile(&file, owned_path, fileName(owned_path)) != 0) {
+		deallocate(getGlobalAllocator(), owned_path);
+		lexerError(state, "Could not open included file");
+		return false;
+	}
+	struct LexerIncludedFile* included = &includes->files[includes->num++];
+	included->parent = state->current_file;
+	included->current_pos = state->current_pos;
+	included->lookahead_pos = state->lookahead_pos;
+	included->carriage_return = state->carriage_return;
+	included->c = state->c;
+	included->lookahead = state->lookahead;
+	included->guard = state->guard;
+	included->file_index = state->file_index;
+	included->num_conditionals = state->conditionals.num;
+	included->path = owned_path;
+
+	state->current_file = file;
+	state->file_index = file_index;
+	startReading(state);
+	return true;
+}
+
+// The included file is lexed right away, the including file is resumed at
+// the next line once the included one ends.
+static bool handleIncludeDirective(struct LexerState* state)
+{
+	bool status = false;
+	char* name = ALLOCATE_STRING(state->scratchpad, MAX_PATH_LENGTH);
+	char* path_buffer = ALLOCATE_STRING(state->scratchpad, MAX_PATH_LENGTH);
+	if (name == NULL || path_buffer == NULL) {
+		generalError("Memory allocation failed");
+		return false;
+	}
+	state->macro_body = true;
+	if (!skipWhiteSpaceOrComments(state)) {
+		goto out;
+	}
+	bool quoted = state->c == '"';
+	if (!readHeaderName(state, name)) {
+		goto out;
+	}
+	struct FileId id;
+	if (findCachedIncludeFile(&state->include_cache, state->include_path, name,
+	                          quoted, state->current_file.full_path,
+	                          path_buffer, MAX_PATH_LENGTH, &id) != 0) {
+		lexerError(state, "Included file not found");
+		goto out;
+	}
+	int file_index = internFile(&state->files, &id);
+	if (file_index < 0) {
+		generalError("Memory allocation failed");
+		goto out;
+	}
+	if (!skipWhiteSpaceOrComments(state)) {
+		goto out;
+	}
+	if (state->c != INPUT_EOF) {
+		lexerError(state, "Unexpected tokens after header name");
+		goto out;
+	}
+	state->macro_body = false;
+	// skip the end of the line
+	consumeInput(state);
+	struct FileInfo* info = getFileInfo(&state->files, file_index);
+	if (!info->checked) {
+		// the first time a file is seen it may still be a copy of one with
+		// #pragma once
+		info->checked = true;
+		if (isCopyOfOnceFile(&state->files, path_buffer)) {
+			info->once = true;
+		}
+	}
+	if (info->once || (info->guard != FILE_TABLE_NO_GUARD &&
+	                   getDefinition(&state->pp_state, info->guard) != NULL)) {
+		// the file would not produce any tokens
+		status = true;
+		goto out;
+	}
+	status = pushIncludedFile(state, path_buffer, file_index);
+out:
+	state->macro_body = false;
+	return status;
+}
+
+static bool handleUndefDirective(struct LexerState* state,
+                                 struct FileContext* ctx, char* read_buffer)
+{
+	if (!skipWhiteSpaceOrComments(state)) {
+		return false;
+	}
+	if (!isAlphabetic(state->c)) {
+		lexerError(state, "Macro name expected");
+		return false;
+	}
+	int length = readWord(state, ctx, read_buffer);
+	if (length < 0) {
+		lexerError(state, "Identifier is to long");
+		return false;
+	}
+	int index = internIdentifier(&state->identifiers, read_buffer, length,
+	                             hashSubstring(read_buffer, length));
+	if (index < 0) {
+		generalError("Memory allocation failed");
+		return false;
+	}
+	undefineMacro(&state->pp_state, index);
+	return skipLine(state);
+}
+
+// Only #pragma once has a meaning, other pragmas are ignored
+static bool handlePragmaDirective(struct LexerState* state,
+                                  struct FileContext* ctx, char* read_buffer)
+{
+	while (state->c == ' ' || state->c == '\t') {
+		consumeInput(state);
+	}
+	if (isAlphabetic(state->c)) {
+		int length = readWord(state, ctx, read_buffer);
+		if (length < 0) {
+			lexerError(state, "Identifier is to long");
+			return false;
+		}
+		// the main file can not be included again
+		if (strcmp("once", read_buffer) == 0 && state->file_index >= 0 &&
+		    markFileOnce(&state->files, state->file_index,
+		                 state->current_file.full_path) != 0) {
+			generalError("Could not remember #pragma once");
+			return false;
+		}
+	}
+	return skipLine(state);
+}
+
 static bool handlePreprocessorDirective(struct LexerState* state,
                                         struct FileContext* ctx)
 
@@ -1816,45 +2656,40 @@ static bool handlePreprocessorDirective(struct LexerState* state,
 		lexerError(state, "Identifier is to long");
 		goto out;
 	}
+	int conditional = classifyConditionalDirective(read_buffer);
 	if (strcmp("include", read_buffer) == 0) {
-		if (!skipLine(state)) {
+		breakIncludeGuard(state);
+		if (!handleIncludeDirective(state)) {
 			goto out;
 		}
 	} else if (strcmp("define", read_buffer) == 0) {
+		breakIncludeGuard(state);
 		if (!handleDefineDirective(state, ctx, read_buffer)) {
 			goto out;
 		}
-	} else if (strcmp("undef", read_buffer) == 0) {
-		if (!skipLine(state)) {
-			goto out;
-		}
-	} else if (strcmp("if", read_buffer) == 0) {
-		if (!skipLine(state)) {
-			goto out;
-		}
-	} else if (strcmp("ifdef", read_buffer) == 0) {
-		if (!skipLine(state)) {
-			goto out;
-		}
-	} else if (strcmp("ifndef", read_buffer) == 0) {
-		if (!skipLine(state)) {
+	} else if (strcmp("embed", read_buffer) == 0) {
+		breakIncludeGuard(state);
+		if (!handleEmbedDirective(state, ctx, read_buffer)) {
 			goto out;
 		}
-
-	} else if (strcmp("elsif", read_buffer) == 0) {
-		if (!skipLine(state)) {
+	} else if (strcmp("undef", read_buffer) == 0) {
+		breakIncludeGuard(state);
+		if (!handleUndefDirective(state, ctx, read_buffer)) {
 			goto out;
 		}
-	} else if (strcmp("else", read_buffer) == 0) {
-		if (!skipLine(state)) {
+	} else if (conditional != CONDITIONAL_NONE) {
+		if (!handleConditionalDirective(state, ctx, read_buffer,
+		                                conditional)) {
 			goto out;
 		}
-	} else if (strcmp("endif", read_buffer) == 0) {
+	} else if (strcmp("error", read_buffer) == 0) {
+		breakIncludeGuard(state);
 		if (!skipLine(state)) {
 			goto out;
 		}
-	} else if (strcmp("error", read_buffer) == 0) {
-		if (!skipLine(state)) {
+	} else if (strcmp("pragma", read_buffer) == 0) {
+		breakIncludeGuard(state);
+		if (!handlePragmaDirective(state, ctx, read_buffer)) {
 			goto out;
 		}
 	} else {
@@ -1867,10 +2702,12 @@ out:
 	return status;
 }
 
+// Lexes the tokens up to the ')' which closes the given number of open
+// parentheses, or up to the matching ')' of the next '(' if none are open
 static bool lexMacroParamTokens(struct LexerState* state,
-                                struct PreprocessorTokenSet* token_set)
+                                struct PreprocessorTokenSet* token_set,
+                                int bracket_count)
 {
-	int bracket_count = 1;
 	struct LexerToken token;
 	skipWhiteSpaceOrComments(state);
 	do {
@@ -1891,6 +2728,10 @@ static bool lexMacroParamTokens(struct LexerState* state,
 		}
 		skipWhiteSpaceOrComments(state);
 	} while (bracket_count != 0 && token.type != TOKEN_EOF);
+	if (bracket_count != 0) {
+		lexerError(state, "macro parantheses not closed");
+		return false;
+	}
 
 out:
 	return true;
@@ -1916,21 +2757,17 @@ static bool beginFunctionLikeMacroExpansion(struct LexerState* state)
 	struct ExpansionContext* current_context =
 	    &expansion_state->expansion_stack[expansion_depth];
 	int param_count = current_context->param.num_params;
-	const struct TokenIterator* param_iterators =
-	    current_context->param.iterators;
 	if (param_count > 0) {
-		struct TokenIterator* param_iterators = ALLOCATE_TYPE(
-		    &pp_state->allocator, param_count, typeof(*param_iterators));
+		struct TokenIterator* param_iterators = allocateMacroArguments(
+		    pp_state, &current_context->param, param_count);
 		if (param_iterators == NULL) {
-			generalError("token iterator allocation failed");
 			goto out;
 		}
-		current_context->param.iterators = param_iterators;
 		current_context->param.parent = NULL;
 
 		int token_marker = expansion_state->token_marker;
 
-		if (!lexMacroParamTokens(state, &pp_state->tokens)) {
+		if (!lexMacroParamTokens(state, &pp_state->tokens, 1)) {
 			stopExpansion(pp_state);
 			state->expand_macro = false;
 			goto out;
@@ -1938,7 +2775,8 @@ static bool beginFunctionLikeMacroExpansion(struct LexerState* state)
 		struct TokenIterator it = {token_marker, token_marker,
 		                           pp_state->tokens.num};
 		if (!prepareMacroParamTokens(&state->pp_state, param_iterators, &it,
-		                             param_count)) {
+		                             param_count,
+		                             expansion_state->variadic)) {
 			stopExpansion(pp_state);
 			state->expand_macro = false;
 			goto out;
@@ -1951,12 +2789,40 @@ static bool beginFunctionLikeMacroExpansion(struct LexerState* state)
 			state->expand_macro = false;
 			goto out;
 		}
+		NEXT(state, out);
+	}
+	if (!applyMacroOperators(pp_state)) {
+		stopExpansion(pp_state);
+		state->expand_macro = false;
+		goto out;
 	}
 	status = true;
 out:
 	return status;
 }
 
+// Reads the rest of an invocation which began in a macro expansion. Without
+// arguments the name of the macro is an ordinary identifier.
+static bool readInvocationFromInput(struct LexerState* state,
+                                    const struct PreprocessorToken* name,
+                                    struct LexerToken* token,
+                                    struct FileContext* ctx)
+{
+	struct PreprocessorState* pp_state = &state->pp_state;
+	int open_parentheses = pp_state->expansion_state.open_parentheses;
+	if (open_parentheses == 0 && state->c != '(') {
+		stopExpansion(pp_state);
+		state->expand_macro = false;
+		return createLexerTokenFromPPToken(state, name, token);
+	}
+	if (!lexMacroParamTokens(state, &pp_state->tokens, open_parentheses)) {
+		return false;
+	}
+	continueExpansion(pp_state);
+	createSimpleToken(token, ctx, TOKEN_EMPTY);
+	return true;
+}
+
 static bool getNextTokenFromMacro(struct LexerState* state,
                                   struct LexerToken* token,
                                   struct FileContext* ctx)
@@ -1975,13 +2841,19 @@ static bool getNextTokenFromMacro(struct LexerState* state,
 	}
 
 	struct PreprocessorToken pp_token;
-	if (!getExpandedToken(&state->pp_state, &state->identifiers, &pp_token)) {
+	if (!getExpandedToken(&state->pp_state, &pp_token)) {
 		stopExpansion(&state->pp_state);
 		state->expand_macro = false;
 		goto out;
 	}
 
-	if (pp_token.type == TOKEN_EOF) {
+	if (expansion_state->read_arguments) {
+		if (!readInvocationFromInput(state, &pp_token, token, ctx)) {
+			stopExpansion(&state->pp_state);
+			state->expand_macro = false;
+			goto out;
+		}
+	} else if (pp_token.type == TOKEN_EOF) {
 		createSimpleToken(token, ctx, TOKEN_EMPTY);
 		stopExpansion(&state->pp_state);
 		state->expand_macro = false;
@@ -2010,7 +2882,14 @@ bool getNextToken(struct LexerState* state, struct LexerToken* token)
 				goto out;
 			}
 		} else {
-			if (state->c == INPUT_EOF) {
+			if (state->c == INPUT_EOF &&
+			    state->conditionals.num > getConditionalBase(state)) {
+				lexerError(state, "Unterminated conditional directive");
+				goto out;
+			} else if (state->c == INPUT_EOF && state->includes.num > 0) {
+				popIncludedFile(state);
+				createSimpleToken(token, &ctx, TOKEN_EMPTY);
+			} else if (state->c == INPUT_EOF) {
 				createSimpleToken(token, &ctx, TOKEN_EOF);
 			} else if (state->c == '#') {
 				// preprocessor
@@ -2030,6 +2909,7 @@ bool getNextToken(struct LexerState* state, struct LexerToken* token)
 				createSimpleToken(token, &ctx, TOKEN_EMPTY);
 			} else {
 				state->line_beginning = false;
+				breakIncludeGuard(state);
 				if (!lexTokens(state, token, &ctx)) {
 					status = false;
 					goto out;
@@ -2041,3 +2921,65 @@ bool getNextToken(struct LexerState* state, struct LexerToken* token)
 out:
 	return status;
 }
+
+void seekLexer(struct LexerState* state, const struct LexerSourcePos* pos,
+               bool line_beginning)
+{
+	// position the lookahead one character before the target and let the
+	// regular input handling move it to the requested position
+	state->current_file.read_pos = pos->file_pos - 1;
+	state->lookahead_pos = *pos;
+	state->lookahead_pos.file_pos--;
+	state->carriage_return = false;
+	state->line_beginning = line_beginning;
+	readInputAndHandleLineEndings(state);
+	consumeInput(state);
+}
+
+bool skipToNextToken(struct LexerState* state)
+{
+	return skipWhiteSpaceOrComments(state);
+}
+
+bool getNextRawToken(struct LexerState* state, struct LexerToken* token)
+{
+	struct FileContext ctx;
+	bool status = false;
+	getFileContext(state, &ctx);
+	if (state->c == INPUT_EOF) {
+		createSimpleToken(token, &ctx, TOKEN_EOF);
+	} else if (state->c == '#') {
+		if (!state->line_beginning) {
+			lexerError(state,
+			           "Preprocessor definitions must start at the "
+			           "beginning of a line");
+			goto out;
+		}
+		state->line_beginning = false;
+		if (!skipLine(state)) {
+			goto out;
+		}
+		createSimpleToken(token, &ctx, TOKEN_EMPTY);
+	} else {
+		state->line_beginning = false;
+		state->raw_mode = true;
+		bool lexed = lexTokens(state, token, &ctx);
+		state->raw_mode = false;
+		if (!lexed) {
+			goto out;
+		}
+	}
+	status = true;
+out:
+	return status;
+}
+
+const unsigned char* getEmbeddedData(const struct LexerState* state,
+                                     const struct LexerToken* token,
+                                     size_t* size)
+{
+	const struct MappedFile* file =
+	    &state->embeds.files[token->value.embed_index];
+	*size = file->size;
+	return file->data;
+}
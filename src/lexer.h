@@ -17,9 +17,13 @@
 #define LEXER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "cpp.h"
+#include "file_table.h"
+#include "identifier_table.h"
+#include "include_search.h"
 #include "input_file.h"
 #include "string_set.h"
 
@@ -28,10 +32,15 @@
 #define LEXER_PP_NUMBER_STRINGSET_SIZE (4096 << 3)
 #define LEXER_MAX_DEFINITION_STRINGSET_SIZE (4096 << 3)
 
-#define LEXER_MAX_IDENTIFIER_COUNT 1024
-#define LEXER_MAX_STRING_LITERAL_COUNT 1024
-#define LEXER_MAX_PP_NUMBER_COUNT 1024
+// initial capacities, the string sets grow on demand
+#define LEXER_IDENTIFIER_COUNT 1024
+#define LEXER_STRING_LITERAL_COUNT 1024
+#define LEXER_PP_NUMBER_COUNT 1024
 #define LEXER_MAX_PP_CONSTANT_COUNT 1024
+#define LEXER_MAX_EMBED_COUNT 256
+#define LEXER_MAX_INCLUDE_DEPTH 200
+#define LEXER_MAX_CONDITIONAL_DEPTH 256
+#define LEXER_FILE_COUNT 256
 
 #define LEXER_IS_PREPROCESSOR_MACRO 0x1
 
@@ -150,11 +159,13 @@ enum TokenType {
 	CONSTANT_UNSIGNED_INT,
 	CONSTANT_FLOAT,
 	CONSTANT_DOUBLE,
+	LITERAL_EMBED,
 	// Preprocessor
 	PP_NUMBER,
 	PP_PARAM,
 	PP_CONCAT,
 	PP_STRINGIFY,
+	PP_VA_OPT,
 	// other
 	TOKEN_EOF,
 	TOKEN_UNKNOWN,
@@ -164,7 +175,8 @@ enum TokenType {
 struct LexerConstant {
 	union {
 		uint8_t param_index;
-		uint16_t string_index;
+		uint32_t string_index;
+		uint16_t embed_index;
 		int character_literal;
 		uint64_t int_literal;
 		float float_literal;
@@ -178,13 +190,11 @@ struct LexerConstantSet {
 	struct LexerConstant* constants;
 };
 
-struct LexerToken {
-	struct LexerConstant value;
-	uint16_t line;
-	uint16_t column;
-	uint16_t line_pos;
-	uint8_t type;
-	bool literal;
+// Files included with #embed. A LITERAL_EMBED token refers to one of them.
+struct LexerEmbedSet {
+	int num;
+	int max_count;
+	struct MappedFile* files;
 };
 
 struct LexerSourcePos {
@@ -194,6 +204,76 @@ struct LexerSourcePos {
 	int line_pos;
 };
 
+enum LexerGuardState {
+	// nothing but white space and comments so far
+	LEXER_GUARD_START,
+	// inside of the #ifndef that may be the include guard
+	LEXER_GUARD_OPEN,
+	// behind the #endif of the include guard
+	LEXER_GUARD_CLOSED,
+	LEXER_GUARD_NONE,
+};
+
+// Detects whether a file is wrapped in #ifndef X ... #endif
+struct LexerIncludeGuard {
+	uint8_t state;
+	int depth;
+	int macro;
+};
+
+enum LexerConditionalState {
+	// the current group is lexed
+	LEXER_CONDITIONAL_ACTIVE,
+	// no group was lexed yet, a following #elif or #else may be
+	LEXER_CONDITIONAL_PENDING,
+	// a previous group was lexed, the following ones are skipped
+	LEXER_CONDITIONAL_DONE,
+};
+
+// An #if, #ifdef or #ifndef whose #endif was not reached yet
+struct LexerConditional {
+	uint8_t state;
+	bool has_else;
+};
+
+// Shared by all files, every file has to close its own conditionals
+struct LexerConditionalStack {
+	int num;
+	int max_count;
+	struct LexerConditional* conditionals;
+};
+
+// The state of a file that is suspended while one of its includes is lexed
+struct LexerIncludedFile {
+	struct InputFile parent;
+	struct LexerSourcePos current_pos;
+	struct LexerSourcePos lookahead_pos;
+	struct LexerIncludeGuard guard;
+	int file_index;
+	// open conditionals of the including files
+	int num_conditionals;
+	bool carriage_return;
+	char c;
+	char lookahead;
+	// path of the included file, owned by the lexer
+	char* path;
+};
+
+struct LexerIncludeStack {
+	int num;
+	int max_count;
+	struct LexerIncludedFile* files;
+};
+
+struct LexerToken {
+	struct LexerConstant value;
+	uint16_t line;
+	uint16_t column;
+	uint16_t line_pos;
+	uint8_t type;
+	bool literal;
+};
+
 struct LexerState {
 	struct LexerSourcePos current_pos;
 	struct LexerSourcePos lookahead_pos;
@@ -201,24 +281,63 @@ struct LexerState {
 	bool line_beginning;
 	bool macro_body;
 	bool expand_macro;
+	bool raw_mode;
 	bool error_handled;
 	char c;
 	char lookahead;
 	struct InputFile current_file;
-	struct StringSet identifiers;
+	struct LexerIncludeStack includes;
+	struct FileTable files;
+	// index of the current file in the file table, -1 for the main file
+	int file_index;
+	struct LexerIncludeGuard guard;
+	struct LexerConditionalStack conditionals;
+	// searched by #include and #embed, may be NULL
+	const struct IncludeSearchPath* include_path;
+	// kept when the lexer is reset
+	struct IncludeCache include_cache;
+	struct IdentifierTable identifiers;
 	struct StringSet string_literals;
 	struct StringSet pp_numbers;
 	struct LexerConstantSet constants;
+	struct LexerEmbedSet embeds;
 	struct PreprocessorState pp_state;
 	struct LinearAllocator* scratchpad;
 };
 
 int initLexer(struct LexerState* state, const char* file_path);
 
+// Initializes the lexer with an already opened file. The lexer takes
+// ownership of the file.
+int initLexerWithInputFile(struct LexerState* state,
+                           const struct InputFile* file);
+
+// Starts lexing another file while keeping all allocated memory. Interned
+// identifiers are kept if requested, everything else is cleared.
+int resetLexer(struct LexerState* state, const char* file_path,
+               bool keep_identifiers);
+
 void cleanupLexer(struct LexerState* state);
 
 bool getNextToken(struct LexerState* state, struct LexerToken* token);
 
+// Moves the lexer to a position of a file that is held in memory.
+void seekLexer(struct LexerState* state, const struct LexerSourcePos* pos,
+               bool line_beginning);
+
+bool skipToNextToken(struct LexerState* state);
+
+// Lexes the token at the current position without handling preprocessor
+// directives or expanding macros. A directive line is skipped and reported
+// as a TOKEN_EMPTY token.
+bool getNextRawToken(struct LexerState* state, struct LexerToken* token);
+
+// Returns the bytes of a LITERAL_EMBED token. The data stays valid until the
+// lexer is reset or cleaned up.
+const unsigned char* getEmbeddedData(const struct LexerState* state,
+                                     const struct LexerToken* token,
+                                     size_t* size);
+
 void printToken(struct LexerState* state, const struct LexerToken* token);
 
 void printTokenAsCStruct(struct LexerState* state,
@@ -15,16 +15,100 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
 #include "error.h"
 #include "lexer.h"
 #include "memory/scratchpad.h"
+#include "parallel_lexer.h"
+#include "pch.h"
+
+static bool lexSequentially(struct LexerState* lexer_state, bool print)
+{
+	while (true) {
+		struct LexerToken token;
+		if (!getNextToken(lexer_state, &token)) {
+			return false;
+		}
+		if (print) {
+			printToken(lexer_state, &token);
+		}
+		if (token.type == TOKEN_EOF) {
+			break;
+		}
+	}
+	return true;
+}
+
+static bool lexInParallel(struct LexerState* lexer_state,
+                          const char* file_path,
+                          const struct IncludeSearchPath* include_path,
+                          const struct PrecompiledHeader* pch, int num_threads)
+{
+	struct LexerTokenBuffer tokens;
+	if (initLexerTokenBuffer(&tokens, PARALLEL_LEXER_TOKEN_BUFFER_SIZE) != 0) {
+		return false;
+	}
+	bool status =
+	    lexFileParallel(lexer_state, file_path, include_path, pch, num_threads,
+	                    PARALLEL_LEXER_MIN_CHUNK_SIZE, &tokens);
+	if (status) {
+		for (int i = 0; i < tokens.num; i++) {
+			printToken(lexer_state, &tokens.tokens[i]);
+		}
+	}
+	cleanupLexerTokenBuffer(&tokens);
+	return status;
+}
 
 int main(int argc, const char** argv)
 {
-	if (argc < 2) {
+	int num_threads = 1;
+	const char* file_path = NULL;
+	const char* emit_pch_path = NULL;
+	const char* include_pch_path = NULL;
+	struct IncludeSearchPath include_path;
+	initIncludeSearchPath(&include_path);
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "-j", 2) == 0) {
+			num_threads = atoi(argv[i] + 2);
+			if (num_threads < 1) {
+				fprintf(stderr, "Invalid number of threads!\n");
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-emit-pch") == 0 ||
+		           strcmp(argv[i], "-include-pch") == 0) {
+			if (i + 1 == argc) {
+				fprintf(stderr, "Missing precompiled header path!\n");
+				return 1;
+			}
+			if (argv[i][1] == 'e') {
+				emit_pch_path = argv[++i];
+			} else {
+				include_pch_path = argv[++i];
+			}
+		} else if (strncmp(argv[i], "-I", 2) == 0 ||
+		           strncmp(argv[i], "-isystem", 8) == 0) {
+			bool system = argv[i][1] == 'i';
+			const char* directory = argv[i] + (system ? 8 : 2);
+			if (*directory == 0) {
+				if (i + 1 == argc) {
+					fprintf(stderr, "Missing include directory!\n");
+					return 1;
+				}
+				directory = argv[++i];
+			}
+			if (addIncludeDirectory(&include_path, directory, system) != 0) {
+				fprintf(stderr, "Too many include directories!\n");
+				return 1;
+			}
+		} else {
+			file_path = argv[i];
+		}
+	}
+	if (file_path == NULL) {
 		fprintf(stderr, "No input file specified!\n");
 		return 1;
 	}
@@ -32,33 +116,54 @@ int main(int argc, const char** argv)
 		fprintf(stderr, "Coud not initialize scrtchpad memory");
 		return 1;
 	}
-	struct LexerState lexer_state;
-	if (initLexer(&lexer_state, argv[1]) != 0) {
-		fprintf(stderr, "Could not initialize lexer\n");
+	struct PrecompiledHeader pch;
+	if (include_pch_path != NULL &&
+	    loadPrecompiledHeader(&pch, include_pch_path) != 0) {
+		fprintf(stderr, "Could not load precompiled header\n");
 		scratchpadCleanup();
-		return -1;
+		return 1;
 	}
-	bool validInput = true;
-	while (validInput) {
-		struct LexerToken token;
-		validInput = getNextToken(&lexer_state, &token);
-		if (!validInput) {
-			lexerError(&lexer_state,
-			           "An unexpected error occured during lexing");
-			exit(1);
-		} else {
-			printToken(&lexer_state, &token);
+	const struct PrecompiledHeader* used_pch =
+	    include_pch_path != NULL ? &pch : NULL;
+	struct LexerState lexer_state;
+	bool validInput;
+	// a header is always precompiled by the sequential lexer
+	if (num_threads > 1 && emit_pch_path == NULL) {
+		validInput = lexInParallel(&lexer_state, file_path, &include_path,
+		                           used_pch, num_threads);
+	} else {
+		if (initLexer(&lexer_state, file_path) != 0) {
+			fprintf(stderr, "Could not initialize lexer\n");
+			scratchpadCleanup();
+			return -1;
 		}
-
-		if (token.type == TOKEN_EOF) {
-			break;
+		lexer_state.include_path = &include_path;
+		validInput =
+		    (used_pch == NULL ||
+		     usePrecompiledHeader(&lexer_state, used_pch) == 0) &&
+		    lexSequentially(&lexer_state, emit_pch_path == NULL);
+	}
+	if (!validInput) {
+		lexerError(&lexer_state, "An unexpected error occured during lexing");
+		exit(1);
+	}
+	if (emit_pch_path != NULL) {
+		int result = writePrecompiledHeader(&lexer_state, emit_pch_path);
+		if (result != 0) {
+			fprintf(stderr, "Could not write precompiled header\n");
+		}
+		cleanupLexer(&lexer_state);
+		if (used_pch != NULL) {
+			unloadPrecompiledHeader(&pch);
 		}
+		scratchpadCleanup();
+		return result != 0;
 	}
-	for (int i = 0;
-	     i < lexer_state.pp_state.definitions.pp_definition_names.num; i++) {
+	for (int i = 0; i < lexer_state.pp_state.definitions.num; i++) {
 		printf("begin %s\n",
-		       getStringAt(
-		           &lexer_state.pp_state.definitions.pp_definition_names, i));
+		       getIdentifierName(
+		           &lexer_state.identifiers,
+		           lexer_state.pp_state.definitions.definitions[i].name));
 		int start = lexer_state.pp_state.definitions.definitions[i].token_start;
 		int end =
 		    lexer_state.pp_state.definitions.definitions[i].num_tokens + start;
@@ -71,6 +176,9 @@ int main(int argc, const char** argv)
 		}
 	}
 	cleanupLexer(&lexer_state);
+	if (used_pch != NULL) {
+		unloadPrecompiledHeader(&pch);
+	}
 	scratchpadCleanup();
 	return 0;
 }
@@ -0,0 +1,484 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "parallel_lexer.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpp.h"
+#include "error.h"
+#include "helper.h"
+#include "memory/allocator.h"
+#include "memory/linear_allocator.h"
+#include "memory/scratchpad.h"
+
+struct SpeculativeTokenPos {
+	struct LexerSourcePos pos;
+	bool line_beginning;
+};
+
+struct LexerChunk {
+	struct LexerState state;
+	struct LinearAllocator scratchpad;
+	size_t begin;
+	size_t end;
+	int num_lines;
+	// Position at which the chunk stopped lexing. This is either the first
+	// token starting behind the end of the chunk or the place where lexing
+	// failed.
+	struct SpeculativeTokenPos resume_pos;
+	struct LexerTokenBuffer tokens;
+	struct SpeculativeTokenPos* positions;
+	int* identifier_map;
+	int* string_literal_map;
+	bool initialized;
+	pthread_t thread;
+	bool thread_started;
+};
+
+int initLexerTokenBuffer(struct LexerTokenBuffer* buffer, int capacity)
+{
+	buffer->num = 0;
+	buffer->capacity = capacity;
+	buffer->tokens = ALLOCATE_TYPE(getGlobalAllocator(), capacity,
+	                               typeof(*buffer->tokens));
+	if (buffer->tokens == NULL) {
+		buffer->capacity = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void cleanupLexerTokenBuffer(struct LexerTokenBuffer* buffer)
+{
+	deallocate(getGlobalAllocator(), buffer->tokens);
+	buffer->tokens = NULL;
+	buffer->num = 0;
+	buffer->capacity = 0;
+}
+
+static bool growLexerTokenBuffer(struct LexerTokenBuffer* buffer)
+{
+	int capacity = MAX(buffer->capacity * 2, PARALLEL_LEXER_TOKEN_BUFFER_SIZE);
+	struct LexerToken* tokens = reallocate(
+	    getGlobalAllocator(), buffer->tokens, sizeof(*tokens) * capacity);
+	if (tokens == NULL) {
+		return false;
+	}
+	buffer->tokens = tokens;
+	buffer->capacity = capacity;
+	return true;
+}
+
+int addLexerToken(struct LexerTokenBuffer* buffer,
+                  const struct LexerToken* token)
+{
+	if (buffer->num == buffer->capacity) {
+		if (!growLexerTokenBuffer(buffer)) {
+			generalError("not enough memory to store token");
+			return -1;
+		}
+	}
+	buffer->tokens[buffer->num] = *token;
+	return buffer->num++;
+}
+
+// Counts line breaks the same way the lexer does: \n, \r\n and \r
+static int countLines(const char* buffer, size_t begin, size_t end)
+{
+	int lines = 0;
+	for (size_t i = begin; i < end; i++) {
+		if (buffer[i] == '\r') {
+			lines++;
+		} else if (buffer[i] == '\n' && (i == 0 || buffer[i - 1] != '\r')) {
+			lines++;
+		}
+	}
+	return lines;
+}
+
+static size_t findLineBeginning(const char* buffer, size_t pos, size_t size)
+{
+	const char* newline = memchr(buffer + pos, '\n', size - pos);
+	if (newline == NULL) {
+		return size;
+	}
+	return newline - buffer + 1;
+}
+
+static int splitIntoChunks(struct LexerChunk* chunks, int max_chunks,
+                           const struct InputFile* file, size_t min_chunk_size)
+{
+	size_t size = file->file_size;
+	int num_chunks = MIN(max_chunks, (int)(size / MAX(min_chunk_size, 1)));
+	num_chunks = MAX(num_chunks, 1);
+
+	int num = 0;
+	size_t begin = 0;
+	for (int i = 1; i <= num_chunks && begin < size; i++) {
+		size_t end = size;
+		if (i < num_chunks) {
+			end = findLineBeginning(file->buffer, (size * i) / num_chunks,
+			                        size);
+		}
+		if (end <= begin) {
+			continue;
+		}
+		memset(&chunks[num], 0, sizeof(chunks[num]));
+		chunks[num].begin = begin;
+		chunks[num].end = end;
+		num++;
+		begin = end;
+	}
+	return num;
+}
+
+static bool initChunk(struct LexerChunk* chunk, const struct InputFile* file)
+{
+	struct InputFile view;
+	createInputFileView(&view, file, chunk->begin);
+	if (initLexerWithInputFile(&chunk->state, &view) != 0) {
+		return false;
+	}
+	chunk->initialized = true;
+
+	struct MemoryArena* arena = globallyAllocateArena(SCRATCHPAD_SIZE);
+	if (arena == NULL) {
+		return false;
+	}
+	initLinearAllocator(&chunk->scratchpad, arena);
+	chunk->state.scratchpad = &chunk->scratchpad;
+	// errors are reported by the sequential lexer when it relexes the chunk
+	chunk->state.error_handled = true;
+
+	if (initLexerTokenBuffer(&chunk->tokens,
+	                         PARALLEL_LEXER_TOKEN_BUFFER_SIZE) != 0) {
+		return false;
+	}
+	chunk->positions = ALLOCATE_TYPE(getGlobalAllocator(),
+	                                 chunk->tokens.capacity,
+	                                 typeof(*chunk->positions));
+	if (chunk->positions == NULL) {
+		return false;
+	}
+
+	struct LexerSourcePos pos = {.line = 0,
+	                             .column = 0,
+	                             .file_pos = chunk->begin + 1,
+	                             .line_pos = chunk->begin};
+	seekLexer(&chunk->state, &pos, true);
+	return true;
+}
+
+static void cleanupChunk(struct LexerChunk* chunk)
+{
+	struct Allocator* global_allocator = getGlobalAllocator();
+	if (chunk->initialized) {
+		cleanupLexer(&chunk->state);
+	}
+	if (chunk->scratchpad.arena != NULL) {
+		cleanupLinearAllocator(&chunk->scratchpad);
+	}
+	cleanupLexerTokenBuffer(&chunk->tokens);
+	deallocate(global_allocator, chunk->positions);
+	deallocate(global_allocator, chunk->identifier_map);
+	deallocate(global_allocator, chunk->string_literal_map);
+}
+
+static bool addSpeculativeToken(struct LexerChunk* chunk,
+                                const struct LexerToken* token,
+                                const struct SpeculativeTokenPos* pos)
+{
+	int capacity = chunk->tokens.capacity;
+	int index = addLexerToken(&chunk->tokens, token);
+	if (index < 0) {
+		return false;
+	}
+	if (capacity != chunk->tokens.capacity) {
+		struct SpeculativeTokenPos* positions = reallocate(
+		    getGlobalAllocator(), chunk->positions,
+		    sizeof(*chunk->positions) * chunk->tokens.capacity);
+		if (positions == NULL) {
+			return false;
+		}
+		chunk->positions = positions;
+	}
+	chunk->positions[index] = *pos;
+	return true;
+}
+
+static void* lexChunk(void* data)
+{
+	struct LexerChunk* chunk = data;
+	struct LexerState* state = &chunk->state;
+
+	chunk->num_lines =
+	    countLines(state->current_file.buffer, chunk->begin, chunk->end);
+
+	while (true) {
+		struct SpeculativeTokenPos pos = {state->current_pos,
+		                                  state->line_beginning};
+		chunk->resume_pos = pos;
+		if (!skipToNextToken(state)) {
+			break;
+		}
+		pos.pos = state->current_pos;
+		pos.line_beginning = state->line_beginning;
+		chunk->resume_pos = pos;
+		if ((size_t)(pos.pos.file_pos - 1) >= chunk->end ||
+		    state->c == INPUT_EOF) {
+			break;
+		}
+		struct LexerToken token;
+		if (!getNextRawToken(state, &token)) {
+			break;
+		}
+		if (!addSpeculativeToken(chunk, &token, &pos)) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+static bool prepareMerge(struct LexerChunk* chunk)
+{
+	struct Allocator* global_allocator = getGlobalAllocator();
+	int num_identifiers =
+	    MAX(getStringCount(&chunk->state.identifiers.names), 1);
+	int num_string_literals =
+	    MAX(getStringCount(&chunk->state.string_literals), 1);
+	chunk->identifier_map =
+	    ALLOCATE_TYPE(global_allocator, num_identifiers, int);
+	chunk->string_literal_map =
+	    ALLOCATE_TYPE(global_allocator, num_string_literals, int);
+	if (chunk->identifier_map == NULL || chunk->string_literal_map == NULL) {
+		return false;
+	}
+	memset(chunk->identifier_map, -1, sizeof(int) * num_identifiers);
+	memset(chunk->string_literal_map, -1, sizeof(int) * num_string_literals);
+	return true;
+}
+
+static int mapIdentifier(struct LexerState* state, struct LexerChunk* chunk,
+                         int index)
+{
+	if (chunk->identifier_map[index] < 0) {
+		struct StringSet* identifiers = &chunk->state.identifiers.names;
+		chunk->identifier_map[index] = internIdentifier(
+		    &state->identifiers, getStringAt(identifiers, index),
+		    getLengthAt(identifiers, index), getHashAt(identifiers, index));
+	}
+	return chunk->identifier_map[index];
+}
+
+static int mapStringLiteral(struct LexerState* state, struct LexerChunk* chunk,
+                            int index)
+{
+	if (chunk->string_literal_map[index] < 0) {
+		struct StringSet* literals = &chunk->state.string_literals;
+		chunk->string_literal_map[index] =
+		    addString(&state->string_literals, getStringAt(literals, index),
+		              getLengthAt(literals, index));
+	}
+	return chunk->string_literal_map[index];
+}
+
+// Takes over speculatively lexed tokens, starting at the given index, until a
+// token is reached that has to be handled by the sequential lexer. Returns the
+// index of that token.
+static int acceptChunkTokens(struct LexerState* state, struct LexerChunk* chunk,
+                             int start, int line_offset,
+                             struct LexerTokenBuffer* tokens)
+{
+	int i;
+	for (i = start; i < chunk->tokens.num; i++) {
+		struct LexerToken token = chunk->tokens.tokens[i];
+		if (token.type == TOKEN_EMPTY) {
+			// preprocessor directive
+			break;
+		} else if (token.type == IDENTIFIER) {
+			int index = mapIdentifier(state, chunk, token.value.string_index);
+			if (index < 0) {
+				return -1;
+			}
+			if (getDefinition(&state->pp_state, index) != NULL) {
+				// macro expansion
+				break;
+			}
+			token.value.string_index = index;
+		} else if (token.type >= KEYWORD_IF && token.type <= KEYWORD_CONSTEVAL) {
+			// keywords have the same index in every identifier table
+			if (getDefinition(&state->pp_state, token.value.string_index) !=
+			    NULL) {
+				break;
+			}
+		} else if (token.type == LITERAL_STRING) {
+			int index =
+			    mapStringLiteral(state, chunk, token.value.string_index);
+			if (index < 0) {
+				return -1;
+			}
+			token.value.string_index = index;
+		}
+		token.line += line_offset;
+		if (addLexerToken(tokens, &token) < 0) {
+			return -1;
+		}
+	}
+	return i;
+}
+
+static void seekToSpeculativePos(struct LexerState* state,
+                                 const struct SpeculativeTokenPos* pos,
+                                 int line_offset)
+{
+	struct LexerSourcePos source_pos = pos->pos;
+	source_pos.line += line_offset;
+	seekLexer(state, &source_pos, pos->line_beginning);
+}
+
+static bool mergeChunks(struct LexerState* state, struct LexerChunk* chunks,
+                        int num_chunks, struct LexerTokenBuffer* tokens)
+{
+	int chunk_index = 0;
+	int cursor = 0;
+	int line_offset = 0;
+	while (true) {
+		// the chunks only cover the main file
+		if (!state->expand_macro && state->includes.num == 0) {
+			if (!skipToNextToken(state)) {
+				return false;
+			}
+			int file_pos = state->current_pos.file_pos;
+			while (chunk_index < num_chunks &&
+			       (size_t)(file_pos - 1) >= chunks[chunk_index].end) {
+				line_offset += chunks[chunk_index].num_lines;
+				chunk_index++;
+				cursor = 0;
+			}
+			if (chunk_index < num_chunks) {
+				struct LexerChunk* chunk = &chunks[chunk_index];
+				while (cursor < chunk->tokens.num &&
+				       chunk->positions[cursor].pos.file_pos < file_pos) {
+					cursor++;
+				}
+				// the speculation is correct if both lexers agree on where
+				// the next token starts
+				if (cursor < chunk->tokens.num &&
+				    chunk->positions[cursor].pos.file_pos == file_pos &&
+				    chunk->positions[cursor].line_beginning ==
+				        state->line_beginning) {
+					int next = acceptChunkTokens(state, chunk, cursor,
+					                             line_offset, tokens);
+					if (next < 0) {
+						return false;
+					}
+					if (next > cursor) {
+						cursor = next;
+						if (next < chunk->tokens.num) {
+							seekToSpeculativePos(state, &chunk->positions[next],
+							                     line_offset);
+						} else {
+							seekToSpeculativePos(state, &chunk->resume_pos,
+							                     line_offset);
+						}
+						continue;
+					}
+				}
+			}
+		}
+		struct LexerToken token;
+		if (!getNextToken(state, &token)) {
+			return false;
+		}
+		if (addLexerToken(tokens, &token) < 0) {
+			return false;
+		}
+		if (token.type == TOKEN_EOF) {
+			break;
+		}
+	}
+	return true;
+}
+
+bool lexFileParallel(struct LexerState* state, const char* file_path,
+                     const struct IncludeSearchPath* include_path,
+                     const struct PrecompiledHeader* pch, int num_threads,
+                     size_t min_chunk_size, struct LexerTokenBuffer* tokens)
+{
+	memset(state, 0, sizeof(*state));
+	struct InputFile file;
+	if (loadInputFile(&file, file_path, fileName(file_path)) != 0) {
+		fprintf(stderr, "Could not open file\n");
+		return false;
+	}
+	if (initLexerWithInputFile(state, &file) != 0) {
+		return false;
+	}
+	state->include_path = include_path;
+	if (pch != NULL && usePrecompiledHeader(state, pch) != 0) {
+		return false;
+	}
+
+	num_threads = MAX(MIN(num_threads, PARALLEL_LEXER_MAX_THREADS), 1);
+	struct LexerChunk* chunks =
+	    ALLOCATE_TYPE(getGlobalAllocator(), num_threads, struct LexerChunk);
+	if (chunks == NULL) {
+		return false;
+	}
+	int num_chunks = 0;
+	if (num_threads > 1) {
+		num_chunks = splitIntoChunks(chunks, num_threads, &state->current_file,
+		                             min_chunk_size);
+	}
+	if (num_chunks == 1) {
+		// not worth it, the sequential lexer handles everything
+		num_chunks = 0;
+	}
+
+	bool status = false;
+	for (int i = 0; i < num_chunks; i++) {
+		if (!initChunk(&chunks[i], &state->current_file)) {
+			num_chunks = i + 1;
+			goto out;
+		}
+	}
+	for (int i = 0; i < num_chunks; i++) {
+		chunks[i].thread_started =
+		    pthread_create(&chunks[i].thread, NULL, lexChunk, &chunks[i]) == 0;
+		if (!chunks[i].thread_started) {
+			lexChunk(&chunks[i]);
+		}
+	}
+	for (int i = 0; i < num_chunks; i++) {
+		if (chunks[i].thread_started) {
+			pthread_join(chunks[i].thread, NULL);
+		}
+	}
+	for (int i = 0; i < num_chunks; i++) {
+		if (!prepareMerge(&chunks[i])) {
+			goto out;
+		}
+	}
+	status = mergeChunks(state, chunks, num_chunks, tokens);
+out:
+	for (int i = 0; i < num_chunks; i++) {
+		cleanupChunk(&chunks[i]);
+	}
+	deallocate(getGlobalAllocator(), chunks);
+	return status;
+}
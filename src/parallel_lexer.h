@@ -0,0 +1,58 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_LEXER_H
+#define PARALLEL_LEXER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lexer.h"
+#include "pch.h"
+
+#define PARALLEL_LEXER_MAX_THREADS 64
+#define PARALLEL_LEXER_MIN_CHUNK_SIZE (4096 << 6)
+#define PARALLEL_LEXER_TOKEN_BUFFER_SIZE 4096
+
+struct LexerTokenBuffer {
+	struct LexerToken* tokens;
+	int num;
+	int capacity;
+};
+
+int initLexerTokenBuffer(struct LexerTokenBuffer* buffer, int capacity);
+
+void cleanupLexerTokenBuffer(struct LexerTokenBuffer* buffer);
+
+int addLexerToken(struct LexerTokenBuffer* buffer,
+                  const struct LexerToken* token);
+
+// Lexes a whole file into a token buffer. The file is split into chunks at
+// line boundaries which are lexed speculatively on their own threads, assuming
+// that a chunk does not start inside of a comment or literal. The chunks are
+// then merged in order by a sequential lexer which only relexes the parts
+// where the speculation was wrong, preprocessor directives, included files
+// and macro expansions. The result is the same token stream a sequential lexer
+// produces.
+//
+// The state is initialized by this function and has to be cleaned up with
+// cleanupLexer, even if lexing fails. The precompiled header may be NULL.
+bool lexFileParallel(struct LexerState* state, const char* file_path,
+                     const struct IncludeSearchPath* include_path,
+                     const struct PrecompiledHeader* pch,
+                     int num_threads, size_t min_chunk_size,
+                     struct LexerTokenBuffer* tokens);
+
+#endif
@@ -1,7 +1,62 @@
 #include "parser.h"
 
+#include <assert.h>
+
+#define LOOKAHEAD_MASK (PARSER_LOOKAHEAD_SIZE - 1)
+
 int initParser(struct ParserState *state, struct LexerState *lexer)
 {
 	state->lexer = lexer;
+	state->lookahead.head = 0;
+	state->lookahead.count = 0;
+	state->lookahead.eof = false;
 	return 0;
 }
+
+// Lexes tokens until the buffer is full so the lexer is called in batches
+// instead of once per peek
+static bool refillLookahead(struct ParserState *state)
+{
+	struct TokenLookahead *lookahead = &state->lookahead;
+	while (lookahead->count < PARSER_LOOKAHEAD_SIZE) {
+		int index = (lookahead->head + lookahead->count) & LOOKAHEAD_MASK;
+		struct LexerToken *token = &lookahead->tokens[index];
+		if (lookahead->eof) {
+			// keep returning the end of file token
+			int last = (index - 1) & LOOKAHEAD_MASK;
+			*token = lookahead->tokens[last];
+		} else {
+			if (!getNextToken(state->lexer, token)) {
+				return false;
+			}
+			lookahead->eof = token->type == TOKEN_EOF;
+		}
+		lookahead->count++;
+	}
+	return true;
+}
+
+const struct LexerToken *peekToken(struct ParserState *state, int k)
+{
+	assert(k >= 0 && k <= PARSER_MAX_LOOKAHEAD);
+	struct TokenLookahead *lookahead = &state->lookahead;
+	if (k >= lookahead->count) {
+		if (!refillLookahead(state)) {
+			return NULL;
+		}
+	}
+	return &lookahead->tokens[(lookahead->head + k) & LOOKAHEAD_MASK];
+}
+
+bool advanceToken(struct ParserState *state)
+{
+	struct TokenLookahead *lookahead = &state->lookahead;
+	if (lookahead->count == 0) {
+		if (!refillLookahead(state)) {
+			return false;
+		}
+	}
+	lookahead->head = (lookahead->head + 1) & LOOKAHEAD_MASK;
+	lookahead->count--;
+	return true;
+}
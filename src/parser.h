@@ -1,10 +1,15 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "lexer.h"
 
+// number of buffered tokens, has to be a power of two
+#define PARSER_LOOKAHEAD_SIZE 8
+#define PARSER_MAX_LOOKAHEAD (PARSER_LOOKAHEAD_SIZE - 1)
+
 enum BinaryOperatorType {
 	BINOP_ADD,
 	BINOP_SUB,
@@ -70,14 +75,28 @@ struct AST {
 	int root_index;
 };
 
+struct TokenLookahead {
+	struct LexerToken tokens[PARSER_LOOKAHEAD_SIZE];
+	uint8_t head;
+	uint8_t count;
+	bool eof;
+};
+
 struct ParserState {
 	struct LexerState *lexer;
-	struct LexerToken current_token;
+	struct TokenLookahead lookahead;
 	struct AST ast;
 };
 
 int initParser(struct ParserState *state, struct LexerState *lexer);
 
+// Returns the k-th token after the current one without consuming it. The
+// current token is at k = 0. Returns NULL if lexing fails.
+const struct LexerToken *peekToken(struct ParserState *state, int k);
+
+// Consumes the current token
+bool advanceToken(struct ParserState *state);
+
 int parse(struct ParserState *state);
 
 #endif
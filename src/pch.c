@@ -0,0 +1,408 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include <string.h>
+
+#include "error.h"
+#include "include_search.h"
+#include "memory/allocator.h"
+
+#define PCH_ALIGNMENT 16
+
+static const char pch_magic[8] = "DCCPCH";
+
+enum PchSectionType {
+	PCH_IDENTIFIERS,
+	PCH_IDENTIFIER_INFOS,
+	PCH_STRING_LITERALS,
+	PCH_PP_NUMBERS,
+	PCH_DEFINITIONS,
+	PCH_TOKENS,
+	PCH_CONSTANTS,
+	PCH_FILE_IDS,
+	PCH_FILE_INFOS,
+	PCH_SECTION_COUNT
+};
+
+struct PchSection {
+	uint64_t offset;
+	uint64_t size;
+};
+
+// Followed by the sections, each of them starts at a multiple of 16 bytes
+struct PchHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	struct PchSection sections[PCH_SECTION_COUNT];
+};
+
+static bool alignFile(FILE* file)
+{
+	static const char padding[PCH_ALIGNMENT] = {0};
+	long pos = ftell(file);
+	if (pos < 0) {
+		return false;
+	}
+	size_t size = (PCH_ALIGNMENT - pos % PCH_ALIGNMENT) % PCH_ALIGNMENT;
+	return fwrite(padding, 1, size, file) == size;
+}
+
+static bool beginSection(FILE* file, struct PchSection* section)
+{
+	if (!alignFile(file)) {
+		return false;
+	}
+	section->offset = ftell(file);
+	return true;
+}
+
+static void endSection(FILE* file, struct PchSection* section)
+{
+	section->size = ftell(file) - section->offset;
+}
+
+static bool writeArraySection(FILE* file, struct PchSection* section,
+                              const void* data, size_t element_size,
+                              size_t num)
+{
+	if (!beginSection(file, section) ||
+	    (num > 0 && fwrite(data, element_size, num, file) != num)) {
+		return false;
+	}
+	endSection(file, section);
+	return true;
+}
+
+static bool writeStringSetSection(FILE* file, struct PchSection* section,
+                                  struct StringSet* set)
+{
+	if (!beginSection(file, section) ||
+	    writeStringSetSnapshotToFile(set, file) != 0) {
+		return false;
+	}
+	endSection(file, section);
+	return true;
+}
+
+// The header itself is not included by the lexer, so its guard is recorded
+// here to skip it when a file that uses the precompiled header includes it
+static int recordMainFileGuard(struct LexerState* state)
+{
+	struct FileId id;
+	if (state->guard.state != LEXER_GUARD_CLOSED ||
+	    !getFileId(state->current_file.full_path, &id)) {
+		return 0;
+	}
+	int index = internFile(&state->files, &id);
+	if (index < 0) {
+		return -1;
+	}
+	getFileInfo(&state->files, index)->guard = state->guard.macro;
+	return 0;
+}
+
+int writePrecompiledHeader(struct LexerState* state, const char* path)
+{
+	struct PreprocessorState* pp_state = &state->pp_state;
+	if (recordMainFileGuard(state) != 0) {
+		generalError("Memory allocation failed");
+		return -1;
+	}
+	for (int i = 0; i < pp_state->tokens.num; i++) {
+		if (pp_state->tokens.tokens[i].type == LITERAL_EMBED) {
+			generalError("Embedded files can not be precompiled");
+			return -1;
+		}
+	}
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		return -1;
+	}
+	struct PchHeader header = {.version = PCH_VERSION};
+	memcpy(header.magic, pch_magic, sizeof(header.magic));
+	struct PchSection* sections = header.sections;
+	struct IdentifierTable* identifiers = &state->identifiers;
+	struct FileTable* files = &state->files;
+	bool written =
+	    fwrite(&header, sizeof(header), 1, file) == 1 &&
+	    writeStringSetSection(file, &sections[PCH_IDENTIFIERS],
+	                          &identifiers->names) &&
+	    writeArraySection(file, &sections[PCH_IDENTIFIER_INFOS],
+	                      identifiers->infos, sizeof(*identifiers->infos),
+	                      getStringCount(&identifiers->names)) &&
+	    writeStringSetSection(file, &sections[PCH_STRING_LITERALS],
+	                          &state->string_literals) &&
+	    writeStringSetSection(file, &sections[PCH_PP_NUMBERS],
+	                          &state->pp_numbers) &&
+	    writeArraySection(file, &sections[PCH_DEFINITIONS],
+	                      pp_state->definitions.definitions,
+	                      sizeof(*pp_state->definitions.definitions),
+	                      pp_state->definitions.num) &&
+	    writeArraySection(file, &sections[PCH_TOKENS], pp_state->tokens.tokens,
+	                      sizeof(*pp_state->tokens.tokens),
+	                      pp_state->tokens.num) &&
+	    writeArraySection(file, &sections[PCH_CONSTANTS],
+	                      state->constants.constants,
+	                      sizeof(*state->constants.constants),
+	                      state->constants.num) &&
+	    writeStringSetSection(file, &sections[PCH_FILE_IDS], &files->ids) &&
+	    writeArraySection(file, &sections[PCH_FILE_INFOS], files->infos,
+	                      sizeof(*files->infos), getStringCount(&files->ids));
+	// the header is written again once the sections are known
+	written = written && fseek(file, 0, SEEK_SET) == 0 &&
+	          fwrite(&header, sizeof(header), 1, file) == 1;
+	if (fclose(file) != 0 || !written) {
+		remove(path);
+		return -1;
+	}
+	return 0;
+}
+
+static const void* getArraySection(const struct PrecompiledHeader* pch,
+                                   const struct PchSection* section,
+                                   size_t element_size, int* num)
+{
+	if (section->size % element_size != 0 ||
+	    section->size / element_size > INT32_MAX) {
+		return NULL;
+	}
+	*num = section->size / element_size;
+	return pch->file.data + section->offset;
+}
+
+static bool checkSections(const struct PrecompiledHeader* pch,
+                          const struct PchHeader* header)
+{
+	for (int i = 0; i < PCH_SECTION_COUNT; i++) {
+		const struct PchSection* section = &header->sections[i];
+		if (section->offset % PCH_ALIGNMENT != 0 ||
+		    section->offset > pch->file.size ||
+		    section->size > pch->file.size - section->offset) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool viewStringSetSection(const struct PrecompiledHeader* pch,
+                                 const struct PchSection* section,
+                                 struct StringSetSnapshot* snapshot)
+{
+	return viewStringSetSnapshot(snapshot, pch->file.data + section->offset,
+	                             section->size) == 0 &&
+	       verifyStringSetSnapshot(snapshot) == 0;
+}
+
+// The indices stored in the arrays are checked on load, so that a damaged
+// header is rejected instead of being read out of bounds
+static bool checkIdentifierInfos(const struct PrecompiledHeader* pch,
+                                 int num_identifiers)
+{
+	for (int i = 0; i < num_identifiers; i++) {
+		const struct IdentifierInfo* info = &pch->identifier_infos[i];
+		if (info->keyword > KEYWORD_CONSTEVAL ||
+		    (info->definition != IDENTIFIER_NO_DEFINITION &&
+		     (info->definition < 0 ||
+		      info->definition >= pch->num_definitions))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool checkFileInfos(const struct PrecompiledHeader* pch, int num_files,
+                           int num_identifiers)
+{
+	for (int i = 0; i < num_files; i++) {
+		int32_t guard = pch->file_infos[i].guard;
+		if (guard != FILE_TABLE_NO_GUARD &&
+		    (guard < 0 || guard >= num_identifiers)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool checkTokens(const struct PrecompiledHeader* pch,
+                        int num_identifiers)
+{
+	uint32_t num_strings = getStringCount(&pch->string_literals.set);
+	uint32_t num_numbers = getStringCount(&pch->pp_numbers.set);
+	for (int i = 0; i < pch->num_tokens; i++) {
+		int type = pch->tokens[i].type;
+		uint32_t value = pch->tokens[i].value_handle;
+		bool valid;
+		if (type <= KEYWORD_CONSTEVAL) {
+			valid = value < (uint32_t)num_identifiers;
+		} else if (type == LITERAL_STRING) {
+			valid = value < num_strings;
+		} else if (type == PP_NUMBER) {
+			valid = value < num_numbers;
+		} else if (type >= CONSTANT_CHAR && type <= CONSTANT_DOUBLE) {
+			valid = value < (uint32_t)pch->num_constants;
+		} else {
+			// parameters are checked with their definition
+			valid = type < TOKEN_EOF && type != LITERAL_EMBED;
+		}
+		if (!valid) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool checkDefinitions(const struct PrecompiledHeader* pch)
+{
+	int num_identifiers = getStringCount(&pch->identifiers.set);
+	for (int i = 0; i < pch->num_definitions; i++) {
+		const struct PreprocessorDefinition* definition = &pch->definitions[i];
+		int end = definition->token_start + definition->num_tokens;
+		if (definition->name >= (uint32_t)num_identifiers ||
+		    end > pch->num_tokens) {
+			return false;
+		}
+		for (int j = definition->token_start; j < end; j++) {
+			const struct PreprocessorToken* token = &pch->tokens[j];
+			if (token->type == PP_PARAM &&
+			    token->value_handle >= definition->num_params) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+int loadPrecompiledHeader(struct PrecompiledHeader* pch, const char* path)
+{
+	memset(pch, 0, sizeof(*pch));
+	if (mapFile(&pch->file, path, SIZE_MAX) != 0) {
+		return -1;
+	}
+	const struct PchHeader* header = (const void*)pch->file.data;
+	if (pch->file.size < sizeof(*header) ||
+	    memcmp(header->magic, pch_magic, sizeof(pch_magic)) != 0 ||
+	    header->version != PCH_VERSION || !checkSections(pch, header)) {
+		goto err;
+	}
+	const struct PchSection* sections = header->sections;
+	if (!viewStringSetSection(pch, &sections[PCH_IDENTIFIERS],
+	                          &pch->identifiers) ||
+	    !viewStringSetSection(pch, &sections[PCH_STRING_LITERALS],
+	                          &pch->string_literals) ||
+	    !viewStringSetSection(pch, &sections[PCH_PP_NUMBERS],
+	                          &pch->pp_numbers) ||
+	    !viewStringSetSection(pch, &sections[PCH_FILE_IDS], &pch->file_ids)) {
+		goto err;
+	}
+
+	int num_identifiers = 0;
+	int num_files = 0;
+	pch->identifier_infos = getArraySection(
+	    pch, &sections[PCH_IDENTIFIER_INFOS],
+	    sizeof(*pch->identifier_infos), &num_identifiers);
+	pch->definitions =
+	    getArraySection(pch, &sections[PCH_DEFINITIONS],
+	                    sizeof(*pch->definitions), &pch->num_definitions);
+	pch->tokens = getArraySection(pch, &sections[PCH_TOKENS],
+	                              sizeof(*pch->tokens), &pch->num_tokens);
+	pch->constants =
+	    getArraySection(pch, &sections[PCH_CONSTANTS],
+	                    sizeof(*pch->constants), &pch->num_constants);
+	pch->file_infos = getArraySection(pch, &sections[PCH_FILE_INFOS],
+	                                  sizeof(*pch->file_infos), &num_files);
+	if (pch->identifier_infos == NULL || pch->definitions == NULL ||
+	    pch->tokens == NULL || pch->constants == NULL ||
+	    pch->file_infos == NULL ||
+	    num_identifiers != getStringCount(&pch->identifiers.set) ||
+	    num_files != getStringCount(&pch->file_ids.set)) {
+		goto err;
+	}
+	if (!checkIdentifierInfos(pch, num_identifiers) ||
+	    !checkFileInfos(pch, num_files, num_identifiers) ||
+	    !checkTokens(pch, num_identifiers) || !checkDefinitions(pch)) {
+		goto err;
+	}
+	return 0;
+err:
+	unmapFile(&pch->file);
+	return -1;
+}
+
+void unloadPrecompiledHeader(struct PrecompiledHeader* pch)
+{
+	unmapFile(&pch->file);
+	memset(pch, 0, sizeof(*pch));
+}
+
+static int copyDefinitions(struct PreprocessorState* pp_state,
+                           const struct PrecompiledHeader* pch)
+{
+	struct PreprocessorDefinitionSet* definitions = &pp_state->definitions;
+	if (pch->num_definitions > definitions->max_definitions) {
+		struct PreprocessorDefinition* new_definitions =
+		    reallocate(definitions->allocator, definitions->definitions,
+		               sizeof(*new_definitions) * pch->num_definitions);
+		if (new_definitions == NULL) {
+			return -1;
+		}
+		definitions->definitions = new_definitions;
+		definitions->max_definitions = pch->num_definitions;
+	}
+	memcpy(definitions->definitions, pch->definitions,
+	       sizeof(*pch->definitions) * pch->num_definitions);
+	definitions->num = pch->num_definitions;
+	return updateMacroNameFilter(pp_state);
+}
+
+int usePrecompiledHeader(struct LexerState* state,
+                         const struct PrecompiledHeader* pch)
+{
+	struct PreprocessorState* pp_state = &state->pp_state;
+	if (getStringCount(&state->string_literals) != 0 ||
+	    getStringCount(&state->pp_numbers) != 0 ||
+	    getStringCount(&state->files.ids) != 0 ||
+	    pp_state->definitions.num != 0 || pp_state->tokens.num != 0 ||
+	    state->constants.num != 0) {
+		generalError("A precompiled header has to be used first");
+		return -1;
+	}
+	if (pch->num_tokens > pp_state->tokens.max_tokens ||
+	    pch->num_constants > state->constants.max_count) {
+		generalError("Precompiled header is too large");
+		return -1;
+	}
+	if (setIdentifierTableBase(&state->identifiers, &pch->identifiers.set,
+	                           pch->identifier_infos) != 0 ||
+	    setFileTableBase(&state->files, &pch->file_ids.set,
+	                     pch->file_infos) != 0 ||
+	    copyDefinitions(pp_state, pch) != 0) {
+		generalError("Memory allocation failed");
+		return -1;
+	}
+	resetStringSet(&state->string_literals);
+	setStringSetBase(&state->string_literals, &pch->string_literals.set);
+	resetStringSet(&state->pp_numbers);
+	setStringSetBase(&state->pp_numbers, &pch->pp_numbers.set);
+	memcpy(pp_state->tokens.tokens, pch->tokens,
+	       sizeof(*pch->tokens) * pch->num_tokens);
+	pp_state->tokens.num = pch->num_tokens;
+	memcpy(state->constants.constants, pch->constants,
+	       sizeof(*pch->constants) * pch->num_constants);
+	state->constants.num = pch->num_constants;
+	return 0;
+}
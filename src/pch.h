@@ -0,0 +1,63 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCH_H
+#define PCH_H
+
+#include "cpp.h"
+#include "file_table.h"
+#include "identifier_table.h"
+#include "input_file.h"
+#include "lexer.h"
+#include "string_set.h"
+
+#define PCH_VERSION 4
+
+// The preprocessor state of a lexer after it processed a header: the macro
+// definitions with their tokens and constants, the interned identifiers,
+// string literals and numbers, and the known include guards. The string sets
+// are used straight from the mapped file, the arrays that can change while
+// lexing are copied.
+struct PrecompiledHeader {
+	struct MappedFile file;
+	struct StringSetSnapshot identifiers;
+	struct StringSetSnapshot string_literals;
+	struct StringSetSnapshot pp_numbers;
+	struct StringSetSnapshot file_ids;
+	const struct IdentifierInfo* identifier_infos;
+	const struct PreprocessorDefinition* definitions;
+	const struct PreprocessorToken* tokens;
+	const struct LexerConstant* constants;
+	const struct FileInfo* file_infos;
+	int num_definitions;
+	int num_tokens;
+	int num_constants;
+};
+
+// Stores the state of a lexer that reached the end of its file. Macros that
+// expand to embedded files can not be stored.
+int writePrecompiledHeader(struct LexerState* state, const char* path);
+
+int loadPrecompiledHeader(struct PrecompiledHeader* pch, const char* path);
+
+void unloadPrecompiledHeader(struct PrecompiledHeader* pch);
+
+// Has to be called before the lexer produced any token. The header has to
+// stay loaded as long as the lexer is used. Resetting the lexer removes the
+// macros of the header again.
+int usePrecompiledHeader(struct LexerState* state,
+                         const struct PrecompiledHeader* pch);
+
+#endif
@@ -15,224 +15,841 @@
 
 #include "string_set.h"
 
+#include <stdalign.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
+#include "helper.h"
+#include "input_file.h"
 #include "memory/allocator.h"
 
-struct StringSetString {
-	uint16_t offset;
-	uint16_t length;
+#if defined(__SSE2__) && !defined(STRING_SET_SCALAR_PROBE)
+#include <emmintrin.h>
+#endif
+
+#define STRING_SET_EMPTY_SLOT 0x80
+#define STRING_SET_ENTRY_SIZE 16
+// The last byte of an entry holds the length of an inline string, the byte
+// before it is always zero and terminates the longest inline string
+#define STRING_SET_INLINE_LENGTH (STRING_SET_ENTRY_SIZE - 2)
+#define STRING_SET_LONG_ENTRY 0xff
+// all characters of a snapshot are in its first chunk
+#define STRING_SET_SNAPSHOT_CHUNK_SHIFT 31
+
+static const char snapshot_magic[8] = "DCCSSET";
+
+// Followed by the control bytes, entries, slots, hashes and the characters of
+// the long strings. The hash of a fixed string detects snapshots written with
+// another function.
+struct StringSetSnapshotHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t hash_check;
+	uint32_t num;
+	uint32_t num_groups;
+	uint64_t characters_size;
+};
+
+// Short strings are stored zero padded with their length in the last byte.
+// Long strings store the offset and length of their characters in the first
+// eight bytes and are marked in the last byte. The offset holds the chunk index
+// in its upper bits and the position inside of the chunk in its lower bits.
+struct StringSetEntry {
+	alignas(STRING_SET_ENTRY_SIZE) uint8_t bytes[STRING_SET_ENTRY_SIZE];
+};
+
+// The entry a string that is looked up would have, built in registers
+struct StringSetKey {
+	uint64_t low;
+	uint64_t high;
 };
 
-static uint32_t fnv1a(const char* string, int length)
+uint32_t hashString(const char* string)
+{
+	return hashBytes(string, strlen(string));
+}
+
+uint32_t hashSubstring(const char* string, int length)
+{
+	return hashBytes(string, length);
+}
+
+// Maximum load factor of the index table is 7/8
+static int groupCount(int max_strings)
+{
+	int num_groups = 2;
+	while (num_groups * STRING_SET_GROUP_SIZE * 7 < max_strings * 8) {
+		num_groups <<= 1;
+	}
+	return num_groups;
+}
+
+// Fibonacci hashing spreads weak hashes over the whole table. The upper bits
+// select the first group, the tag is taken from the middle.
+static inline uint64_t mixHash(uint32_t hash)
+{
+	return hash * 0x9e3779b97f4a7c15ull;
+}
+
+static inline uint32_t getGroup(const struct StringSet* stringset,
+                                uint64_t mixed)
+{
+	return mixed >> stringset->group_shift;
+}
+
+static inline uint8_t getTag(uint64_t mixed)
+{
+	return (mixed >> 32) & 0x7f;
+}
+
+#if defined(__SSE2__) && !defined(STRING_SET_SCALAR_PROBE)
+
+static inline uint32_t matchTag(const uint8_t* group, uint8_t tag)
+{
+	__m128i control = _mm_loadu_si128((const __m128i*)group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(tag)));
+}
+
+static inline uint32_t matchEmpty(const uint8_t* group)
+{
+	// only empty slots have the high bit set
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+
+static inline bool compareKey(const struct StringSetEntry* entry,
+                              const struct StringSetKey* key)
+{
+	__m128i stored = _mm_load_si128((const __m128i*)entry->bytes);
+	__m128i probe = _mm_set_epi64x(key->high, key->low);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(stored, probe)) == 0xffff;
+}
+
+#else
+
+static inline uint32_t matchTag(const uint8_t* group, uint8_t tag)
 {
-	uint32_t hash = 2166136261;
-	for (int i = 0; i < length; i++) {
-		hash ^= *string;
-		hash *= 16777619;
-		string++;
+	uint32_t mask = 0;
+	for (int i = 0; i < STRING_SET_GROUP_SIZE; i++) {
+		mask |= (uint32_t)(group[i] == tag) << i;
 	}
-	return hash;
+	return mask;
 }
 
-static uint32_t fnv1a_nullterminated(const char* string)
+static inline uint32_t matchEmpty(const uint8_t* group)
 {
-	uint32_t hash = 2166136261;
-	while (*string) {
-		hash ^= (int)*string;
-		hash *= 16777619;
-		string++;
+	uint32_t mask = 0;
+	for (int i = 0; i < STRING_SET_GROUP_SIZE; i++) {
+		mask |= (uint32_t)(group[i] >> 7) << i;
 	}
-	return hash;
+	return mask;
 }
 
-static uint32_t djb2(const char* string, int length)
+static inline bool compareKey(const struct StringSetEntry* entry,
+                              const struct StringSetKey* key)
 {
-	uint32_t hash = 5381;
-	for (int i = 0; i < length; i++) {
-		hash = ((hash << 5) + hash) ^ (int)*string;
-		string++;
+	uint64_t words[2];
+	memcpy(words, entry->bytes, sizeof(words));
+	return words[0] == key->low && words[1] == key->high;
+}
+
+#endif
+
+static inline bool isInlineLength(int length)
+{
+	return length <= STRING_SET_INLINE_LENGTH;
+}
+
+// The bytes past the end of the string stay zero, like in the entries
+static inline struct StringSetKey makeKey(const char* string, int length)
+{
+	struct StringSetKey key = {0, (uint64_t)STRING_SET_LONG_ENTRY << 56};
+	if (!isInlineLength(length)) {
+		return key;
 	}
-	return hash;
+	uint64_t words[2] = {0, 0};
+	memcpy(words, string, length);
+	// like the entries this assumes little endian byte order
+	key.low = words[0];
+	key.high = words[1] | (uint64_t)length << 56;
+	return key;
 }
 
-static uint32_t djb2_nullterminated(const char* string)
+static inline bool isInlineEntry(const struct StringSetEntry* entry)
 {
-	uint32_t hash = 5381;
-	while (*string) {
-		hash = ((hash << 5) + hash) ^ (int)*string;
-		string++;
+	return entry->bytes[STRING_SET_ENTRY_SIZE - 1] != STRING_SET_LONG_ENTRY;
+}
+
+static inline uint32_t getEntryLength(const struct StringSetEntry* entry)
+{
+	if (isInlineEntry(entry)) {
+		return entry->bytes[STRING_SET_ENTRY_SIZE - 1];
 	}
-	return hash;
+	uint32_t length;
+	memcpy(&length, entry->bytes + 4, sizeof(length));
+	return length;
 }
 
-uint32_t hashString(const char* string)
+static inline const char* getEntryString(const struct StringSet* stringset,
+                                         const struct StringSetEntry* entry)
 {
-	return djb2_nullterminated(string);
+	if (isInlineEntry(entry)) {
+		return (const char*)entry->bytes;
+	}
+	uint32_t offset;
+	memcpy(&offset, entry->bytes, sizeof(offset));
+	uint32_t chunk = offset >> stringset->chunk_shift;
+	uint32_t pos = offset & ((1u << stringset->chunk_shift) - 1);
+	return stringset->chunks[chunk] + pos;
 }
 
-uint32_t hashSubstring(const char* string, int length)
+// Segment i starts at index (2^i - 1) << segment_shift
+static inline uint32_t getSegment(const struct StringSet* stringset,
+                                  uint32_t index, uint32_t* pos)
 {
-	return djb2(string, length);
+	uint32_t block = (index >> stringset->segment_shift) + 1;
+	uint32_t segment = 31 - __builtin_clz(block);
+	*pos = index - (((1u << segment) - 1) << stringset->segment_shift);
+	return segment;
 }
 
-static int createString(struct StringSetString* string, const char* str,
-                        int length, char* string_buffer, int buffer_size,
-                        int offset)
+static inline struct StringSetEntry* getEntry(
+    const struct StringSet* stringset, uint32_t index)
 {
-	int new_offset = offset + length + 1;
-	if (new_offset >= buffer_size) {
+	uint32_t pos;
+	uint32_t segment = getSegment(stringset, index, &pos);
+	return &stringset->segments[segment].entries[pos];
+}
+
+static inline uint32_t* getHash(const struct StringSet* stringset,
+                                uint32_t index)
+{
+	uint32_t pos;
+	uint32_t segment = getSegment(stringset, index, &pos);
+	return &stringset->segments[segment].hashes[pos];
+}
+
+static int allocateIndexTable(struct StringSet* stringset, int num_groups)
+{
+	struct Allocator* allocator = stringset->parent_allocator;
+	int num_slots = num_groups * STRING_SET_GROUP_SIZE;
+	uint8_t* control =
+	    allocateAligned(allocator, num_slots, STRING_SET_GROUP_SIZE);
+	if (control == NULL) {
 		return -1;
 	}
-	string->length = length;
-	char* ptr = string_buffer + offset;
+	uint32_t* slots = ALLOCATE_TYPE(allocator, num_slots, uint32_t);
+	if (slots == NULL) {
+		deallocate(allocator, control);
+		return -1;
+	}
+	memset(control, STRING_SET_EMPTY_SLOT, num_slots);
+	stringset->control = control;
+	stringset->slots = slots;
+	stringset->group_mask = num_groups - 1;
+	stringset->group_shift = 64 - __builtin_ctz(num_groups);
+	return 0;
+}
 
-	string->offset = offset;
-	memcpy(ptr, str, length);
-	ptr[length] = 0;
-	return new_offset;
+static inline int getNumSlots(const struct StringSet* stringset)
+{
+	return (stringset->group_mask + 1) * STRING_SET_GROUP_SIZE;
 }
 
-static inline const char* getString(const struct StringSetString* string,
-                                    char* string_buffer)
+// Returns the slot that holds the string or the empty slot where it has to be
+// inserted. Groups are probed with triangular numbers, which visits every
+// group of a power of two sized table.
+static uint32_t findSlot(const struct StringSet* stringset,
+                         const struct StringSetKey* key, const char* string,
+                         int length, uint32_t hash, bool* found)
 {
-	return string_buffer + string->offset;
+	uint64_t mixed = mixHash(hash);
+	uint8_t tag = getTag(mixed);
+	uint32_t group = getGroup(stringset, mixed);
+	bool is_inline = isInlineLength(length);
+	for (uint32_t step = 1;; step++) {
+		const uint8_t* control =
+		    stringset->control + group * STRING_SET_GROUP_SIZE;
+		uint32_t matches = matchTag(control, tag);
+		while (matches != 0) {
+			uint32_t slot =
+			    group * STRING_SET_GROUP_SIZE + __builtin_ctz(matches);
+			uint32_t i = stringset->slots[slot];
+			const struct StringSetEntry* entry = getEntry(stringset, i);
+			bool equal =
+			    is_inline ? compareKey(entry, key)
+			              : !isInlineEntry(entry) &&
+			                    getEntryLength(entry) == (uint32_t)length &&
+			                    *getHash(stringset, i) == hash &&
+			                    memcmp(getEntryString(stringset, entry), string,
+			                           length) == 0;
+			if (equal) {
+				*found = true;
+				return slot;
+			}
+			matches &= matches - 1;
+		}
+		uint32_t empty = matchEmpty(control);
+		if (empty != 0) {
+			// strings are never removed, so the string can not be stored
+			// behind an empty slot
+			*found = false;
+			return group * STRING_SET_GROUP_SIZE + __builtin_ctz(empty);
+		}
+		group = (group + step) & stringset->group_mask;
+	}
 }
 
-static bool compareStrings(const struct StringSetString* string,
-                           const char* string2, int length2,
-                           struct StringSet* stringset)
+// Used for rehashing, where all strings are known to be distinct
+static uint32_t findEmptySlot(const struct StringSet* stringset, uint32_t hash)
 {
-	int length = string->length;
-	if (length != length2) {
-		return false;
+	uint32_t group = getGroup(stringset, mixHash(hash));
+	for (uint32_t step = 1;; step++) {
+		uint32_t empty =
+		    matchEmpty(stringset->control + group * STRING_SET_GROUP_SIZE);
+		if (empty != 0) {
+			return group * STRING_SET_GROUP_SIZE + __builtin_ctz(empty);
+		}
+		group = (group + step) & stringset->group_mask;
+	}
+}
+
+static void insertSlot(struct StringSet* stringset, uint32_t slot,
+                       uint32_t hash, int index)
+{
+	stringset->control[slot] = getTag(mixHash(hash));
+	stringset->slots[slot] = index;
+}
+
+static int growIndexTable(struct StringSet* stringset)
+{
+	uint8_t* old_control = stringset->control;
+	uint32_t* old_slots = stringset->slots;
+	uint32_t old_group_mask = stringset->group_mask;
+	int old_group_shift = stringset->group_shift;
+	if (allocateIndexTable(stringset, 2 * (old_group_mask + 1)) != 0) {
+		stringset->control = old_control;
+		stringset->slots = old_slots;
+		stringset->group_mask = old_group_mask;
+		stringset->group_shift = old_group_shift;
+		return -1;
 	}
-	const char* string1 = getString(string, stringset->string_buffer);
-	for (int i = 0; i < length; i++) {
-		if (*string1 != *string2) {
-			return false;
+	deallocate(stringset->parent_allocator, old_control);
+	deallocate(stringset->parent_allocator, old_slots);
+	for (int i = 0; i < stringset->num; i++) {
+		uint32_t hash = *getHash(stringset, i);
+		insertSlot(stringset, findEmptySlot(stringset, hash), hash, i);
+	}
+	return 0;
+}
+
+// Each segment is as large as all previous ones together
+static int addSegment(struct StringSet* stringset)
+{
+	struct Allocator* allocator = stringset->parent_allocator;
+	int segment = stringset->num_segments;
+	uint64_t size = (uint64_t)1 << (stringset->segment_shift + segment);
+	// indices have to fit into an int
+	if (segment == STRING_SET_MAX_SEGMENTS ||
+	    (uint64_t)stringset->max_num + size > INT32_MAX) {
+		return -1;
+	}
+	struct StringSetEntry* entries =
+	    ALLOCATE_TYPE(allocator, size, struct StringSetEntry);
+	if (entries == NULL) {
+		return -1;
+	}
+	uint32_t* hashes = ALLOCATE_TYPE(allocator, size, uint32_t);
+	if (hashes == NULL) {
+		deallocate(allocator, entries);
+		return -1;
+	}
+	stringset->segments[segment].entries = entries;
+	stringset->segments[segment].hashes = hashes;
+	stringset->num_segments++;
+	stringset->max_num += size;
+	return 0;
+}
+
+static void freeSegments(struct StringSet* stringset, int first)
+{
+	for (int i = first; i < stringset->num_segments; i++) {
+		deallocate(stringset->parent_allocator,
+		           stringset->segments[i].entries);
+		deallocate(stringset->parent_allocator, stringset->segments[i].hashes);
+	}
+	stringset->num_segments = first;
+	stringset->max_num = first == 0 ? 0 : 1 << stringset->segment_shift;
+}
+
+// Replaces an array by a larger copy. This also works for allocators which can
+// only reallocate their last allocation.
+static void* growArray(struct Allocator* allocator, void* array,
+                       size_t old_size, size_t new_size)
+{
+	void* new_array = allocateAligned(allocator, new_size, DEFAULT_ALIGNMENT);
+	if (new_array == NULL) {
+		return NULL;
+	}
+	memcpy(new_array, array, old_size);
+	deallocate(allocator, array);
+	return new_array;
+}
+
+static int addChunk(struct StringSet* stringset, size_t size)
+{
+	struct Allocator* allocator = stringset->parent_allocator;
+	if (stringset->num_chunks == stringset->max_chunks) {
+		// offsets are limited to 32 bits
+		if ((uint64_t)stringset->max_chunks * 2 << stringset->chunk_shift >
+		    ((uint64_t)1 << 32)) {
+			return -1;
+		}
+		int max_chunks = stringset->max_chunks;
+		char** chunks =
+		    growArray(allocator, stringset->chunks, sizeof(*chunks) * max_chunks,
+		              sizeof(*chunks) * max_chunks * 2);
+		if (chunks == NULL) {
+			return -1;
 		}
-		string1++;
-		string2++;
+		stringset->chunks = chunks;
+		stringset->max_chunks = max_chunks * 2;
 	}
-	return true;
+	char* chunk = allocateAligned(allocator, size, 1);
+	if (chunk == NULL) {
+		return -1;
+	}
+	stringset->chunks[stringset->num_chunks++] = chunk;
+	stringset->offset = 0;
+	return 0;
+}
+
+// Stores a copy of a long string in a chunk. Strings never move once they are
+// stored.
+static int createLongString(struct StringSet* stringset,
+                            struct StringSetEntry* entry, const char* str,
+                            int length)
+{
+	uint32_t chunk_size = 1u << stringset->chunk_shift;
+	uint32_t offset;
+	if ((uint32_t)length + 1 > chunk_size) {
+		// very long strings get a chunk of their own
+		if (addChunk(stringset, length + 1) != 0) {
+			return -1;
+		}
+		stringset->offset = chunk_size;
+		offset = (stringset->num_chunks - 1) << stringset->chunk_shift;
+	} else {
+		if (stringset->offset + length + 1 > chunk_size &&
+		    addChunk(stringset, chunk_size) != 0) {
+			return -1;
+		}
+		offset = ((stringset->num_chunks - 1) << stringset->chunk_shift) |
+		         stringset->offset;
+		stringset->offset += length + 1;
+	}
+	uint32_t size = length;
+	memset(entry->bytes, 0, STRING_SET_ENTRY_SIZE);
+	memcpy(entry->bytes, &offset, sizeof(offset));
+	memcpy(entry->bytes + 4, &size, sizeof(size));
+	entry->bytes[STRING_SET_ENTRY_SIZE - 1] = STRING_SET_LONG_ENTRY;
+	char* ptr = (char*)getEntryString(stringset, entry);
+	memcpy(ptr, str, length);
+	ptr[length] = 0;
+	return 0;
 }
 
 int initStringSet(struct StringSet* stringset, size_t string_buffer_size,
                   int max_strings, struct Allocator* allocator)
 {
+	memset(stringset, 0, sizeof(*stringset));
 	stringset->parent_allocator = allocator;
-	char* buffer = allocateAligned(allocator, string_buffer_size, 1);
-	if (buffer == NULL) {
+	stringset->chunk_shift = 4;
+	while ((1u << stringset->chunk_shift) < string_buffer_size) {
+		stringset->chunk_shift++;
+	}
+	while ((1 << stringset->segment_shift) < max_strings) {
+		stringset->segment_shift++;
+	}
+	stringset->max_chunks = 4;
+	stringset->chunks = ALLOCATE_TYPE(allocator, stringset->max_chunks, char*);
+	if (!stringset->chunks) {
 		return -1;
 	}
-	stringset->string_buffer = buffer;
-	stringset->buffer_size = string_buffer_size;
-	stringset->offset = 0;
-	stringset->num = 0;
-	stringset->max_num = max_strings;
-	stringset->strings =
-	    ALLOCATE_TYPE(allocator, max_strings, typeof(*stringset->strings));
-	if (!stringset->strings) {
+	if (addChunk(stringset, 1u << stringset->chunk_shift) != 0) {
 		goto err1;
 	}
-	stringset->hashes =
-	    ALLOCATE_TYPE(allocator, max_strings, typeof(*stringset->hashes));
-	if (!stringset->hashes) {
+	if (addSegment(stringset) != 0) {
 		goto err2;
 	}
+	if (allocateIndexTable(stringset, groupCount(stringset->max_num)) != 0) {
+		goto err3;
+	}
 	return 0;
 
+err3:
+	freeSegments(stringset, 0);
 err2:
-	deallocate(allocator, stringset->strings);
+	deallocate(allocator, stringset->chunks[0]);
 err1:
-	deallocate(allocator, stringset->string_buffer);
+	deallocate(allocator, stringset->chunks);
 	return -1;
 }
 
 int cleanupStringSet(struct StringSet* stringset)
 {
-	deallocate(stringset->parent_allocator, stringset->string_buffer);
-	deallocate(stringset->parent_allocator, stringset->strings);
-	deallocate(stringset->parent_allocator, stringset->hashes);
-	stringset->string_buffer = NULL;
-	stringset->strings = NULL;
-	stringset->hashes = NULL;
+	struct Allocator* allocator = stringset->parent_allocator;
+	for (int i = 0; i < stringset->num_chunks; i++) {
+		deallocate(allocator, stringset->chunks[i]);
+	}
+	freeSegments(stringset, 0);
+	deallocate(allocator, stringset->chunks);
+	deallocate(allocator, stringset->control);
+	deallocate(allocator, stringset->slots);
+	stringset->chunks = NULL;
+	stringset->control = NULL;
+	stringset->slots = NULL;
+	stringset->group_mask = 0;
+	stringset->num_chunks = 0;
+	stringset->max_chunks = 0;
 	stringset->offset = 0;
-	stringset->buffer_size = 0;
+	stringset->base = NULL;
+	stringset->base_num = 0;
 	stringset->num = 0;
-	stringset->max_num = 0;
 	return 0;
 }
 
+void resetStringSet(struct StringSet* stringset)
+{
+	// only the first chunk and segment are kept
+	for (int i = 1; i < stringset->num_chunks; i++) {
+		deallocate(stringset->parent_allocator, stringset->chunks[i]);
+	}
+	stringset->num_chunks = 1;
+	freeSegments(stringset, 1);
+	memset(stringset->control, STRING_SET_EMPTY_SLOT, getNumSlots(stringset));
+	stringset->offset = 0;
+	stringset->num = 0;
+}
+
+// Looks through the base layers first, they hold the lower indices
+static int lookup(const struct StringSet* stringset,
+                  const struct StringSetKey* key, const char* string,
+                  int length, uint32_t hash)
+{
+	if (stringset->base != NULL) {
+		int index = lookup(stringset->base, key, string, length, hash);
+		if (index >= 0) {
+			return index;
+		}
+	}
+	bool found;
+	uint32_t slot = findSlot(stringset, key, string, length, hash, &found);
+	return found ? stringset->base_num + (int)stringset->slots[slot] : -1;
+}
+
+static const struct StringSet* getLayer(const struct StringSet* stringset,
+                                        int* index)
+{
+	while (*index < stringset->base_num) {
+		stringset = stringset->base;
+	}
+	*index -= stringset->base_num;
+	return stringset;
+}
+
 int addStringAndHash(struct StringSet* stringset, const char* string,
                      int length, uint32_t hash, bool* exists)
 {
-	for (int i = 0; i < stringset->num; i++) {
-		if (stringset->hashes[i] == hash) {
-			if (compareStrings(&stringset->strings[i], string, length,
-			                   stringset)) {
-				if (exists != NULL) {
-					*exists = true;
-				}
-				return i;
+	struct StringSetKey key = makeKey(string, length);
+	if (stringset->base != NULL) {
+		int index = lookup(stringset->base, &key, string, length, hash);
+		if (index >= 0) {
+			if (exists != NULL) {
+				*exists = true;
 			}
+			return index;
+		}
+	}
+	bool found;
+	uint32_t slot = findSlot(stringset, &key, string, length, hash, &found);
+	if (found) {
+		if (exists != NULL) {
+			*exists = true;
 		}
+		return stringset->base_num + stringset->slots[slot];
 	}
 	if (exists != NULL) {
 		*exists = false;
 	}
 
-	if (stringset->num + 1 > stringset->max_num) {
+	if (stringset->num == stringset->max_num && addSegment(stringset) != 0) {
 		return -1;
 	}
-	int index = stringset->num++;
-	stringset->hashes[index] = hash;
-	int new_offset = createString(&stringset->strings[index], string, length,
-	                              stringset->string_buffer,
-	                              stringset->buffer_size, stringset->offset);
-	if (new_offset < 0) {
+	if ((stringset->num + 1) * 8 > getNumSlots(stringset) * 7) {
+		if (growIndexTable(stringset) != 0) {
+			return -1;
+		}
+		slot = findSlot(stringset, &key, string, length, hash, &found);
+	}
+	int index = stringset->num;
+	struct StringSetEntry* entry = getEntry(stringset, index);
+	if (isInlineLength(length)) {
+		uint64_t words[2] = {key.low, key.high};
+		memcpy(entry->bytes, words, STRING_SET_ENTRY_SIZE);
+	} else if (createLongString(stringset, entry, string, length) != 0) {
 		return -1;
 	}
-	stringset->offset = new_offset;
+	*getHash(stringset, index) = hash;
+	insertSlot(stringset, slot, hash, index);
+	stringset->num++;
 
-	return index;
+	return stringset->base_num + index;
 }
 
 int addString(struct StringSet* stringset, const char* string, int length)
 {
-	uint32_t hash = fnv1a(string, length);
+	uint32_t hash = hashSubstring(string, length);
 	return addStringAndHash(stringset, string, length, hash, NULL);
 }
 
 const char* getStringAt(struct StringSet* stringset, int index)
 {
-	return getString(&stringset->strings[index], stringset->string_buffer);
+	const struct StringSet* layer = getLayer(stringset, &index);
+	return getEntryString(layer, getEntry(layer, index));
 }
 
 uint32_t getHashAt(struct StringSet* stringset, int index)
 {
-	return stringset->hashes[index];
+	const struct StringSet* layer = getLayer(stringset, &index);
+	return *getHash(layer, index);
 }
 
 int getLengthAt(struct StringSet* stringset, int index)
 {
-	return stringset->strings[index].length;
+	const struct StringSet* layer = getLayer(stringset, &index);
+	return getEntryLength(getEntry(layer, index));
 }
 
 int findIndex(struct StringSet* stringset, const char* string, int length,
               uint32_t hash)
 {
-	for (int i = 0; i < stringset->num; i++) {
-		if (stringset->hashes[i] == hash) {
-			if (compareStrings(&stringset->strings[i], string, length,
-			                   stringset)) {
-				return i;
+	struct StringSetKey key = makeKey(string, length);
+	return lookup(stringset, &key, string, length, hash);
+}
+
+void setStringSetBase(struct StringSet* stringset,
+                      const struct StringSet* base)
+{
+	stringset->base = base;
+	stringset->base_num = getStringCount(base);
+}
+
+static uint32_t getSnapshotHashCheck(void)
+{
+	return hashBytes(snapshot_magic, sizeof(snapshot_magic));
+}
+
+// A flat copy has all entries in its first segment and all characters in
+// its first chunk, so the offsets of its long strings are positions in the
+// character section
+static int flattenStringSet(struct StringSet* stringset,
+                            struct StringSet* flat, size_t* characters_size)
+{
+	int num = getStringCount(stringset);
+	*characters_size = 0;
+	for (int i = 0; i < num; i++) {
+		int length = getLengthAt(stringset, i);
+		if (!isInlineLength(length)) {
+			*characters_size += length + 1;
+		}
+	}
+	if (*characters_size > (1u << STRING_SET_SNAPSHOT_CHUNK_SHIFT)) {
+		return -1;
+	}
+	if (initStringSet(flat, MAX(*characters_size, 1), num,
+	                  getGlobalAllocator()) != 0) {
+		return -1;
+	}
+	for (int i = 0; i < num; i++) {
+		if (addStringAndHash(flat, getStringAt(stringset, i),
+		                     getLengthAt(stringset, i),
+		                     getHashAt(stringset, i), NULL) != i) {
+			cleanupStringSet(flat);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static bool writeFlatStringSet(struct StringSet* flat, size_t characters_size,
+                               FILE* file)
+{
+	int num = getStringCount(flat);
+	struct StringSetSnapshotHeader header = {
+	    .version = STRING_SET_SNAPSHOT_VERSION,
+	    .hash_check = getSnapshotHashCheck(),
+	    .num = num,
+	    .num_groups = flat->group_mask + 1,
+	    .characters_size = characters_size,
+	};
+	memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+
+	size_t num_slots = getNumSlots(flat);
+	const struct StringSetSegment* segment = &flat->segments[0];
+	return fwrite(&header, sizeof(header), 1, file) == 1 &&
+	       fwrite(flat->control, 1, num_slots, file) == num_slots &&
+	       fwrite(segment->entries, STRING_SET_ENTRY_SIZE, num, file) ==
+	           (size_t)num &&
+	       fwrite(flat->slots, sizeof(*flat->slots), num_slots, file) ==
+	           num_slots &&
+	       fwrite(segment->hashes, sizeof(*segment->hashes), num, file) ==
+	           (size_t)num &&
+	       fwrite(flat->chunks[0], 1, characters_size, file) ==
+	           characters_size;
+}
+
+int writeStringSetSnapshotToFile(struct StringSet* stringset, FILE* file)
+{
+	struct StringSet flat;
+	size_t characters_size;
+	if (flattenStringSet(stringset, &flat, &characters_size) != 0) {
+		return -1;
+	}
+	bool written = writeFlatStringSet(&flat, characters_size, file);
+	cleanupStringSet(&flat);
+	return written ? 0 : -1;
+}
+
+int writeStringSetSnapshot(struct StringSet* stringset, const char* path)
+{
+	// the set may be layered on a snapshot mapped from the same path, so it
+	// is copied before the file is truncated
+	struct StringSet flat;
+	size_t characters_size;
+	if (flattenStringSet(stringset, &flat, &characters_size) != 0) {
+		return -1;
+	}
+	int result = -1;
+	FILE* file = fopen(path, "wb");
+	if (file != NULL) {
+		bool written = writeFlatStringSet(&flat, characters_size, file);
+		if (fclose(file) == 0 && written) {
+			result = 0;
+		}
+	}
+	cleanupStringSet(&flat);
+	return result;
+}
+
+int verifyStringSetSnapshot(const struct StringSetSnapshot* snapshot)
+{
+	const struct StringSet* set = &snapshot->set;
+	uint32_t characters_size = set->offset;
+	uint32_t num_slots = getNumSlots(set);
+	bool has_empty_slot = false;
+	for (uint32_t i = 0; i < num_slots; i++) {
+		if (set->control[i] == STRING_SET_EMPTY_SLOT) {
+			has_empty_slot = true;
+		} else if (set->slots[i] >= (uint32_t)set->num) {
+			return -1;
+		}
+	}
+	for (int i = 0; i < set->num; i++) {
+		const struct StringSetEntry* entry = &set->segments[0].entries[i];
+		if (isInlineEntry(entry)) {
+			if (entry->bytes[STRING_SET_ENTRY_SIZE - 1] >
+			    STRING_SET_INLINE_LENGTH) {
+				return -1;
 			}
+			continue;
+		}
+		uint32_t offset;
+		memcpy(&offset, entry->bytes, sizeof(offset));
+		uint32_t length = getEntryLength(entry);
+		if (offset >= characters_size || length >= characters_size - offset ||
+		    set->chunks[0][offset + length] != '\0') {
+			return -1;
 		}
 	}
-	return -1;
+	// probing stops at an empty slot
+	return has_empty_slot ? 0 : -1;
+}
+
+int viewStringSetSnapshot(struct StringSetSnapshot* snapshot,
+                          const unsigned char* data, size_t size)
+{
+	// entries are compared with aligned loads
+	const struct StringSetSnapshotHeader* header = (const void*)data;
+	if ((uintptr_t)data % 16 != 0 || size < sizeof(*header) ||
+	    memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+	    header->version != STRING_SET_SNAPSHOT_VERSION ||
+	    header->hash_check != getSnapshotHashCheck() ||
+	    header->num > INT32_MAX || header->num_groups == 0 ||
+	    (header->num_groups & (header->num_groups - 1)) != 0) {
+		return -1;
+	}
+	// the header and the control bytes are multiples of 16 bytes, which keeps
+	// the entries aligned
+	size_t num = header->num;
+	size_t num_slots = (size_t)header->num_groups * STRING_SET_GROUP_SIZE;
+	size_t control_offset = sizeof(*header);
+	size_t entries_offset = control_offset + num_slots;
+	size_t slots_offset = entries_offset + num * STRING_SET_ENTRY_SIZE;
+	size_t hashes_offset = slots_offset + num_slots * sizeof(uint32_t);
+	size_t characters_offset = hashes_offset + num * sizeof(uint32_t);
+	if (size != characters_offset + header->characters_size) {
+		return -1;
+	}
+
+	// the arrays point into the read only data, the set must never be
+	// modified
+	struct StringSet* set = &snapshot->set;
+	memset(set, 0, sizeof(*set));
+	snapshot->data = NULL;
+	snapshot->size = 0;
+	snapshot->characters = (char*)data + characters_offset;
+	set->chunks = &snapshot->characters;
+	set->num_chunks = 1;
+	set->max_chunks = 1;
+	set->chunk_shift = STRING_SET_SNAPSHOT_CHUNK_SHIFT;
+	set->offset = header->characters_size;
+	set->segments[0].entries = (struct StringSetEntry*)(data + entries_offset);
+	set->segments[0].hashes = (uint32_t*)(data + hashes_offset);
+	set->num_segments = 1;
+	while ((1u << set->segment_shift) < num) {
+		set->segment_shift++;
+	}
+	set->control = (unsigned char*)data + control_offset;
+	set->slots = (uint32_t*)(data + slots_offset);
+	set->group_mask = header->num_groups - 1;
+	set->group_shift = 64 - __builtin_ctz(header->num_groups);
+	set->num = num;
+	set->max_num = num;
+	return 0;
+}
+
+int loadStringSetSnapshot(struct StringSetSnapshot* snapshot,
+                          const char* path)
+{
+	struct MappedFile file;
+	if (mapFile(&file, path, SIZE_MAX) != 0) {
+		return -1;
+	}
+	if (viewStringSetSnapshot(snapshot, file.data, file.size) != 0) {
+		unmapFile(&file);
+		return -1;
+	}
+	snapshot->data = file.data;
+	snapshot->size = file.size;
+	return 0;
+}
+
+void unloadStringSetSnapshot(struct StringSetSnapshot* snapshot)
+{
+	struct MappedFile file = {snapshot->data, snapshot->size};
+	unmapFile(&file);
+	memset(snapshot, 0, sizeof(*snapshot));
 }
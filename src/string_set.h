@@ -19,30 +19,85 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 struct Allocator;
-struct StringSetString;
+struct StringSetEntry;
 
+#define STRING_SET_GROUP_SIZE 16
+#define STRING_SET_MAX_SEGMENTS 32
+
+#define STRING_SET_SNAPSHOT_VERSION 2
+
+// Entries and hashes of a range of indices
+struct StringSetSegment {
+	struct StringSetEntry* entries;
+	uint32_t* hashes;
+};
+
+// Strings are stored densely in insertion order, so the index of a string
+// never changes. A swiss table maps hashes to these indices: every slot has a
+// control byte that is either empty or holds a 7 bit tag of the hash, and a
+// lookup compares the tags of a whole group of slots at once using SSE2.
+//
+// Every string has a 16 byte entry. Short strings are stored inline in their
+// entry, so a candidate is compared with a single 128 bit compare. Only long
+// strings are stored out of line in chunks.
+//
+// The set grows on demand: the entries live in segments of doubling size and
+// the long strings in fixed chunks, neither is ever moved. Pointers returned
+// by getStringAt stay valid until the set is reset.
+//
+// A set can be layered on top of a read only base set, usually a snapshot
+// loaded from disk. The base keeps the indices below base_num, new strings
+// are added to the upper set and numbered after them.
 struct StringSet {
 	struct Allocator* parent_allocator;
-	char* string_buffer;
-	struct StringSetString* strings;
-	uint32_t* hashes;
-	int offset;
-	int buffer_size;
+	const struct StringSet* base;
+	int base_num;
+	struct StringSetSegment segments[STRING_SET_MAX_SEGMENTS];
+	char** chunks;
+	uint8_t* control;
+	uint32_t* slots;
+	uint32_t group_mask;
+	int group_shift;
+	// the first segment has 2^segment_shift entries
+	int segment_shift;
+	int num_segments;
+	int chunk_shift;
+	int num_chunks;
+	int max_chunks;
+	// write position in the last chunk
+	uint32_t offset;
+	// strings in this layer, without the base
 	int num;
+	// capacity of the allocated segments
 	int max_num;
 };
 
+// A string set mapped read only from a file. Loading it only validates the
+// header, its contents are trusted unless it is verified.
+struct StringSetSnapshot {
+	struct StringSet set;
+	const unsigned char* data;
+	size_t size;
+	char* characters;
+};
+
 uint32_t hashString(const char* string);
 
 uint32_t hashSubstring(const char* string, int length);
 
+// The buffer size is rounded up to a power of two and used as chunk size for
+// long strings. The number of strings is only an initial capacity.
 int initStringSet(struct StringSet* stringset, size_t string_buffer_size,
                   int max_strings, struct Allocator* allocator);
 
 int cleanupStringSet(struct StringSet* stringset);
 
+// Removes all strings but keeps the memory for reuse
+void resetStringSet(struct StringSet* stringset);
+
 int addStringAndHash(struct StringSet* stringset, const char* string,
                      int length, uint32_t hash, bool* exists);
 
@@ -57,4 +112,39 @@ uint32_t getHashAt(struct StringSet* stringset, int index);
 int findIndex(struct StringSet* stringset, const char* string, int length,
               uint32_t hash);
 
+static inline int getStringCount(const struct StringSet* stringset)
+{
+	return stringset->base_num + stringset->num;
+}
+
+// Layers an empty set on top of the base, which has to outlive it. The base
+// is never modified.
+void setStringSetBase(struct StringSet* stringset,
+                      const struct StringSet* base);
+
+// Writes all strings of the set including its base. A snapshot keeps the
+// indices of the set.
+int writeStringSetSnapshot(struct StringSet* stringset, const char* path);
+
+// Writes a snapshot at the current position of an open file. The position has
+// to be a multiple of 16 bytes for the snapshot to be mapped again.
+int writeStringSetSnapshotToFile(struct StringSet* stringset, FILE* file);
+
+// Fails if the file was written by a different version or with a different
+// hash function
+int loadStringSetSnapshot(struct StringSetSnapshot* snapshot,
+                          const char* path);
+
+// Uses a snapshot that is part of a larger mapping. The data has to be aligned
+// to 16 bytes, it is not owned by the snapshot and has to outlive it.
+int viewStringSetSnapshot(struct StringSetSnapshot* snapshot,
+                          const unsigned char* data, size_t size);
+
+// Checks the slots and the entries against the size of the snapshot's arrays
+// in linear time, the strings are not hashed again. Needed before untrusted
+// data is looked up.
+int verifyStringSetSnapshot(const struct StringSetSnapshot* snapshot);
+
+void unloadStringSetSnapshot(struct StringSetSnapshot* snapshot);
+
 #endif
@@ -0,0 +1,318 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "token_paste.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "error.h"
+#include "helper.h"
+#include "lexer.h"
+#include "string_set.h"
+
+static const char* const punctuator_spellings[] = {
+    [PUNCTUATOR_PLUS] = "+",
+    [PUNCTUATOR_MINUS] = "-",
+    [PUNCTUATOR_DIV] = "/",
+    [PUNCTUATOR_MODULO] = "%",
+    [PUNCTUATOR_PLUSPLUS] = "++",
+    [PUNCTUATOR_MINUSMINUS] = "--",
+    [PUNCTUATOR_AND] = "&",
+    [PUNCTUATOR_OR] = "|",
+    [PUNCTUATOR_XOR] = "^",
+    [PUNCTUATOR_SHIFT_LEFT] = "<<",
+    [PUNCTUATOR_SHIFT_RIGHT] = ">>",
+    [PUNCTUATOR_NEGATE] = "~",
+    [PUNCTUATOR_LOGICAL_AND] = "&&",
+    [PUNCTUATOR_LOGICAL_OR] = "||",
+    [PUNCTUATOR_LOGICAL_NOT] = "!",
+    [PUNCTUATOR_EQUAL] = "==",
+    [PUNCTUATOR_NOT_EQUAL] = "!=",
+    [PUNCTUATOR_LESS] = "<",
+    [PUNCTUATOR_GREATER] = ">",
+    [PUNCTUATOR_LESS_OR_EQUAL] = "<=",
+    [PUNCTUATOR_GREATER_OR_EQUAL] = ">=",
+    [PUNCTUATOR_ASSIGNMENT] = "=",
+    [PUNCTUATOR_PLUS_ASSIGNMENT] = "+=",
+    [PUNCTUATOR_MINUS_ASSIGNMENT] = "-=",
+    [PUNCTUATOR_MUL_ASSIGNMENT] = "*=",
+    [PUNCTUATOR_DIV_ASSIGNMENT] = "/=",
+    [PUNCTUATOR_MODULO_ASSIGNMENT] = "%=",
+    [PUNCTUATOR_AND_ASSIGNMENT] = "&=",
+    [PUNCTUATOR_OR_ASSIGNMENT] = "|=",
+    [PUNCTUATOR_XOR_ASSIGNMENT] = "^=",
+    [PUNCTUATOR_SHIFT_LEFT_ASSIGNMENT] = "<<=",
+    [PUNCTUATOR_SHIFT_RIGHT_ASSIGNMENT] = ">>=",
+    [PUNCTUATOR_POINT] = ".",
+    [PUNCTUATOR_DEREFERENCE] = "->",
+    [PUNCTUATOR_CONDITIONAL] = "?",
+    [PUNCTUATOR_PARENTHESE_LEFT] = "(",
+    [PUNCTUATOR_PARENTHESE_RIGHT] = ")",
+    [PUNCTUATOR_BRACKET_LEFT] = "[",
+    [PUNCTUATOR_BRACKET_RIGHT] = "]",
+    [PUNCTUATOR_BRACE_LEFT] = "{",
+    [PUNCTUATOR_BRACE_RIGHT] = "}",
+    [PUNCTUATOR_ASTERISC] = "*",
+    [PUNCTUATOR_COMMA] = ",",
+    [PUNCTUATOR_COLON] = ":",
+    [PUNCTUATOR_SEMICOLON] = ";",
+    [PP_CONCAT] = "##",
+    [PP_STRINGIFY] = "#",
+};
+
+#define NUM_SPELLINGS \
+	(int)(sizeof(punctuator_spellings) / sizeof(punctuator_spellings[0]))
+
+static bool append(char* buffer, int size, int* length, const char* string,
+                   int string_length)
+{
+	if (*length + string_length > size) {
+		return false;
+	}
+	memcpy(buffer + *length, string, string_length);
+	*length += string_length;
+	return true;
+}
+
+// Appends a character of a literal as it is written in the source
+static bool appendEscaped(char* buffer, int size, int* length,
+                          unsigned char c, char quote)
+{
+	char escaped[8];
+	int escaped_length = 0;
+	if (c == quote || c == '\\') {
+		escaped[escaped_length++] = '\\';
+		escaped[escaped_length++] = c;
+	} else if (c == '\n') {
+		escaped_length = sprintf(escaped, "\\n");
+	} else if (c == '\t') {
+		escaped_length = sprintf(escaped, "\\t");
+	} else if (c < 0x20 || c == 0x7f) {
+		escaped_length = sprintf(escaped, "\\%03o", c);
+	} else {
+		escaped[escaped_length++] = c;
+	}
+	return append(buffer, size, length, escaped, escaped_length);
+}
+
+static int spellCharacterConstant(int character, char* buffer, int size)
+{
+	int length = 0;
+	if (!append(buffer, size, &length, "'", 1)) {
+		return -1;
+	}
+	// multi character constants hold the first character in the highest byte
+	int shift = 24;
+	while (shift > 0 && ((unsigned int)character >> shift) == 0) {
+		shift -= 8;
+	}
+	for (; shift >= 0; shift -= 8) {
+		unsigned char c = (unsigned int)character >> shift;
+		if (!appendEscaped(buffer, size, &length, c, '\'')) {
+			return -1;
+		}
+	}
+	return append(buffer, size, &length, "'", 1) ? length : -1;
+}
+
+static int spellStringLiteral(const char* string, int string_length,
+                              char* buffer, int size)
+{
+	int length = 0;
+	if (!append(buffer, size, &length, "\"", 1)) {
+		return -1;
+	}
+	for (int i = 0; i < string_length; i++) {
+		if (!appendEscaped(buffer, size, &length, string[i], '"')) {
+			return -1;
+		}
+	}
+	return append(buffer, size, &length, "\"", 1) ? length : -1;
+}
+
+int spellPPToken(struct PreprocessorState* state,
+                 const struct PreprocessorToken* token, char* buffer,
+                 int size)
+{
+	int type = token->type;
+	int length = 0;
+	const char* spelling = NULL;
+	char number[32];
+	if (type <= KEYWORD_CONSTEVAL) {
+		// keywords keep the identifier index of their name
+		spelling = getIdentifierName(state->identifiers, token->value_handle);
+	} else if (type == PP_NUMBER) {
+		spelling = getStringAt(state->pp_numbers, token->value_handle);
+	} else if (type == LITERAL_STRING) {
+		return spellStringLiteral(
+		    getStringAt(state->string_literals, token->value_handle),
+		    getLengthAt(state->string_literals, token->value_handle), buffer,
+		    size);
+	} else if (type >= CONSTANT_CHAR && type <= CONSTANT_DOUBLE) {
+		const struct LexerConstant* constant =
+		    &state->constants->constants[token->value_handle];
+		if (type == CONSTANT_CHAR || type == CONSTANT_UNSIGNED_CHAR) {
+			return spellCharacterConstant(constant->character_literal,
+			                              buffer, size);
+		} else if (type == CONSTANT_INT) {
+			sprintf(number, "%" PRIu64, constant->int_literal);
+		} else if (type == CONSTANT_UNSIGNED_INT) {
+			sprintf(number, "%" PRIu64 "u", constant->int_literal);
+		} else if (type == CONSTANT_FLOAT) {
+			sprintf(number, "%.9gf", constant->float_literal);
+		} else {
+			sprintf(number, "%.17g", constant->double_literal);
+		}
+		spelling = number;
+	} else if (type < NUM_SPELLINGS) {
+		spelling = punctuator_spellings[type];
+	}
+	if (spelling == NULL) {
+		return -1;
+	}
+	return append(buffer, size, &length, spelling, strlen(spelling)) ? length
+	                                                                 : -1;
+}
+
+static bool isPPNumber(const char* spelling, int length)
+{
+	if (!isDecimalDigit(spelling[0]) &&
+	    !(spelling[0] == '.' && length > 1 && isDecimalDigit(spelling[1]))) {
+		return false;
+	}
+	for (int i = 1; i < length; i++) {
+		char c = spelling[i];
+		char previous = spelling[i - 1];
+		bool is_sign = (c == '+' || c == '-') &&
+		               (previous == 'e' || previous == 'E' ||
+		                previous == 'p' || previous == 'P');
+		if (!isAlphaNumeric(c) && c != '.' && !is_sign) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool isIdentifier(const char* spelling, int length)
+{
+	if (!isAlphabetic(spelling[0])) {
+		return false;
+	}
+	for (int i = 1; i < length; i++) {
+		if (!isAlphaNumeric(spelling[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Lexes a spelling which has to form exactly one token
+static bool relexToken(struct PreprocessorState* state, const char* spelling,
+                       int length, struct PreprocessorToken* result)
+{
+	result->flags = 0;
+	if (isIdentifier(spelling, length)) {
+		int index = internIdentifier(state->identifiers, spelling, length,
+		                             hashSubstring(spelling, length));
+		if (index < 0) {
+			return false;
+		}
+		result->type = getIdentifierInfo(state->identifiers, index)->keyword;
+		result->value_handle = index;
+		return true;
+	} else if (isPPNumber(spelling, length)) {
+		int index = addString(state->pp_numbers, spelling, length);
+		if (index < 0) {
+			generalError("Could not allocate number");
+			return false;
+		}
+		result->type = PP_NUMBER;
+		result->value_handle = index;
+		return true;
+	}
+	for (int type = 0; type < NUM_SPELLINGS; type++) {
+		const char* punctuator = punctuator_spellings[type];
+		if (punctuator != NULL && (int)strlen(punctuator) == length &&
+		    memcmp(punctuator, spelling, length) == 0) {
+			result->type = type;
+			result->value_handle = 0;
+			return true;
+		}
+	}
+	generalError("Pasting does not give a valid preprocessing token");
+	return false;
+}
+
+bool pastePPTokens(struct PreprocessorState* state,
+                   const struct PreprocessorToken* left,
+                   const struct PreprocessorToken* right,
+                   struct PreprocessorToken* result)
+{
+	char* buffer = state->paste_buffer;
+	int size = PREPROCESSOR_PASTE_BUFFER_SIZE;
+	int left_length = spellPPToken(state, left, buffer, size);
+	int right_length = -1;
+	if (left_length >= 0) {
+		right_length = spellPPToken(state, right, buffer + left_length,
+		                            size - left_length);
+	}
+	if (right_length < 0) {
+		generalError("Token can not be pasted");
+		return false;
+	}
+	*result = *left;
+	return relexToken(state, buffer, left_length + right_length, result);
+}
+
+bool stringifyPPTokens(struct PreprocessorState* state,
+                       const struct PreprocessorToken* tokens, int num_tokens,
+                       struct PreprocessorToken* result)
+{
+	char* buffer = state->paste_buffer;
+	int size = PREPROCESSOR_PASTE_BUFFER_SIZE;
+	int length = 0;
+	int previous_end = -1;
+	for (int i = 0; i < num_tokens; i++) {
+		const struct PreprocessorToken* token = &tokens[i];
+		bool adjacent = i > 0 && token->line == tokens[i - 1].line &&
+		                token->column == previous_end;
+		if (i > 0 && !adjacent && !append(buffer, size, &length, " ", 1)) {
+			break;
+		}
+		int token_length =
+		    spellPPToken(state, token, buffer + length, size - length);
+		if (token_length < 0) {
+			generalError("Argument can not be stringified");
+			return false;
+		}
+		length += token_length;
+		previous_end = token->column + token_length;
+	}
+	if (length == size) {
+		generalError("Stringified argument is too long");
+		return false;
+	}
+	int index = addString(state->string_literals, buffer, length);
+	if (index < 0) {
+		generalError("Could not allocate string");
+		return false;
+	}
+	result->type = LITERAL_STRING;
+	result->value_handle = index;
+	result->flags = 0;
+	return true;
+}
@@ -0,0 +1,43 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TOKEN_PASTE_H
+#define TOKEN_PASTE_H
+
+#include <stdbool.h>
+
+#include "cpp.h"
+
+// Writes the spelling of a token without a terminating zero. Returns its
+// length or -1 if the token has no spelling or does not fit.
+int spellPPToken(struct PreprocessorState* state,
+                 const struct PreprocessorToken* token, char* buffer,
+                 int size);
+
+// Joins the spellings of both tokens in the paste buffer and lexes them again
+// as a single token. Identifiers and numbers are interned directly from the
+// buffer.
+bool pastePPTokens(struct PreprocessorState* state,
+                   const struct PreprocessorToken* left,
+                   const struct PreprocessorToken* right,
+                   struct PreprocessorToken* result);
+
+// Creates the string literal of the # operator. Tokens that were separated
+// in the source are separated by a single space.
+bool stringifyPPTokens(struct PreprocessorState* state,
+                       const struct PreprocessorToken* tokens, int num_tokens,
+                       struct PreprocessorToken* result);
+
+#endif
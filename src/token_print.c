@@ -129,11 +129,13 @@ static const char* getTokenName(enum TokenType type)
 		RETURN_AS_STRING_IF_MATCH(CONSTANT_UNSIGNED_INT)
 		RETURN_AS_STRING_IF_MATCH(CONSTANT_FLOAT)
 		RETURN_AS_STRING_IF_MATCH(CONSTANT_DOUBLE)
+		RETURN_AS_STRING_IF_MATCH(LITERAL_EMBED)
 		/*preprocessor*/
 		RETURN_AS_STRING_IF_MATCH(PP_NUMBER)
 		RETURN_AS_STRING_IF_MATCH(PP_PARAM)
 		RETURN_AS_STRING_IF_MATCH(PP_CONCAT)
 		RETURN_AS_STRING_IF_MATCH(PP_STRINGIFY)
+		RETURN_AS_STRING_IF_MATCH(PP_VA_OPT)
 		// end of file
 		RETURN_AS_STRING_IF_MATCH(TOKEN_EOF)
 		RETURN_AS_STRING_IF_MATCH(TOKEN_UNKNOWN)
@@ -153,7 +155,7 @@ void printToken(struct LexerState* state, const struct LexerToken* token)
 			    "line:%d, column: %d, type: IDENTIFIER, id:%d, name: "
 			    "\"%s\"\n",
 			    token->line + 1, token->column + 1, index,
-			    getStringAt(&state->identifiers, index));
+			    getIdentifierName(&state->identifiers, index));
 			break;
 		}
 		case PP_PARAM: {
@@ -173,6 +175,16 @@ void printToken(struct LexerState* state, const struct LexerToken* token)
 			    getStringAt(&state->string_literals, index));
 			break;
 		}
+		case LITERAL_EMBED: {
+			size_t size;
+			getEmbeddedData(state, token, &size);
+			printf(
+			    "line:%d, column: %d, type: LITERAL_EMBED, id:%d, size: "
+			    "%zu\n",
+			    token->line + 1, token->column + 1, token->value.embed_index,
+			    size);
+			break;
+		}
 		case PP_NUMBER: {
 			int index = token->value.string_index;
 			printf(
@@ -229,7 +241,7 @@ void printTokenAsCStruct(struct LexerState* state,
 			    "{.line = %d, .column = %d, .type = IDENTIFIER, "
 			    ".string_value= \"%s\"\n},",
 			    token->line + 1, token->column + 1,
-			    getStringAt(&state->identifiers, index));
+			    getIdentifierName(&state->identifiers, index));
 			break;
 		}
 		case PP_PARAM: {
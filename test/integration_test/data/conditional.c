@@ -0,0 +1,121 @@
+#define ENABLED
+#define VALUE 1
+
+#if 1
+int if_taken;
+#else
+int if_skipped;
+#endif
+
+#if 0
+int zero_skipped;
+#elif 1
+int elif_taken;
+#else
+int else_skipped;
+#endif
+
+#ifdef ENABLED
+int ifdef_taken;
+#endif
+#ifndef ENABLED
+int ifndef_skipped;
+#elifdef VALUE
+int elifdef_taken;
+#endif
+
+# if !defined(MISSING)
+int not_defined_taken;
+#  else
+int not_defined_skipped;
+# endif
+
+#if defined MISSING
+#if 1
+int nested_skipped;
+#else
+int nested_else_skipped;
+#endif
+#elifndef MISSING
+int elifndef_taken;
+#endif
+
+#if 0
+/* a comment that looks like a directive
+#endif
+*/
+const char* string = "/* not a comment";
+char quote = '"';
+// #endif in a line comment \
+#endif in its continuation
+the apostrophe in this line isn't a problem
+this line is long enough to be skipped by the vector loop, line \
+#endif
+int skipped_to_the_end;
+#else
+int else_after_comments_taken;
+#endif
+
+#if 0
+/* C:\*/
+int backslash_skipped;
+#else
+int backslash_in_comment_taken;
+#endif
+
+#if UNDEFINED_NAME
+int undefined_skipped;
+#elif 0
+int second_elif_skipped;
+#else
+int last_else_taken;
+#endif
+#define PRODUCT(a, b) ((a) * (b))
+#if VALUE + 2 * 3 == 7 && PRODUCT(VALUE + 1, 3) == 6
+int arithmetic_taken;
+#endif
+#if -1 > 0u && 18446744073709551615 == -1 && 'a' == 97
+int conversions_taken;
+#endif
+#if (2 << 3) == 16 && (-16 >> 2) == -4 && 7 % 4 == 3 && (~0 & 0xff) == 255 \
+    && (5 ^ 1) == 4 && (4 | 1) == 5 && 7 / 2 == 3 && 3 - 5 == -2
+int bit_operators_taken;
+#endif
+#if 0 && 1 / 0
+int short_circuit_skipped;
+#elif 1 || 1 % 0
+int short_circuit_taken;
+#endif
+#if (1 ? 2 : 1 / 0) == 2 && (0 ? 1 : 0 ? 2 : 3) == 3 && (1 ? 0 ? 5 : 6 : 7) == 6
+int conditional_operator_taken;
+#endif
+#if defined(VALUE) && !defined MISSING && UNDEFINED_NAME == 0 && !(1 >= 2)
+int defined_taken;
+#endif
+
+#define UNDEF_VALUE 2
+#define UNDEF_USER UNDEF_VALUE
+#if UNDEF_USER == 2
+#undef UNDEF_VALUE
+#undef MISSING
+#endif
+#ifdef UNDEF_VALUE
+int undef_skipped;
+#elif !defined(UNDEF_VALUE) && UNDEF_USER == 0
+#ifndef UNDEF_VALUE
+int undef_taken;
+#endif
+#endif
+#define UNDEF_VALUE 3
+#if UNDEF_USER == 3
+int redefined_after_undef_taken;
+#endif
+
+#if 0
+int crlf_skipped;
+#else
+int crlf_taken;
+#endif
+#ifdef ENABLED
+int last_line_taken;
+#endif
\ No newline at end of file
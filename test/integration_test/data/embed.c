@@ -0,0 +1,5 @@
+#embed "embed.bin"
+#embed "embed.bin" limit(5) prefix(1, ) suffix(, 0)
+#embed "empty.bin" if_empty(0) prefix(1)
+#embed <embed.bin> __limit__(0) if_empty(-1) prefix(x)
+int end;
@@ -0,0 +1,148 @@
+#define foo foo bar
+#define x y
+#define y x
+#define f(a) a + f
+#define g(a) f(a) * g
+#define id(a) a
+#define nested(a) id(a) + nested(a)
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define call(f, x) f(x)
+#define apply(f, x) f x
+#define zero() 0
+#define use_zero zero() + 1
+#define f2(a) a * g2
+#define g2(a) f2(a)
+#define rescan f2(2)(9)
+#define PAGE_SIZE (1 << 12)
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define wrap_y y
+#define uses_later later + 1
+#define q(x) x
+#define LPAREN (
+#define INV q LPAREN 3 )
+#define wrap_inv INV
+#define cat(a, b) a ## b
+#define xcat(a, b) cat(a, b)
+#define str(a) #a
+#define xstr(a) str(a)
+#define suffix(a) a##_suffix
+#define op_assign(op) op ## =
+#define prefix page
+#define object_paste page ## _size
+#define LOG(fmt, ...) impl(fmt, __VA_ARGS__)
+#define impl(fmt, a, b) fmt + a + b
+#define forward(...) max(__VA_ARGS__)
+#define first(a, ...) a
+#define rest(a, ...) __VA_ARGS__
+#define opt(fmt, ...) print(fmt __VA_OPT__(, ) __VA_ARGS__)
+#define opt_impl(fmt, ...) impl(fmt __VA_OPT__(, ) __VA_ARGS__)
+#define count(...) sizeof((int[]){0 __VA_OPT__(, ) __VA_ARGS__})
+#define show(...) #__VA_ARGS__
+#define pair 1, 2
+#define wrap(a) max(a)
+#define nothing
+#define F G
+#define G(x) x + 1
+#define CALL(fn) fn
+#define X(a) (a)
+#define O1 X(
+
+// a macro is not expanded again while its replacement is rescanned
+int self = foo;
+int indirect = x + y;
+int function = f(1);
+int through_other = g(2);
+// but it is expanded in its arguments
+int argument = id(id(3));
+int argument_recursion = f(f(4));
+int nested_argument = nested(nested(5));
+// arguments are expanded once and shared by all uses
+int nested_max = max(max(1, 2), max(3, 4));
+int empty_argument = id() 6;
+int no_arguments = use_zero;
+int top_level_no_arguments = zero();
+// a function like macro name without arguments is an identifier
+int name_only = id;
+int name_followed = id + 7;
+// unless the arguments follow the name after the expansion
+int passed_function = call(id, 8);
+int passed_name = apply(max, (9, 10));
+int rescanned_arguments = rescan;
+int arguments_in_input = F(3);
+int name_in_input = F + 1;
+int returned_name = CALL(q)(7);
+int arguments_continued = O1 5);
+// expansions of object like macros are reused until a macro they depend on
+// is redefined
+int page_size = PAGE_SIZE;
+int page_mask = PAGE_MASK;
+int page_mask_again = PAGE_MASK;
+#define PAGE_SIZE (1 << 13)
+int redefined_page_mask = PAGE_MASK;
+int before_definition = uses_later;
+#define later 2
+int after_definition = uses_later;
+// and only if the context does not hide a macro they depend on
+int cached_indirect = wrap_y + x;
+// the reused tokens are not rescanned
+int not_rescanned = INV;
+int not_rescanned_again = INV;
+int not_rescanned_inside = wrap_inv;
+// the operands of ## and # are not expanded, the results are rescanned
+int pasted = cat(pa, ste);
+int pasted_number = cat(1, 02);
+int pasted_name = cat(PAGE, _SIZE);
+int not_expanded = cat(prefix, _size);
+int expanded_first = xcat(prefix, _size);
+int suffix(value) = 14;
+int empty_operand = cat(, 11) + cat(12, );
+int both_empty = cat(,) 13;
+int assigned = 1 op_assign(<<) 2;
+unsigned long keyword = cat(size, of)(int);
+int object_like = object_paste;
+const char* stringified = str( a  +  b "s\n" 'c' );
+const char* adjacent = str(f(x)+1);
+const char* empty_string = str();
+const char* line_break = str(a
+                             b);
+const char* expanded_string = xstr(PAGE_SIZE);
+// the variable arguments form the last argument, including their commas
+int forwarded = LOG(1, 2, 3);
+int forwarded_variadic = forward(4, 5);
+int first_argument = first(6, 7, 8);
+int left_out = first(9);
+int rest_arguments = rest(1, 2, 3);
+int with_arguments = opt(f, 10, 11);
+int without_arguments = opt(g);
+int separated_option = opt_impl(1, 2, 3);
+int expands_to_nothing = count(nothing);
+unsigned long counted = count(a, b);
+const char* shown = show(a, b,c);
+// substituted arguments are separated again
+int separated = wrap(pair);
+// the example of C11 6.10.3.5, which reads arguments across expansions
+#undef x
+#undef y
+#undef f
+#undef g
+#undef q
+#undef str
+#define x 3
+#define f(a) f(x * (a))
+#undef x
+#define x 2
+#define g f
+#define z z[0]
+#define h g(~
+#define m(a) a(w)
+#define w 0,1
+#define t(a) a
+#define p() int
+#define q(x) x
+#define r(x,y) x ## y
+#define str(x) # x
+f(y+1) + f(f(z)) % t(t(g)(0) + t)(1);
+g(x+(3,4)-w) | h 5) & m
+    (f)^m(m);
+p() i[q()] = { q(1), r(2,3), r(4,), r(,5), r(,) };
+char c[2][6] = { str(hello), str() };
@@ -0,0 +1,63 @@
+int self = foo bar;
+int indirect = x + y;
+int function = 1 + f;
+int through_other = 2 + f * g;
+int argument = 3;
+int argument_recursion = 4 + f + f;
+int nested_argument = 5 + nested(5) + nested(5 + nested(5));
+int nested_max = ((((1) > (2) ? (1) : (2))) > (((3) > (4) ? (3) : (4))) ?
+                  (((1) > (2) ? (1) : (2))) : (((3) > (4) ? (3) : (4))));
+int empty_argument = 6;
+int no_arguments = 0 + 1;
+int top_level_no_arguments = 0;
+int name_only = id;
+int name_followed = id + 7;
+int passed_function = 8;
+int passed_name = ((9) > (10) ? (9) : (10));
+int rescanned_arguments = 2 * 9 * g2;
+int arguments_in_input = 3 + 1;
+int name_in_input = G + 1;
+int returned_name = 7;
+int arguments_continued = (5);
+int page_size = (1 << 12);
+int page_mask = ((1 << 12) - 1);
+int page_mask_again = ((1 << 12) - 1);
+int redefined_page_mask = ((1 << 13) - 1);
+int before_definition = later + 1;
+int after_definition = 2 + 1;
+int cached_indirect = y + x;
+int not_rescanned = q ( 3 );
+int not_rescanned_again = q ( 3 );
+int not_rescanned_inside = q ( 3 );
+int pasted = paste;
+int pasted_number = 102;
+int pasted_name = (1 << 13);
+int not_expanded = prefix_size;
+int expanded_first = page_size;
+int value_suffix = 14;
+int empty_operand = 11 + 12;
+int both_empty = 13;
+int assigned = 1 <<= 2;
+unsigned long keyword = sizeof(int);
+int object_like = page_size;
+const char* stringified = "a + b \"s\\n\" 'c'";
+const char* adjacent = "f(x)+1";
+const char* empty_string = "";
+const char* line_break = "a b";
+const char* expanded_string = "(1 << 13)";
+int forwarded = 1 + 2 + 3;
+int forwarded_variadic = ((4) > (5) ? (4) : (5));
+int first_argument = 6;
+int left_out = 9;
+int rest_arguments = 2, 3;
+int with_arguments = print(f, 10, 11);
+int without_arguments = print(g);
+int separated_option = 1 + 2 + 3;
+int expands_to_nothing = sizeof((int[]){0});
+unsigned long counted = sizeof((int[]){0, a, b});
+const char* shown = "a, b,c";
+int separated = ((1) > (2) ? (1) : (2));
+f(2 * (y+1)) + f(2 * (f(2 * (z[0])))) % f(2 * (0)) + t(1);
+f(2 * (2+(3,4)-0,1)) | f(2 * (~ 5)) & f(2 * (0,1))^m(0,1);
+int i[] = { 1, 23, 4, 5, };
+char c[2][6] = { "hello", "" };
@@ -0,0 +1,16 @@
+#include "include/nested.h"
+int a;
+#include <angled.h> // comment
+#include <order.h>
+#include "include/empty.h"
+int b;
+#include "include/guarded.h"
+#include "include/guarded.h"
+#include "include/unguarded.h"
+#include "include/unguarded.h"
+#include "include/once.h"
+#include "include/../include/once.h"
+#include "include/once_copy.h"
+#include "include/once_same_size.h"
+#pragma weak ignored
+#include "include/missing.h"
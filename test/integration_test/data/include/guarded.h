@@ -0,0 +1,5 @@
+// comments are allowed around the guard
+#ifndef GUARDED_H
+#define GUARDED_H
+int guarded;
+#endif /* GUARDED_H */
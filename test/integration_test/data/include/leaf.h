@@ -0,0 +1 @@
+char leaf;
\ No newline at end of file
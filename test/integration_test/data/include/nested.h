@@ -0,0 +1,2 @@
+#include "leaf.h"
+long nested;
@@ -0,0 +1 @@
+float angled;
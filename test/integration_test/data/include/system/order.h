@@ -0,0 +1 @@
+double system;
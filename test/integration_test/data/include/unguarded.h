@@ -0,0 +1,4 @@
+#ifndef UNGUARDED_H
+#define UNGUARDED_H
+#endif
+int unguarded;
@@ -0,0 +1 @@
+short user;
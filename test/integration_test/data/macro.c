@@ -1,4 +1,4 @@
-#include <stdio.h>
+#include "macro.h"
 
 #define MACRO(a, b) ((a) + (b) + (c)) + "(c))"
 #define MACRO2(a, b) ((a) + (b))
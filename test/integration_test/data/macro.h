@@ -0,0 +1,2 @@
+int puts(const char* s);
+#define MACRO_H_VALUE 42
@@ -0,0 +1,40 @@
+/* A comment spanning
+ * several lines which
+ * contains "quotes" and 'ticks'
+ * #define NOT_A_MACRO 1
+ */
+#define SIZE 16
+#define ADD(a, b) ((a) + (b))
+
+struct Entry {
+	const char* name; // comment /* not nested
+	int value;
+};
+
+static const char* strings[] = {"first", "second /* no comment */",
+                                "third // no comment", "fou\
+rth"};
+
+int sum(int* values, int count)
+{
+	int result = 0;
+	/*
+	int unused = 10;
+	*/
+	for (int i = 0; i < count; i++) {
+		result = ADD(result, values[i]);
+	}
+	return result * SIZE;
+}
+
+#define SIZE2 SIZE
+
+double scale(double value)
+{
+	return value * 1.5e3 + 0x1f + 017 + 'a' + SIZE2;
+}
+
+int long_line = 1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 9 + 10 + 11 + 12 + 13 + 14 + \
+                15 + 16;
+
+/* final comment */
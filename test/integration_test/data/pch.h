@@ -0,0 +1,10 @@
+#ifndef PCH_H
+#define PCH_H
+
+#define PCH_VALUE 42
+#define PCH_STRING "precompiled"
+#define PCH_FLOAT 1.5f
+#define PCH_SUM(a, b) ((a) + (b) * PCH_VALUE)
+#define PCH_CHAR 'c'
+
+#endif
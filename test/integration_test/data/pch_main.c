@@ -0,0 +1,12 @@
+#include "pch.h"
+#include "pch.h"
+
+int value = PCH_VALUE;
+const char* string = PCH_STRING;
+float number = PCH_FLOAT;
+int sum = PCH_SUM(value, 3);
+char character = PCH_CHAR;
+const char* other = "not precompiled";
+double other_number = 2.5;
+#define PCH_VALUE 7
+int redefined = PCH_VALUE;
@@ -0,0 +1,85 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lexer.h"
+#include "memory/scratchpad.h"
+#include "test.h"
+
+static void expectDeclaration(struct LexerState* state, const char* name)
+{
+	struct LexerToken token;
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, KEYWORD_INT);
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, IDENTIFIER);
+	const char* identifier =
+	    getIdentifierName(&state->identifiers, token.value.string_index);
+	if (strcmp(identifier, name) != 0) {
+		fprintf(stderr, "expected %s but got %s\n", name, identifier);
+		EXPECT_TRUE(false);
+	}
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, PUNCTUATOR_SEMICOLON);
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "No input file specified!\n");
+		return 1;
+	}
+	if (scratchpadInit() != 0) {
+		fprintf(stderr, "Coud not initialize scrtchpad memory");
+		return 1;
+	}
+	struct LexerState state;
+	int result = initLexer(&state, argv[1]);
+	EXPECT_EQ_INT(result, 0);
+
+	expectDeclaration(&state, "if_taken");
+	expectDeclaration(&state, "elif_taken");
+	expectDeclaration(&state, "ifdef_taken");
+	expectDeclaration(&state, "elifdef_taken");
+	expectDeclaration(&state, "not_defined_taken");
+	expectDeclaration(&state, "elifndef_taken");
+	// comments, literals and continuations in skipped groups can not end
+	// the group
+	expectDeclaration(&state, "else_after_comments_taken");
+	expectDeclaration(&state, "backslash_in_comment_taken");
+	expectDeclaration(&state, "last_else_taken");
+	// expressions in #if
+	expectDeclaration(&state, "arithmetic_taken");
+	expectDeclaration(&state, "conversions_taken");
+	expectDeclaration(&state, "bit_operators_taken");
+	expectDeclaration(&state, "short_circuit_taken");
+	expectDeclaration(&state, "conditional_operator_taken");
+	expectDeclaration(&state, "defined_taken");
+	expectDeclaration(&state, "undef_taken");
+	expectDeclaration(&state, "redefined_after_undef_taken");
+	expectDeclaration(&state, "crlf_taken");
+	expectDeclaration(&state, "last_line_taken");
+
+	struct LexerToken token;
+	bool found = getNextToken(&state, &token);
+	EXPECT_TRUE(found);
+	EXPECT_EQ_INT(token.type, TOKEN_EOF);
+
+	cleanupLexer(&state);
+	scratchpadCleanup();
+	return 0;
+}
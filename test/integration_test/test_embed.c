@@ -0,0 +1,82 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lexer.h"
+#include "memory/scratchpad.h"
+#include "test.h"
+
+static void expectToken(struct LexerState* state, int type, int line)
+{
+	struct LexerToken token;
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, type);
+	EXPECT_EQ_INT(token.line + 1, line);
+}
+
+static void expectEmbed(struct LexerState* state, int line,
+                        size_t expected_size)
+{
+	struct LexerToken token;
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, LITERAL_EMBED);
+	EXPECT_EQ_INT(token.line + 1, line);
+	size_t size;
+	const unsigned char* data = getEmbeddedData(state, &token, &size);
+	EXPECT_EQ_INT((int)size, (int)expected_size);
+	int result = memcmp(data, "Hello embedded world\n", size);
+	EXPECT_EQ_INT(result, 0);
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "No input file specified!\n");
+		return 1;
+	}
+	if (scratchpadInit() != 0) {
+		fprintf(stderr, "Coud not initialize scrtchpad memory");
+		return 1;
+	}
+	struct LexerState state;
+	int result = initLexer(&state, argv[1]);
+	EXPECT_EQ_INT(result, 0);
+
+	expectEmbed(&state, 1, 21);
+
+	expectToken(&state, CONSTANT_INT, 2);
+	expectToken(&state, PUNCTUATOR_COMMA, 2);
+	expectEmbed(&state, 2, 5);
+	expectToken(&state, PUNCTUATOR_COMMA, 2);
+	expectToken(&state, CONSTANT_INT, 2);
+
+	// an empty file only produces the if_empty tokens
+	expectToken(&state, CONSTANT_INT, 3);
+
+	// a limit of zero makes the file empty
+	expectToken(&state, PUNCTUATOR_MINUS, 4);
+	expectToken(&state, CONSTANT_INT, 4);
+
+	expectToken(&state, KEYWORD_INT, 5);
+	expectToken(&state, IDENTIFIER, 5);
+	expectToken(&state, PUNCTUATOR_SEMICOLON, 5);
+	expectToken(&state, TOKEN_EOF, 6);
+
+	cleanupLexer(&state);
+	scratchpadCleanup();
+	return 0;
+}
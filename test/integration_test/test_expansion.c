@@ -0,0 +1,165 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "input_file.h"
+#include "lexer.h"
+#include "memory/scratchpad.h"
+#include "test.h"
+
+static bool compareTokens(struct LexerState* a_state,
+                          const struct LexerToken* a,
+                          struct LexerState* b_state,
+                          const struct LexerToken* b)
+{
+	if (a->type != b->type) {
+		return false;
+	}
+	switch (a->type) {
+		case IDENTIFIER:
+			return strcmp(getIdentifierName(&a_state->identifiers,
+			                                a->value.string_index),
+			              getIdentifierName(&b_state->identifiers,
+			                                b->value.string_index)) == 0;
+		case LITERAL_STRING:
+			return strcmp(getStringAt(&a_state->string_literals,
+			                          a->value.string_index),
+			              getStringAt(&b_state->string_literals,
+			                          b->value.string_index)) == 0;
+		case CONSTANT_CHAR:
+		case CONSTANT_UNSIGNED_CHAR:
+			return a->value.character_literal == b->value.character_literal;
+		case CONSTANT_INT:
+		case CONSTANT_UNSIGNED_INT:
+			return a->value.int_literal == b->value.int_literal;
+		default:
+			return true;
+	}
+}
+
+#define NUM_GENERATED_DEFINITIONS 4000
+
+static void expectGeneratedName(struct LexerState* state, const char* format,
+                                int index)
+{
+	char name[32];
+	struct LexerToken token;
+	snprintf(name, sizeof(name), format, index);
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, IDENTIFIER);
+	EXPECT_TRUE(strcmp(getIdentifierName(&state->identifiers,
+	                                     token.value.string_index),
+	                   name) == 0);
+}
+
+static void expectGeneratedDeclaration(struct LexerState* state,
+                                       const char* format, int index,
+                                       int num_names)
+{
+	struct LexerToken token;
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, KEYWORD_INT);
+	expectGeneratedName(state, "v%d", index);
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, PUNCTUATOR_ASSIGNMENT);
+	for (int i = 0; i < num_names; i++) {
+		expectGeneratedName(state, format, index);
+	}
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, PUNCTUATOR_SEMICOLON);
+}
+
+// Cached expansions of many uses of macros must not use up the room for the
+// definitions, whether the macros are redefined or not
+static void expandGeneratedDefinitions(void)
+{
+	size_t size = NUM_GENERATED_DEFINITIONS * 96;
+	char* buffer = malloc(size);
+	EXPECT_TRUE(buffer != NULL);
+	int length = snprintf(buffer, size, "#define A B\n");
+	for (int i = 0; i < NUM_GENERATED_DEFINITIONS; i++) {
+		length += snprintf(buffer + length, size - length,
+		                   "#undef B\n#define B i%d\nint v%d = A;\n", i, i);
+	}
+	for (int i = 0; i < NUM_GENERATED_DEFINITIONS; i++) {
+		length += snprintf(buffer + length, size - length,
+		                   "#define M%d m%d m%d\nint v%d = M%d;\n", i, i,
+		                   i, i, i);
+	}
+	struct InputFile file = {.name = "generated.c",
+	                         .full_path = "generated.c",
+	                         .buffer = buffer,
+	                         .file_size = length};
+	struct LexerState state;
+	int result = initLexerWithInputFile(&state, &file);
+	EXPECT_EQ_INT(result, 0);
+	for (int i = 0; i < NUM_GENERATED_DEFINITIONS; i++) {
+		expectGeneratedDeclaration(&state, "i%d", i, 1);
+	}
+	for (int i = 0; i < NUM_GENERATED_DEFINITIONS; i++) {
+		expectGeneratedDeclaration(&state, "m%d", i, 2);
+	}
+	struct LexerToken token;
+	EXPECT_TRUE(getNextToken(&state, &token));
+	EXPECT_EQ_INT(token.type, TOKEN_EOF);
+	cleanupLexer(&state);
+	free(buffer);
+}
+
+// The macros in the first file have to expand to the tokens of the second
+// file, which does not use the preprocessor.
+int main(int argc, const char** argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "Input and expected file required!\n");
+		return 1;
+	}
+	if (scratchpadInit() != 0) {
+		fprintf(stderr, "Coud not initialize scrtchpad memory");
+		return 1;
+	}
+	struct LexerState state;
+	struct LexerState expected_state;
+	int result = initLexer(&state, argv[1]);
+	EXPECT_EQ_INT(result, 0);
+	result = initLexer(&expected_state, argv[2]);
+	EXPECT_EQ_INT(result, 0);
+
+	while (true) {
+		struct LexerToken token;
+		struct LexerToken expected;
+		EXPECT_TRUE(getNextToken(&state, &token));
+		EXPECT_TRUE(getNextToken(&expected_state, &expected));
+		if (!compareTokens(&state, &token, &expected_state, &expected)) {
+			fprintf(stderr, "expected token in line %d differs\n",
+			        expected.line);
+			printToken(&state, &token);
+			printToken(&expected_state, &expected);
+			EXPECT_TRUE(false);
+		}
+		if (token.type == TOKEN_EOF) {
+			break;
+		}
+	}
+
+	cleanupLexer(&expected_state);
+	cleanupLexer(&state);
+	expandGeneratedDefinitions();
+	scratchpadCleanup();
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "include_search.h"
+#include "lexer.h"
+#include "memory/scratchpad.h"
+#include "test.h"
+
+static void expectToken(struct LexerState* state, int type, int line)
+{
+	struct LexerToken token;
+	EXPECT_TRUE(getNextToken(state, &token));
+	EXPECT_EQ_INT(token.type, type);
+	EXPECT_EQ_INT(token.line + 1, line);
+}
+
+static void expectDeclaration(struct LexerState* state, int type, int line)
+{
+	expectToken(state, type, line);
+	expectToken(state, IDENTIFIER, line);
+	expectToken(state, PUNCTUATOR_SEMICOLON, line);
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "No input file specified!\n");
+		return 1;
+	}
+	if (scratchpadInit() != 0) {
+		fprintf(stderr, "Coud not initialize scrtchpad memory");
+		return 1;
+	}
+	struct IncludeSearchPath include_path;
+	initIncludeSearchPath(&include_path);
+	// -I directories are searched first, regardless of the order
+	int result = addIncludeDirectory(&include_path, "include/system", true);
+	EXPECT_EQ_INT(result, 0);
+	result = addIncludeDirectory(&include_path, "include/user", false);
+	EXPECT_EQ_INT(result, 0);
+
+	struct LexerState state;
+	result = initLexer(&state, argv[1]);
+	EXPECT_EQ_INT(result, 0);
+	state.include_path = &include_path;
+
+	// nested.h includes leaf.h relative to its own directory
+	expectDeclaration(&state, KEYWORD_CHAR, 1);
+	expectDeclaration(&state, KEYWORD_LONG, 2);
+	expectDeclaration(&state, KEYWORD_INT, 2);
+	expectDeclaration(&state, KEYWORD_FLOAT, 1);
+	expectDeclaration(&state, KEYWORD_SHORT, 1);
+	// empty.h produces no tokens
+	expectDeclaration(&state, KEYWORD_INT, 6);
+	// the second inclusion of a file with an include guard is skipped
+	expectDeclaration(&state, KEYWORD_INT, 4);
+	expectDeclaration(&state, KEYWORD_INT, 4);
+	expectDeclaration(&state, KEYWORD_INT, 4);
+	// files with #pragma once are skipped when included through another
+	// path or as a copy with the same content
+	expectDeclaration(&state, KEYWORD_INT, 2);
+	// but not a file with the same size and another content
+	expectDeclaration(&state, KEYWORD_INT, 2);
+
+	struct LexerToken token;
+	bool found = getNextToken(&state, &token);
+	EXPECT_FALSE(found);
+
+	cleanupLexer(&state);
+	scratchpadCleanup();
+	return 0;
+}
@@ -22,52 +22,68 @@
 #include "lexer.h"
 #include "memory/scratchpad.h"
 
-int main(int argc, const char** argv)
+static void lexFile(struct LexerState* lexer_state)
 {
-	if (argc < 2) {
-		fprintf(stderr, "No input file specified!\n");
-		return 1;
-	}
-	if (scratchpadInit() != 0) {
-		fprintf(stderr, "Coud not initialize scrtchpad memory");
-		return 1;
-	}
-	struct LexerState lexer_state;
-	if (initLexer(&lexer_state, argv[1]) != 0) {
-		fprintf(stderr, "Could not initialize lexer\n");
-		return -1;
-	}
 	bool validInput = true;
 	while (validInput) {
 		struct LexerToken token;
-		validInput = getNextToken(&lexer_state, &token);
+		validInput = getNextToken(lexer_state, &token);
 		if (!validInput) {
-			lexerError(&lexer_state,
+			lexerError(lexer_state,
 			           "An unexpected error occured during lexing");
 			exit(1);
 		} else {
-			printToken(&lexer_state, &token);
+			printToken(lexer_state, &token);
 		}
 
 		if (token.type == TOKEN_EOF) {
 			break;
 		}
 	}
-	for (int i = 0;
-	     i < lexer_state.pp_state.definitions.pp_definition_names.num; i++) {
+	for (int i = 0; i < lexer_state->pp_state.definitions.num; i++) {
 		printf("begin %s\n",
-		       getStringAt(
-		           &lexer_state.pp_state.definitions.pp_definition_names, i));
-		int start = lexer_state.pp_state.definitions.definitions[i].token_start;
+		       getIdentifierName(
+		           &lexer_state->identifiers,
+		           lexer_state->pp_state.definitions.definitions[i].name));
+		int start =
+		    lexer_state->pp_state.definitions.definitions[i].token_start;
 		int end =
-		    lexer_state.pp_state.definitions.definitions[i].num_tokens + start;
+		    lexer_state->pp_state.definitions.definitions[i].num_tokens + start;
 		for (int j = start; j < end; j++) {
 			struct PreprocessorToken* pp_token =
-			    &lexer_state.pp_state.tokens.tokens[j];
+			    &lexer_state->pp_state.tokens.tokens[j];
 			struct LexerToken t;
-			createLexerTokenFromPPToken(&lexer_state, pp_token, &t);
-			printToken(&lexer_state, &t);
+			createLexerTokenFromPPToken(lexer_state, pp_token, &t);
+			printToken(lexer_state, &t);
+		}
+	}
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "No input file specified!\n");
+		return 1;
+	}
+	if (scratchpadInit() != 0) {
+		fprintf(stderr, "Coud not initialize scrtchpad memory");
+		return 1;
+	}
+	struct LexerState lexer_state;
+	if (initLexer(&lexer_state, argv[1]) != 0) {
+		fprintf(stderr, "Could not initialize lexer\n");
+		return -1;
+	}
+	lexFile(&lexer_state);
+	// further files reuse the lexer state
+	for (int i = 2; i < argc; i++) {
+		if (resetLexer(&lexer_state, argv[i], true) != 0) {
+			fprintf(stderr, "Could not reset lexer\n");
+			return -1;
 		}
+		lexFile(&lexer_state);
 	}
+	cleanupLexer(&lexer_state);
+	scratchpadCleanup();
 	return 0;
 }
@@ -0,0 +1,90 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+#include "lexer.h"
+#include "memory/scratchpad.h"
+#include "parallel_lexer.h"
+#include "parser.h"
+#include "test.h"
+
+static void lexSequentially(const char* file_path,
+                            struct LexerTokenBuffer* tokens)
+{
+	struct LexerState lexer_state;
+	int result = initLexer(&lexer_state, file_path);
+	EXPECT_EQ_INT(result, 0);
+	while (true) {
+		struct LexerToken token;
+		EXPECT_TRUE(getNextToken(&lexer_state, &token));
+		addLexerToken(tokens, &token);
+		if (token.type == TOKEN_EOF) {
+			break;
+		}
+	}
+	cleanupLexer(&lexer_state);
+}
+
+static void expectSameToken(const struct LexerToken* token,
+                            const struct LexerToken* expected)
+{
+	EXPECT_NE_PTR(token, NULL);
+	EXPECT_EQ_INT(token->type, expected->type);
+	EXPECT_EQ_INT(token->line, expected->line);
+	EXPECT_EQ_INT(token->column, expected->column);
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "No input file specified!\n");
+		return 1;
+	}
+	if (scratchpadInit() != 0) {
+		fprintf(stderr, "Coud not initialize scrtchpad memory");
+		return 1;
+	}
+	struct LexerTokenBuffer expected;
+	int result = initLexerTokenBuffer(&expected, 64);
+	EXPECT_EQ_INT(result, 0);
+	lexSequentially(argv[1], &expected);
+
+	struct LexerState lexer_state;
+	result = initLexer(&lexer_state, argv[1]);
+	EXPECT_EQ_INT(result, 0);
+	struct ParserState parser_state;
+	initParser(&parser_state, &lexer_state);
+
+	const struct LexerToken* eof = &expected.tokens[expected.num - 1];
+	for (int i = 0; i < expected.num + PARSER_MAX_LOOKAHEAD; i++) {
+		// look ahead with varying distances
+		int k = i % (PARSER_MAX_LOOKAHEAD + 1);
+		int index = MIN(i + k, expected.num - 1);
+		expectSameToken(peekToken(&parser_state, k), &expected.tokens[index]);
+		if (i < expected.num) {
+			expectSameToken(peekToken(&parser_state, 0), &expected.tokens[i]);
+		} else {
+			expectSameToken(peekToken(&parser_state, 0), eof);
+		}
+		EXPECT_TRUE(advanceToken(&parser_state));
+	}
+	cleanupLexer(&lexer_state);
+	cleanupLexerTokenBuffer(&expected);
+	scratchpadCleanup();
+	return 0;
+}
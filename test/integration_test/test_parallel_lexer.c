@@ -0,0 +1,109 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lexer.h"
+#include "memory/scratchpad.h"
+#include "parallel_lexer.h"
+#include "test.h"
+
+static bool lexSequentially(const char* file_path,
+                            struct LexerTokenBuffer* tokens)
+{
+	struct LexerState lexer_state;
+	if (initLexer(&lexer_state, file_path) != 0) {
+		return false;
+	}
+	bool status = true;
+	while (true) {
+		struct LexerToken token;
+		if (!getNextToken(&lexer_state, &token)) {
+			status = false;
+			break;
+		}
+		addLexerToken(tokens, &token);
+		if (token.type == TOKEN_EOF) {
+			break;
+		}
+	}
+	cleanupLexer(&lexer_state);
+	return status;
+}
+
+static bool compareTokens(const struct LexerToken* a,
+                          const struct LexerToken* b)
+{
+	if (a->type != b->type || a->line != b->line || a->column != b->column) {
+		return false;
+	}
+	switch (a->type) {
+		case IDENTIFIER:
+		case LITERAL_STRING:
+			return a->value.string_index == b->value.string_index;
+		case CONSTANT_CHAR:
+		case CONSTANT_UNSIGNED_CHAR:
+			return a->value.character_literal == b->value.character_literal;
+		case CONSTANT_INT:
+		case CONSTANT_UNSIGNED_INT:
+			return a->value.int_literal == b->value.int_literal;
+		case CONSTANT_FLOAT:
+			return a->value.float_literal == b->value.float_literal;
+		case CONSTANT_DOUBLE:
+			return a->value.double_literal == b->value.double_literal;
+		default:
+			return true;
+	}
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "No input file specified!\n");
+		return 1;
+	}
+	if (scratchpadInit() != 0) {
+		fprintf(stderr, "Coud not initialize scrtchpad memory");
+		return 1;
+	}
+	struct LexerTokenBuffer expected;
+	int result = initLexerTokenBuffer(&expected, 64);
+	EXPECT_EQ_INT(result, 0);
+	EXPECT_TRUE(lexSequentially(argv[1], &expected));
+
+	for (int num_threads = 2; num_threads <= 8; num_threads++) {
+		struct LexerState lexer_state;
+		struct LexerTokenBuffer tokens;
+		result = initLexerTokenBuffer(&tokens, 64);
+		EXPECT_EQ_INT(result, 0);
+		bool lexed = lexFileParallel(&lexer_state, argv[1], NULL, NULL,
+		                             num_threads, 1, &tokens);
+		EXPECT_TRUE(lexed);
+		EXPECT_EQ_INT(tokens.num, expected.num);
+		for (int i = 0; i < tokens.num; i++) {
+			if (!compareTokens(&tokens.tokens[i], &expected.tokens[i])) {
+				fprintf(stderr, "token %d differs\n", i);
+				printToken(&lexer_state, &tokens.tokens[i]);
+				EXPECT_TRUE(false);
+			}
+		}
+		cleanupLexerTokenBuffer(&tokens);
+		cleanupLexer(&lexer_state);
+	}
+	cleanupLexerTokenBuffer(&expected);
+	scratchpadCleanup();
+	return 0;
+}
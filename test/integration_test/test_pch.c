@@ -0,0 +1,211 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lexer.h"
+#include "memory/scratchpad.h"
+#include "parallel_lexer.h"
+#include "pch.h"
+#include "test.h"
+
+#define PCH_PATH "test_pch.pch"
+#define DAMAGED_PCH_PATH "test_pch_damaged.pch"
+
+static bool lexTokens(struct LexerState* state, struct LexerTokenBuffer* tokens)
+{
+	while (true) {
+		struct LexerToken token;
+		if (!getNextToken(state, &token)) {
+			return false;
+		}
+		addLexerToken(tokens, &token);
+		if (token.type == TOKEN_EOF) {
+			return true;
+		}
+	}
+}
+
+// The string indices differ between the lexers, so strings are compared by
+// their content
+static bool compareTokens(struct LexerState* a_state,
+                          const struct LexerToken* a,
+                          struct LexerState* b_state,
+                          const struct LexerToken* b)
+{
+	if (a->type != b->type || a->line != b->line || a->column != b->column) {
+		return false;
+	}
+	switch (a->type) {
+		case IDENTIFIER:
+			return strcmp(getIdentifierName(&a_state->identifiers,
+			                                a->value.string_index),
+			              getIdentifierName(&b_state->identifiers,
+			                                b->value.string_index)) == 0;
+		case LITERAL_STRING:
+			return strcmp(getStringAt(&a_state->string_literals,
+			                          a->value.string_index),
+			              getStringAt(&b_state->string_literals,
+			                          b->value.string_index)) == 0;
+		case CONSTANT_CHAR:
+			return a->value.character_literal == b->value.character_literal;
+		case CONSTANT_INT:
+			return a->value.int_literal == b->value.int_literal;
+		case CONSTANT_FLOAT:
+			return a->value.float_literal == b->value.float_literal;
+		case CONSTANT_DOUBLE:
+			return a->value.double_literal == b->value.double_literal;
+		default:
+			return true;
+	}
+}
+
+static void expectSameTokens(struct LexerState* expected_state,
+                             const struct LexerTokenBuffer* expected,
+                             struct LexerState* state,
+                             const struct LexerTokenBuffer* tokens)
+{
+	EXPECT_EQ_INT(tokens->num, expected->num);
+	for (int i = 0; i < tokens->num; i++) {
+		if (!compareTokens(expected_state, &expected->tokens[i], state,
+		                   &tokens->tokens[i])) {
+			fprintf(stderr, "token %d differs\n", i);
+			printToken(state, &tokens->tokens[i]);
+			EXPECT_TRUE(false);
+		}
+	}
+}
+
+static bool copyFile(const char* from, const char* to, long damaged_offset)
+{
+	FILE* in = fopen(from, "rb");
+	FILE* out = fopen(to, "wb");
+	bool copied = in != NULL && out != NULL;
+	long offset = 0;
+	int c;
+	while (copied && (c = fgetc(in)) != EOF) {
+		copied = fputc(offset++ == damaged_offset ? 0xff : c, out) != EOF;
+	}
+	if (in != NULL) {
+		fclose(in);
+	}
+	if (out != NULL && fclose(out) != 0) {
+		copied = false;
+	}
+	return copied;
+}
+
+// A damaged header is either rejected or only refers to its own entries, which
+// the sanitizers check while it is used
+static void useDamagedHeaders(const char* input_path)
+{
+	FILE* file = fopen(PCH_PATH, "rb");
+	EXPECT_TRUE(file != NULL);
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	for (long offset = 0; offset < size; offset++) {
+		EXPECT_TRUE(copyFile(PCH_PATH, DAMAGED_PCH_PATH, offset));
+		struct PrecompiledHeader pch;
+		if (loadPrecompiledHeader(&pch, DAMAGED_PCH_PATH) != 0) {
+			continue;
+		}
+		struct LexerState state;
+		struct LexerTokenBuffer tokens;
+		int result = initLexer(&state, input_path);
+		EXPECT_EQ_INT(result, 0);
+		result = initLexerTokenBuffer(&tokens, 64);
+		EXPECT_EQ_INT(result, 0);
+		if (usePrecompiledHeader(&state, &pch) == 0) {
+			lexTokens(&state, &tokens);
+		}
+		cleanupLexerTokenBuffer(&tokens);
+		cleanupLexer(&state);
+		unloadPrecompiledHeader(&pch);
+	}
+	remove(DAMAGED_PCH_PATH);
+	// a truncated header is rejected
+	EXPECT_TRUE(copyFile(PCH_PATH, DAMAGED_PCH_PATH, -1));
+	int result = truncate(DAMAGED_PCH_PATH, size / 2);
+	EXPECT_EQ_INT(result, 0);
+	struct PrecompiledHeader pch;
+	result = loadPrecompiledHeader(&pch, DAMAGED_PCH_PATH);
+	EXPECT_TRUE(result != 0);
+	remove(DAMAGED_PCH_PATH);
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "No header and input file specified!\n");
+		return 1;
+	}
+	if (scratchpadInit() != 0) {
+		fprintf(stderr, "Coud not initialize scrtchpad memory");
+		return 1;
+	}
+	struct LexerState expected_state;
+	struct LexerTokenBuffer expected;
+	int result = initLexerTokenBuffer(&expected, 64);
+	EXPECT_EQ_INT(result, 0);
+	result = initLexer(&expected_state, argv[2]);
+	EXPECT_EQ_INT(result, 0);
+	EXPECT_TRUE(lexTokens(&expected_state, &expected));
+
+	struct LexerState state;
+	struct LexerTokenBuffer tokens;
+	result = initLexer(&state, argv[1]);
+	EXPECT_EQ_INT(result, 0);
+	result = initLexerTokenBuffer(&tokens, 64);
+	EXPECT_EQ_INT(result, 0);
+	EXPECT_TRUE(lexTokens(&state, &tokens));
+	result = writePrecompiledHeader(&state, PCH_PATH);
+	EXPECT_EQ_INT(result, 0);
+	cleanupLexer(&state);
+
+	useDamagedHeaders(argv[2]);
+	struct PrecompiledHeader pch;
+	result = loadPrecompiledHeader(&pch, PCH_PATH);
+	EXPECT_EQ_INT(result, 0);
+	remove(PCH_PATH);
+
+	// the includes of the header are skipped because of its include guard
+	result = initLexer(&state, argv[2]);
+	EXPECT_EQ_INT(result, 0);
+	result = usePrecompiledHeader(&state, &pch);
+	EXPECT_EQ_INT(result, 0);
+	tokens.num = 0;
+	EXPECT_TRUE(lexTokens(&state, &tokens));
+	expectSameTokens(&expected_state, &expected, &state, &tokens);
+	cleanupLexer(&state);
+
+	for (int num_threads = 2; num_threads <= 4; num_threads++) {
+		tokens.num = 0;
+		bool lexed = lexFileParallel(&state, argv[2], NULL, &pch, num_threads,
+		                             1, &tokens);
+		EXPECT_TRUE(lexed);
+		expectSameTokens(&expected_state, &expected, &state, &tokens);
+		cleanupLexer(&state);
+	}
+
+	unloadPrecompiledHeader(&pch);
+	cleanupLexerTokenBuffer(&tokens);
+	cleanupLexer(&expected_state);
+	cleanupLexerTokenBuffer(&expected);
+	scratchpadCleanup();
+	return 0;
+}
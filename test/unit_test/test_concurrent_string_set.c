@@ -0,0 +1,166 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "concurrent_string_set.h"
+#include "hash.h"
+#include "memory/allocator.h"
+#include "test.h"
+
+#define NUM_THREADS 8
+#define NUM_SHARED_STRINGS 5000
+#define NUM_OWN_STRINGS 500
+#define LONG_STRING_LENGTH 20000
+
+struct Worker {
+	pthread_t thread;
+	struct ConcurrentStringSet* set;
+	int id;
+	int shared[NUM_SHARED_STRINGS];
+	int own[NUM_OWN_STRINGS];
+	int long_string;
+};
+
+static char long_string[LONG_STRING_LENGTH];
+
+static int intern(struct ConcurrentStringSet* set, const char* string,
+                  int length)
+{
+	return internConcurrentString(set, string, length,
+	                              hashBytes(string, length), NULL);
+}
+
+// Every thread interns all shared strings, starting at a different position,
+// and strings nobody else sees
+static void* internStrings(void* data)
+{
+	struct Worker* worker = data;
+	char buffer[32];
+	for (int i = 0; i < NUM_SHARED_STRINGS; i++) {
+		int n = (i + worker->id * NUM_SHARED_STRINGS / NUM_THREADS) %
+		        NUM_SHARED_STRINGS;
+		int length = snprintf(buffer, sizeof(buffer), "shared%d", n);
+		worker->shared[n] = intern(worker->set, buffer, length);
+		if (i % 10 == 0) {
+			int own = i / 10;
+			length = snprintf(buffer, sizeof(buffer), "own%d_%d", worker->id,
+			                  own);
+			worker->own[own] = intern(worker->set, buffer, length);
+		}
+	}
+	worker->long_string =
+	    intern(worker->set, long_string, sizeof(long_string));
+	return NULL;
+}
+
+static void testConcurrentInterning(void)
+{
+	// start small to force the shards to grow while other threads read
+	struct ConcurrentStringSet set;
+	int result = initConcurrentStringSet(&set, 16, getGlobalAllocator());
+	EXPECT_EQ_INT(result, 0);
+	memset(long_string, 'x', sizeof(long_string));
+
+	static struct Worker workers[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		workers[i].set = &set;
+		workers[i].id = i;
+		result = pthread_create(&workers[i].thread, NULL, internStrings,
+		                        &workers[i]);
+		EXPECT_EQ_INT(result, 0);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	int num_strings = getConcurrentStringCount(&set);
+	EXPECT_EQ_INT(num_strings,
+	              NUM_SHARED_STRINGS + NUM_THREADS * NUM_OWN_STRINGS + 1);
+
+	// all threads agree on the indices and every index is used exactly once
+	static bool used[NUM_SHARED_STRINGS + NUM_THREADS * NUM_OWN_STRINGS + 1];
+	char buffer[32];
+	for (int i = 0; i < NUM_SHARED_STRINGS; i++) {
+		int index = workers[0].shared[i];
+		for (int j = 1; j < NUM_THREADS; j++) {
+			EXPECT_EQ_INT(workers[j].shared[i], index);
+		}
+		EXPECT_FALSE(used[index]);
+		used[index] = true;
+		int length = snprintf(buffer, sizeof(buffer), "shared%d", i);
+		int cmp = strcmp(getConcurrentStringAt(&set, index), buffer);
+		EXPECT_EQ_INT(cmp, 0);
+		int stored_length = getConcurrentLengthAt(&set, index);
+		EXPECT_EQ_INT(stored_length, length);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		for (int j = 0; j < NUM_OWN_STRINGS; j++) {
+			int index = workers[i].own[j];
+			EXPECT_FALSE(used[index]);
+			used[index] = true;
+			snprintf(buffer, sizeof(buffer), "own%d_%d", i, j);
+			int cmp = strcmp(getConcurrentStringAt(&set, index), buffer);
+			EXPECT_EQ_INT(cmp, 0);
+		}
+		EXPECT_EQ_INT(workers[i].long_string, workers[0].long_string);
+	}
+	int index = workers[0].long_string;
+	EXPECT_FALSE(used[index]);
+	int cmp = memcmp(getConcurrentStringAt(&set, index), long_string,
+	                 LONG_STRING_LENGTH);
+	EXPECT_EQ_INT(cmp, 0);
+
+	bool exists = false;
+	index = internConcurrentString(&set, "shared42", 8,
+	                               hashBytes("shared42", 8), &exists);
+	EXPECT_EQ_INT(index, workers[0].shared[42]);
+	EXPECT_TRUE(exists);
+	index = findConcurrentString(&set, "missing", 7, hashBytes("missing", 7));
+	EXPECT_EQ_INT(index, -1);
+	cleanupConcurrentStringSet(&set);
+}
+
+static void testCollisions(void)
+{
+	struct ConcurrentStringSet set;
+	int result = initConcurrentStringSet(&set, 64, getGlobalAllocator());
+	EXPECT_EQ_INT(result, 0);
+
+	// all strings share the same hash and have to be told apart by content
+	const char* strings[] = {"a", "b", "ab", "ba", "abc"};
+	for (int i = 0; i < 5; i++) {
+		int index = internConcurrentString(&set, strings[i], strlen(strings[i]),
+		                                   42, NULL);
+		EXPECT_EQ_INT(index, i);
+	}
+	for (int i = 0; i < 5; i++) {
+		int index =
+		    findConcurrentString(&set, strings[i], strlen(strings[i]), 42);
+		EXPECT_EQ_INT(index, i);
+	}
+	int index = findConcurrentString(&set, "c", 1, 42);
+	EXPECT_EQ_INT(index, -1);
+	cleanupConcurrentStringSet(&set);
+}
+
+int main()
+{
+	testConcurrentInterning();
+	testCollisions();
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include_search.h"
+#include "memory/allocator.h"
+#include "test.h"
+
+#define TEST_DIR "include_search_files"
+#define PATH_SIZE 256
+
+static void createFile(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	EXPECT_TRUE(file != NULL);
+	fclose(file);
+}
+
+static void setUp(void)
+{
+	mkdir(TEST_DIR, 0755);
+	mkdir(TEST_DIR "/user", 0755);
+	mkdir(TEST_DIR "/system", 0755);
+	mkdir(TEST_DIR "/system/sys", 0755);
+	createFile(TEST_DIR "/main.c");
+	createFile(TEST_DIR "/local.h");
+	createFile(TEST_DIR "/user/both.h");
+	createFile(TEST_DIR "/system/both.h");
+	createFile(TEST_DIR "/system/local.h");
+	createFile(TEST_DIR "/system/sys/types.h");
+}
+
+static void tearDown(void)
+{
+	remove(TEST_DIR "/main.c");
+	remove(TEST_DIR "/local.h");
+	remove(TEST_DIR "/late.h");
+	remove(TEST_DIR "/user/both.h");
+	remove(TEST_DIR "/system/both.h");
+	remove(TEST_DIR "/system/local.h");
+	remove(TEST_DIR "/system/sys/types.h");
+	rmdir(TEST_DIR "/system/sys");
+	rmdir(TEST_DIR "/system");
+	rmdir(TEST_DIR "/user");
+	rmdir(TEST_DIR);
+}
+
+static void expectFound(struct IncludeCache* cache,
+                        const struct IncludeSearchPath* search_path,
+                        const char* name, bool quoted, const char* expected)
+{
+	char path[PATH_SIZE];
+	struct FileId id;
+	int result = findIncludeFile(search_path, name, quoted, TEST_DIR "/main.c",
+	                             path, PATH_SIZE, &id);
+	EXPECT_EQ_INT(result, 0);
+	int cmp = strcmp(path, expected);
+	EXPECT_EQ_INT(cmp, 0);
+
+	// a cached lookup gives the same result, the first time and afterwards
+	for (int i = 0; i < 2; i++) {
+		struct FileId cached_id;
+		result = findCachedIncludeFile(cache, search_path, name, quoted,
+		                               TEST_DIR "/main.c", path, PATH_SIZE,
+		                               &cached_id);
+		EXPECT_EQ_INT(result, 0);
+		cmp = strcmp(path, expected);
+		EXPECT_EQ_INT(cmp, 0);
+		cmp = memcmp(&id, &cached_id, sizeof(id));
+		EXPECT_EQ_INT(cmp, 0);
+	}
+}
+
+static void testSearchOrder(void)
+{
+	struct IncludeSearchPath search_path;
+	initIncludeSearchPath(&search_path);
+	int result = addIncludeDirectory(&search_path, TEST_DIR "/missing", true);
+	EXPECT_EQ_INT(result, 0);
+	result = addIncludeDirectory(&search_path, TEST_DIR "/system/", true);
+	EXPECT_EQ_INT(result, 0);
+	result = addIncludeDirectory(&search_path, TEST_DIR "/user", false);
+	EXPECT_EQ_INT(result, 0);
+
+	struct IncludeCache cache;
+	initIncludeCache(&cache, getGlobalAllocator());
+	expectFound(&cache, &search_path, "local.h", true, TEST_DIR "/local.h");
+	expectFound(&cache, &search_path, "local.h", false,
+	            TEST_DIR "/system/local.h");
+	expectFound(&cache, &search_path, "both.h", false, TEST_DIR "/user/both.h");
+	expectFound(&cache, &search_path, "sys/types.h", false,
+	            TEST_DIR "/system/sys/types.h");
+	cleanupIncludeCache(&cache);
+}
+
+static void testNegativeCaching(void)
+{
+	struct IncludeSearchPath search_path;
+	initIncludeSearchPath(&search_path);
+	struct IncludeCache cache;
+	initIncludeCache(&cache, getGlobalAllocator());
+
+	char path[PATH_SIZE];
+	struct FileId id;
+	int result =
+	    findCachedIncludeFile(&cache, &search_path, "late.h", true,
+	                          TEST_DIR "/main.c", path, PATH_SIZE, &id);
+	EXPECT_EQ_INT(result, -1);
+
+	// a file that appears later is not seen through the cache
+	createFile(TEST_DIR "/late.h");
+	result = findIncludeFile(&search_path, "late.h", true, TEST_DIR "/main.c",
+	                         path, PATH_SIZE, &id);
+	EXPECT_EQ_INT(result, 0);
+	result = findCachedIncludeFile(&cache, &search_path, "late.h", true,
+	                               TEST_DIR "/main.c", path, PATH_SIZE, &id);
+	EXPECT_EQ_INT(result, -1);
+
+	// the cache is cleared when it is used with another search path
+	struct IncludeSearchPath other_path;
+	initIncludeSearchPath(&other_path);
+	result = findCachedIncludeFile(&cache, &other_path, "late.h", true,
+	                               TEST_DIR "/main.c", path, PATH_SIZE, &id);
+	EXPECT_EQ_INT(result, 0);
+	cleanupIncludeCache(&cache);
+}
+
+int main()
+{
+	tearDown();
+	setUp();
+	testSearchOrder();
+	testNegativeCaching();
+	tearDown();
+	return 0;
+}
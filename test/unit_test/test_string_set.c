@@ -0,0 +1,242 @@
+/*	Copyright (C) 2021 David Leiter
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdalign.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memory/allocator.h"
+#include "string_set.h"
+#include "test.h"
+
+#define NUM_STRINGS 5000
+
+static void testInsertAndFind(void)
+{
+	// start small to force the set to grow several times
+	struct StringSet set;
+	int result = initStringSet(&set, 64, 4, getGlobalAllocator());
+	EXPECT_EQ_INT(result, 0);
+
+	char buffer[32];
+	const char* first = NULL;
+	for (int i = 0; i < NUM_STRINGS; i++) {
+		int length = snprintf(buffer, sizeof(buffer), "string%d", i);
+		bool exists = true;
+		int index = addStringAndHash(&set, buffer, length,
+		                             hashSubstring(buffer, length), &exists);
+		EXPECT_EQ_INT(index, i);
+		EXPECT_FALSE(exists);
+		if (i == 0) {
+			first = getStringAt(&set, 0);
+		}
+	}
+	// stored strings are never moved
+	EXPECT_EQ_PTR(getStringAt(&set, 0), first);
+
+	int index;
+	for (int i = 0; i < NUM_STRINGS; i++) {
+		int length = snprintf(buffer, sizeof(buffer), "string%d", i);
+		uint32_t hash = hashSubstring(buffer, length);
+		index = findIndex(&set, buffer, length, hash);
+		EXPECT_EQ_INT(index, i);
+		bool exists = false;
+		index = addStringAndHash(&set, buffer, length, hash, &exists);
+		EXPECT_EQ_INT(index, i);
+		EXPECT_TRUE(exists);
+		int cmp = strcmp(getStringAt(&set, i), buffer);
+		EXPECT_EQ_INT(cmp, 0);
+	}
+	index = findIndex(&set, "missing", 7, hashSubstring("missing", 7));
+	EXPECT_EQ_INT(index, -1);
+	cleanupStringSet(&set);
+}
+
+static void testLongStrings(void)
+{
+	struct StringSet set;
+	int result = initStringSet(&set, 16, 4, getGlobalAllocator());
+	EXPECT_EQ_INT(result, 0);
+
+	char long_string[100];
+	memset(long_string, 'x', sizeof(long_string));
+	int index = addString(&set, "short", 5);
+	EXPECT_EQ_INT(index, 0);
+	index = addString(&set, long_string, sizeof(long_string));
+	EXPECT_EQ_INT(index, 1);
+	index = addString(&set, "after", 5);
+	EXPECT_EQ_INT(index, 2);
+
+	int length = getLengthAt(&set, 1);
+	EXPECT_EQ_INT(length, sizeof(long_string));
+	int cmp = memcmp(getStringAt(&set, 1), long_string, sizeof(long_string));
+	EXPECT_EQ_INT(cmp, 0);
+	cmp = strcmp(getStringAt(&set, 0), "short");
+	EXPECT_EQ_INT(cmp, 0);
+	cmp = strcmp(getStringAt(&set, 2), "after");
+	EXPECT_EQ_INT(cmp, 0);
+
+	resetStringSet(&set);
+	index = addString(&set, long_string, sizeof(long_string));
+	EXPECT_EQ_INT(index, 0);
+	cleanupStringSet(&set);
+}
+
+static void testInlineStrings(void)
+{
+	struct StringSet set;
+	int result = initStringSet(&set, 64, 4, getGlobalAllocator());
+	EXPECT_EQ_INT(result, 0);
+
+	// prefixes of one string around the inline length, read from the end of
+	// a page to cover keys that can not be loaded past the string
+	const char* text = "abcdefghijklmnopqrstuvwxyz0123456789";
+	int max_length = strlen(text);
+	static alignas(4096) char page[2 * 4096];
+	for (int length = 0; length <= max_length; length++) {
+		char* string = page + 4096 - length;
+		memcpy(string, text, length);
+		int index = addString(&set, string, length);
+		EXPECT_EQ_INT(index, length);
+	}
+	for (int length = 0; length <= max_length; length++) {
+		int index = findIndex(&set, text, length, hashSubstring(text, length));
+		EXPECT_EQ_INT(index, length);
+		int stored_length = getLengthAt(&set, length);
+		EXPECT_EQ_INT(stored_length, length);
+		const char* string = getStringAt(&set, length);
+		int cmp = memcmp(string, text, length);
+		EXPECT_EQ_INT(cmp, 0);
+		EXPECT_EQ_INT(string[length], '\0');
+	}
+	cleanupStringSet(&set);
+}
+
+static void testCollisions(void)
+{
+	struct StringSet set;
+	int result = initStringSet(&set, 4096, 64, getGlobalAllocator());
+	EXPECT_EQ_INT(result, 0);
+
+	// all strings share the same hash and have to be told apart by content
+	const char* strings[] = {"a", "b", "ab", "ba", "abc"};
+	for (int i = 0; i < 5; i++) {
+		int index = addStringAndHash(&set, strings[i], strlen(strings[i]), 42,
+		                             NULL);
+		EXPECT_EQ_INT(index, i);
+	}
+	for (int i = 0; i < 5; i++) {
+		int index = findIndex(&set, strings[i], strlen(strings[i]), 42);
+		EXPECT_EQ_INT(index, i);
+	}
+	int index = findIndex(&set, "c", 1, 42);
+	EXPECT_EQ_INT(index, -1);
+
+	resetStringSet(&set);
+	index = findIndex(&set, "a", 1, 42);
+	EXPECT_EQ_INT(index, -1);
+	index = addStringAndHash(&set, "abc", 3, 42, NULL);
+	EXPECT_EQ_INT(index, 0);
+	cleanupStringSet(&set);
+}
+
+static void testSnapshot(void)
+{
+	const char* path = "test_string_set.snapshot";
+	struct StringSet set;
+	int result = initStringSet(&set, 64, 4, getGlobalAllocator());
+	EXPECT_EQ_INT(result, 0);
+	char buffer[32];
+	for (int i = 0; i < NUM_STRINGS; i++) {
+		int length = snprintf(buffer, sizeof(buffer), "string%d", i);
+		addString(&set, buffer, length);
+	}
+	result = writeStringSetSnapshot(&set, path);
+	EXPECT_EQ_INT(result, 0);
+	cleanupStringSet(&set);
+
+	struct StringSetSnapshot snapshot;
+	result = loadStringSetSnapshot(&snapshot, path);
+	EXPECT_EQ_INT(result, 0);
+	int count = getStringCount(&snapshot.set);
+	EXPECT_EQ_INT(count, NUM_STRINGS);
+
+	// new strings go into the upper layer and are numbered after the base
+	struct StringSet upper;
+	result = initStringSet(&upper, 64, 4, getGlobalAllocator());
+	EXPECT_EQ_INT(result, 0);
+	setStringSetBase(&upper, &snapshot.set);
+	for (int i = 0; i < 2 * NUM_STRINGS; i++) {
+		int length = snprintf(buffer, sizeof(buffer), "string%d", i);
+		bool exists = false;
+		int index = addStringAndHash(&upper, buffer, length,
+		                             hashSubstring(buffer, length), &exists);
+		EXPECT_EQ_INT(index, i);
+		EXPECT_EQ_INT(exists, i < NUM_STRINGS);
+		int cmp = strcmp(getStringAt(&upper, i), buffer);
+		EXPECT_EQ_INT(cmp, 0);
+		int stored_length = getLengthAt(&upper, i);
+		EXPECT_EQ_INT(stored_length, length);
+	}
+	count = getStringCount(&upper);
+	EXPECT_EQ_INT(count, 2 * NUM_STRINGS);
+	int index = findIndex(&upper, "string42", 8, hashSubstring("string42", 8));
+	EXPECT_EQ_INT(index, 42);
+	index = findIndex(&upper, "missing", 7, hashSubstring("missing", 7));
+	EXPECT_EQ_INT(index, -1);
+
+	// a layered set is written as a whole
+	result = writeStringSetSnapshot(&upper, path);
+	EXPECT_EQ_INT(result, 0);
+	cleanupStringSet(&upper);
+	unloadStringSetSnapshot(&snapshot);
+	result = loadStringSetSnapshot(&snapshot, path);
+	EXPECT_EQ_INT(result, 0);
+	count = getStringCount(&snapshot.set);
+	EXPECT_EQ_INT(count, 2 * NUM_STRINGS);
+	index = findIndex(&snapshot.set, "string7777", 10,
+	                  hashSubstring("string7777", 10));
+	EXPECT_EQ_INT(index, 7777);
+	result = verifyStringSetSnapshot(&snapshot);
+	EXPECT_EQ_INT(result, 0);
+
+	// entries are loaded aligned, so misaligned data is rejected
+	struct StringSetSnapshot view;
+	result = viewStringSetSnapshot(&view, snapshot.data + 1,
+	                               snapshot.size - 1);
+	EXPECT_EQ_INT(result, -1);
+	unloadStringSetSnapshot(&snapshot);
+
+	// files of another version are rejected
+	FILE* file = fopen(path, "r+b");
+	EXPECT_TRUE(file != NULL);
+	uint32_t version = STRING_SET_SNAPSHOT_VERSION + 1;
+	fseek(file, 8, SEEK_SET);
+	fwrite(&version, sizeof(version), 1, file);
+	fclose(file);
+	result = loadStringSetSnapshot(&snapshot, path);
+	EXPECT_EQ_INT(result, -1);
+	remove(path);
+}
+
+int main()
+{
+	testInsertAndFind();
+	testLongStrings();
+	testInlineStrings();
+	testCollisions();
+	testSnapshot();
+	return 0;
+}